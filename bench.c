@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "controller.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Decision step microbenchmark
+//  - Times smoothing + one controller_step per sample for each curve and filter over the same
+//    synthetic trace, at the daemon's default limits
+//
+//  Usage: ./pwm_fan_bench {steps optional} {smooth_window optional}
+//
+
+// Default # of steps per run and smoothing window
+#define BENCH_STEPS_DEFAULT  2000000
+#define BENCH_WINDOW_DEFAULT 4
+
+// Synthetic trace length; replayed in a loop so it stays cache resident like a real tick
+#define BENCH_TRACE_SIZE 4096
+
+// Simulated tick in ns
+#define BENCH_TICK_NS 250000000LL
+
+typedef struct {
+    const char *name;
+    const char *curve_str;
+    int control_mode;
+} BenchControl;
+
+static const BenchControl BENCH_CONTROLS[] = {
+    { "quartic", "quartic", CONTROL_CURVE },
+    { "cubic",   "cubic",   CONTROL_CURVE },
+    { "sine",    "sine",    CONTROL_CURVE },
+    { "linear",  "linear",  CONTROL_CURVE },
+    { "points",  "points",  CONTROL_CURVE },
+    { "pid",     "linear",  CONTROL_PID },
+    { "pid_rpm", "linear",  CONTROL_PID_RPM }
+};
+
+static const char *BENCH_FILTERS[] = { "sma", "ema", "median" };
+
+// Random walk between 30C and 50C so every band and the grace period are hit
+void bench_trace( int *trace ) {
+
+    unsigned int seed = 12345;
+    int temp_mc = 40000;
+
+    for( int i = 0; i < BENCH_TRACE_SIZE; i++ ) {
+
+        seed = seed * 1103515245 + 12345;
+        temp_mc += ( int ) ( ( seed >> 16 ) % 1001 ) - 500;
+
+        if( temp_mc < 30000 ) { temp_mc = 30000; }
+        if( temp_mc > 50000 ) { temp_mc = 50000; }
+
+        trace[i] = temp_mc;
+    }
+}
+
+// Controller at the daemon's default limits
+void bench_controller( Controller *ctl, const BenchControl *control ) {
+
+    memset( ctl, 0, sizeof( *ctl ) );
+
+    ctl->min_duty_cycle   = 20;
+    ctl->max_duty_cycle   = 100;
+    ctl->fan_off_grace_ms = 60000;
+    ctl->min_off_temp_mc  = 38000;
+    ctl->min_on_temp_mc   = 40000;
+    ctl->max_temp_mc      = 46000;
+    ctl->control_mode     = control->control_mode;
+    ctl->pid_target_mc    = 43000;
+    ctl->pid_max_rpm      = 3000;
+
+    ctl->temp_pid.kp_milli     = 4000;
+    ctl->temp_pid.ki_milli     = 200;
+    ctl->temp_pid.error_scale  = 1000;
+    ctl->temp_pid.out_min_mpct = ctl->min_duty_cycle * 1000LL;
+    ctl->temp_pid.out_max_mpct = ctl->max_duty_cycle * 1000LL;
+
+    ctl->rpm_pid.kp_milli     = 10;
+    ctl->rpm_pid.ki_milli     = 20;
+    ctl->rpm_pid.error_scale  = 1;
+    ctl->rpm_pid.out_min_mpct = ctl->min_duty_cycle * 1000LL;
+    ctl->rpm_pid.out_max_mpct = ctl->max_duty_cycle * 1000LL;
+
+    ctl->curve_points[0] = ( CurvePoint ) { 38000, 20 };
+    ctl->curve_points[1] = ( CurvePoint ) { 42000, 50 };
+    ctl->curve_points[2] = ( CurvePoint ) { 46000, 100 };
+    ctl->curve_point_count = 3;
+}
+
+long long bench_now_ns() {
+
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return ( long long ) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+int main( int argc, char* argv[] ) {
+
+    unsigned long steps  = argc > 1 ? strtoul( argv[1], NULL, 10 ) : BENCH_STEPS_DEFAULT;
+    unsigned int window  = argc > 2 ? strtoul( argv[2], NULL, 10 ) : BENCH_WINDOW_DEFAULT;
+
+    static int trace[ BENCH_TRACE_SIZE ];
+    unsigned long long checksum = 0;
+
+    if( steps == 0 ) {
+
+        fprintf( stderr, "Usage: %s {steps optional} {smooth_window optional}\n", argv[0] );
+        return 1;
+    }
+
+    bench_trace( trace );
+
+    printf( "%lu steps per run, smoothing window %u\n\n", steps, window );
+    printf( "%-8s %-7s %10s\n", "control", "filter", "ns/step" );
+
+    for( size_t i = 0; i < sizeof( BENCH_CONTROLS ) / sizeof( BENCH_CONTROLS[0] ); i++ ) {
+
+        for( size_t j = 0; j < sizeof( BENCH_FILTERS ) / sizeof( BENCH_FILTERS[0] ); j++ ) {
+
+            Controller ctl;
+            SmoothFilter smooth;
+            CurveShapeFunc shape_func;
+
+            bench_controller( &ctl, &BENCH_CONTROLS[i] );
+            curve_shape_from_name( BENCH_CONTROLS[i].curve_str, &shape_func );
+
+            if( ! smooth_setup( &smooth, BENCH_FILTERS[j], window ) || ! curve_compile( &ctl, shape_func ) ) {
+
+                fprintf( stderr, "Error: smoothing window must be 1-%i!\n", SMOOTH_WINDOW_MAX );
+                return 1;
+            }
+
+            ControllerSample sample = { 0 };
+            controller_start( &ctl, 0 );
+
+            long long start_ns = bench_now_ns();
+
+            for( unsigned long step = 0; step < steps; step++ ) {
+
+                sample.cur_temp_mc = trace[ step % BENCH_TRACE_SIZE ];
+                sample.now_ns      = step * BENCH_TICK_NS;
+                sample.tach_rpm    = ctl.duty_cycle_set_val * 30;
+
+                smooth_push( &smooth, sample.cur_temp_mc );
+                sample.smooth_temp_mc = smooth_value( &smooth );
+
+                checksum += controller_step( &ctl, &sample ).duty_cycle;
+            }
+
+            long long elapsed_ns = bench_now_ns() - start_ns;
+
+            printf( "%-8s %-7s %10.2f\n", BENCH_CONTROLS[i].name, BENCH_FILTERS[j], ( double ) elapsed_ns / steps );
+
+            curve_free( &ctl );
+            smooth_free( &smooth );
+        }
+    }
+
+    // Keeps the loop from being optimized away
+    printf( "\nchecksum %llu\n", checksum );
+
+    return 0;
+}
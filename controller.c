@@ -0,0 +1,494 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "controller.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Smoothing filters
+//
+
+// Free a smoothing filter's buffers
+void smooth_free( SmoothFilter *smooth ) {
+
+    free( smooth->ring );
+    free( smooth->sorted );
+
+    smooth->ring   = NULL;
+    smooth->sorted = NULL;
+}
+
+// Setup a smoothing filter by name; returns false on an unknown filter or invalid window
+bool smooth_setup( SmoothFilter *smooth, const char *filter_str, unsigned int window ) {
+
+    int filter;
+
+    if( strcmp( filter_str, "sma" ) == 0 )         { filter = SMOOTH_SMA; }
+    else if( strcmp( filter_str, "ema" ) == 0 )    { filter = SMOOTH_EMA; }
+    else if( strcmp( filter_str, "median" ) == 0 ) { filter = SMOOTH_MEDIAN; }
+    else                                           { return false; }
+
+    if( window < 1 || window > SMOOTH_WINDOW_MAX ) { return false; }
+
+    memset( smooth, 0, sizeof( *smooth ) );
+
+    smooth->filter = filter;
+    smooth->window = window;
+    smooth->ring   = calloc( window, sizeof( int ) );
+    smooth->sorted = filter == SMOOTH_MEDIAN ? calloc( window, sizeof( int ) ) : NULL;
+
+    return smooth->ring != NULL && ( filter != SMOOTH_MEDIAN || smooth->sorted != NULL );
+}
+
+// Index of the first sorted sample >= value
+static unsigned int smooth_sorted_lower_bound( SmoothFilter *smooth, int value ) {
+
+    unsigned int low = 0, high = smooth->count;
+
+    while( low < high ) {
+
+        unsigned int mid = ( low + high ) / 2;
+
+        if( smooth->sorted[ mid ] < value ) { low = mid + 1; } else { high = mid; }
+    }
+
+    return low;
+}
+
+// Push a sample; O(1) for sma/ema, O(log N) search + one memmove per side for median
+// - Until the window fills the filter only covers the samples seen so far so there is no
+//   startup bias from seed values
+void smooth_push( SmoothFilter *smooth, int value ) {
+
+    bool is_full = smooth->count == smooth->window;
+    int evicted  = smooth->ring[ smooth->head ];
+
+    smooth->ring[ smooth->head ] = value;
+    smooth->head = ( smooth->head + 1 ) % smooth->window;
+
+    switch( smooth->filter ) {
+
+        case SMOOTH_SMA:
+            smooth->sum += value - ( is_full ? evicted : 0 );
+            break;
+
+        case SMOOTH_EMA:
+
+            // First sample seeds the average
+            if( smooth->count == 0 ) {
+
+                smooth->ema_q8 = ( long long ) value * 256;
+
+            } else {
+
+                smooth->ema_q8 += ( ( long long ) value * 256 - smooth->ema_q8 ) * 2 / ( smooth->window + 1 );
+            }
+
+            break;
+
+        case SMOOTH_MEDIAN:
+
+            if( is_full ) {
+
+                unsigned int evicted_idx = smooth_sorted_lower_bound( smooth, evicted );
+
+                memmove( &smooth->sorted[ evicted_idx ], &smooth->sorted[ evicted_idx + 1 ], ( smooth->count - evicted_idx - 1 ) * sizeof( int ) );
+                smooth->count--;
+            }
+
+            unsigned int insert_idx = smooth_sorted_lower_bound( smooth, value );
+
+            memmove( &smooth->sorted[ insert_idx + 1 ], &smooth->sorted[ insert_idx ], ( smooth->count - insert_idx ) * sizeof( int ) );
+            smooth->sorted[ insert_idx ] = value;
+
+            break;
+    }
+
+    if( smooth->count < smooth->window ) { smooth->count++; }
+}
+
+// Current filtered value, rounded; 0 until the first sample
+int smooth_value( SmoothFilter *smooth ) {
+
+    if( smooth->count == 0 ) { return 0; }
+
+    switch( smooth->filter ) {
+
+        case SMOOTH_EMA:
+            return ( smooth->ema_q8 + 128 ) / 256;
+
+        case SMOOTH_MEDIAN:
+
+            // Even counts average the middle two
+            if( smooth->count % 2 == 0 ) {
+
+                return ( smooth->sorted[ smooth->count / 2 - 1 ] + smooth->sorted[ smooth->count / 2 ] + 1 ) / 2;
+            }
+
+            return smooth->sorted[ smooth->count / 2 ];
+
+        default:
+            return ( smooth->sum + smooth->count / 2 ) / smooth->count;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Curves
+//  - Curve shapes map a Q16 position in the curve range (0 - Q16_ONE) to a Q16 fraction of the
+//    duty cycle range; integer only so the table is bit-identical on every platform
+//
+
+// Q16 multiply
+static long long q16_mul( long long a, long long b ) {
+
+    return ( a * b ) >> 16;
+}
+
+// Quartic bezier ease-in/out
+// - https://easings.net/#easeInOutQuart
+long long curve_shape_quartic( long long pct_q16 ) {
+
+    if( pct_q16 < Q16_ONE / 2 ) {
+
+        long long pct_2 = q16_mul( pct_q16, pct_q16 );
+        return 8 * q16_mul( pct_2, pct_2 );
+    }
+
+    long long inv_q16 = 2 * Q16_ONE - 2 * pct_q16,
+              inv_2   = q16_mul( inv_q16, inv_q16 );
+
+    return Q16_ONE - q16_mul( inv_2, inv_2 ) / 2;
+}
+
+// Cubic bezier ease-in/out
+// - https://easings.net/#easeInOutCubic
+long long curve_shape_cubic( long long pct_q16 ) {
+
+    if( pct_q16 < Q16_ONE / 2 ) {
+
+        return 4 * q16_mul( q16_mul( pct_q16, pct_q16 ), pct_q16 );
+    }
+
+    long long inv_q16 = 2 * Q16_ONE - 2 * pct_q16;
+
+    return Q16_ONE - q16_mul( q16_mul( inv_q16, inv_q16 ), inv_q16 ) / 2;
+}
+
+// Sine ease-in/out; sin^2( pct * 90deg ) with Bhaskara I's integer sine approximation
+//    ( exact at both ends, within 0.2% in between )
+// - https://easings.net/#easeInOutSine
+long long curve_shape_sine( long long pct_q16 ) {
+
+    long long deg_q16 = 90 * pct_q16,
+              x_q16   = q16_mul( deg_q16, 180 * Q16_ONE - deg_q16 ),
+              sin_q16 = 4 * x_q16 * Q16_ONE / ( 40500 * Q16_ONE - x_q16 );
+
+    return q16_mul( sin_q16, sin_q16 );
+}
+
+// Linear
+long long curve_shape_linear( long long pct_q16 ) {
+
+    return pct_q16;
+}
+
+// Curve shape by PWM_FAN_CURVE name; `points` has no shape (NULL) and uses the user points
+// - Returns false on an unknown name
+bool curve_shape_from_name( const char *curve_str, CurveShapeFunc *shape_func ) {
+
+    if( strcmp( curve_str, "quartic" ) == 0 )     { *shape_func = curve_shape_quartic; }
+    else if( strcmp( curve_str, "cubic" ) == 0 )  { *shape_func = curve_shape_cubic; }
+    else if( strcmp( curve_str, "sine" ) == 0 )   { *shape_func = curve_shape_sine; }
+    else if( strcmp( curve_str, "linear" ) == 0 ) { *shape_func = curve_shape_linear; }
+    else if( strcmp( curve_str, "points" ) == 0 ) { *shape_func = NULL; }
+    else                                          { return false; }
+
+    return true;
+}
+
+// Duty cycle from the user points curve, linearly interpolated (rounded) and held flat past
+//    either end
+unsigned short curve_points_duty_cycle( Controller *ctl, int temp_mc ) {
+
+    CurvePoint *curve_points = ctl->curve_points;
+
+    if( temp_mc <= curve_points[0].temp_mc ) { return curve_points[0].duty_cycle; }
+
+    for( int i = 1; i < ctl->curve_point_count; i++ ) {
+
+        if( temp_mc <= curve_points[i].temp_mc ) {
+
+            long long span_mc  = curve_points[i].temp_mc - curve_points[ i - 1 ].temp_mc,
+                      delta_dc = ( long long ) curve_points[i].duty_cycle - curve_points[ i - 1 ].duty_cycle,
+                      scaled   = delta_dc * ( temp_mc - curve_points[ i - 1 ].temp_mc );
+
+            // Round half away from zero for falling segments too
+            scaled += scaled < 0 ? -span_mc / 2 : span_mc / 2;
+
+            return curve_points[ i - 1 ].duty_cycle + scaled / span_mc;
+        }
+    }
+
+    return curve_points[ ctl->curve_point_count - 1 ].duty_cycle;
+}
+
+// Calibrated RPM at a duty cycle, linearly interpolated and held flat past either end
+unsigned int curve_rpm_at( Controller *ctl, unsigned short duty_cycle ) {
+
+    RpmPoint *rpm_points = ctl->rpm_points;
+
+    if( duty_cycle <= rpm_points[0].duty_cycle ) { return rpm_points[0].rpm; }
+
+    for( int i = 1; i < ctl->rpm_point_count; i++ ) {
+
+        if( duty_cycle <= rpm_points[i].duty_cycle ) {
+
+            long long span_dc = rpm_points[i].duty_cycle - rpm_points[ i - 1 ].duty_cycle;
+
+            return rpm_points[ i - 1 ].rpm + ( ( long long ) rpm_points[i].rpm - rpm_points[ i - 1 ].rpm ) * ( duty_cycle - rpm_points[ i - 1 ].duty_cycle ) / span_dc;
+        }
+    }
+
+    return rpm_points[ ctl->rpm_point_count - 1 ].rpm;
+}
+
+// Map every duty cycle in the fan's range to the lowest duty cycle reaching the same fraction
+//    of the calibrated RPM range, ie: the middle of the range gives half way between the RPM
+//    at min and max duty cycle; NULL if uncalibrated, flat or out of memory
+// - One pass as both the targets and the calibrated RPM only increase
+static unsigned short* curve_airflow_map( Controller *ctl ) {
+
+    long long rpm_min  = curve_rpm_at( ctl, ctl->min_duty_cycle ),
+              rpm_max  = curve_rpm_at( ctl, ctl->max_duty_cycle ),
+              dc_range = ctl->max_duty_cycle - ctl->min_duty_cycle;
+
+    if( ctl->rpm_point_count < 2 || rpm_max <= rpm_min || dc_range == 0 ) { return NULL; }
+
+    unsigned short *airflow_map = malloc( ( ctl->max_duty_cycle + 1 ) * sizeof( unsigned short ) );
+    unsigned short airflow_duty_cycle = ctl->min_duty_cycle;
+
+    if( airflow_map == NULL ) { return NULL; }
+
+    for( unsigned int duty_cycle = ctl->min_duty_cycle; duty_cycle <= ctl->max_duty_cycle; duty_cycle++ ) {
+
+        long long target_rpm = rpm_min + ( rpm_max - rpm_min ) * ( duty_cycle - ctl->min_duty_cycle ) / dc_range;
+
+        while( airflow_duty_cycle < ctl->max_duty_cycle && curve_rpm_at( ctl, airflow_duty_cycle ) < target_rpm ) {
+
+            airflow_duty_cycle++;
+        }
+
+        airflow_map[ duty_cycle ] = airflow_duty_cycle;
+    }
+
+    return airflow_map;
+}
+
+// Compile the curve into a lookup table with one entry per millidegree from min_off_temp_mc
+//    to max_temp_mc so per-step evaluation is a single array load
+// - A NULL shape compiles the user points; returns false if the table can't be allocated
+// - Needs max_temp_mc above min_off_temp_mc
+// - Calibrated fans get the curve in airflow; the shape's duty cycle is the fraction of the
+//   RPM range to reach
+bool curve_compile( Controller *ctl, CurveShapeFunc shape_func ) {
+
+    ctl->curve_table_min_mc = ctl->min_off_temp_mc;
+    ctl->curve_table_size   = ctl->max_temp_mc - ctl->min_off_temp_mc + 1;
+    ctl->curve_table        = malloc( ctl->curve_table_size * sizeof( unsigned short ) );
+
+    if( ctl->curve_table == NULL ) { return false; }
+
+    unsigned short *airflow_map = curve_airflow_map( ctl );
+
+    long long duty_cycle_range = ctl->max_duty_cycle - ctl->min_duty_cycle;
+
+    for( unsigned int i = 0; i < ctl->curve_table_size; i++ ) {
+
+        long long duty_cycle;
+
+        if( shape_func == NULL ) {
+
+            duty_cycle = curve_points_duty_cycle( ctl, ctl->curve_table_min_mc + i );
+
+        } else {
+
+            long long pct_q16 = i * Q16_ONE / ( ctl->curve_table_size - 1 );
+
+            duty_cycle = ( shape_func( pct_q16 ) * duty_cycle_range + Q16_ONE / 2 ) / Q16_ONE + ctl->min_duty_cycle;
+        }
+
+        // Ensure we don't pass invalid duty cycle
+        if( duty_cycle < ctl->min_duty_cycle ) { duty_cycle = ctl->min_duty_cycle; }
+        if( duty_cycle > ctl->max_duty_cycle ) { duty_cycle = ctl->max_duty_cycle; }
+
+        ctl->curve_table[i] = airflow_map != NULL ? airflow_map[ duty_cycle ] : duty_cycle;
+    }
+
+    free( airflow_map );
+
+    return true;
+}
+
+// Free a compiled curve
+void curve_free( Controller *ctl ) {
+
+    free( ctl->curve_table );
+    ctl->curve_table = NULL;
+}
+
+// Look up the duty cycle for a millidegree temp in the compiled curve
+// - Out of range temps can happen using CPU temp smoothing because the averages may fall out
+//   of the singular instantaneous check in the decision
+unsigned short curve_lookup( Controller *ctl, int temp_mc ) {
+
+    long idx = temp_mc - ctl->curve_table_min_mc;
+
+    if( idx < 0 )                               { return ctl->min_duty_cycle; }
+    if( idx >= ( long ) ctl->curve_table_size ) { return ctl->max_duty_cycle; }
+
+    return ctl->curve_table[ idx ];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  PID loops
+//
+
+// Restart a PID controller with its integral at `seed_mpct` so the output picks up from
+//    there without a bump
+void pid_reset( PidController *pid, long long seed_mpct ) {
+
+    if( seed_mpct < pid->out_min_mpct ) { seed_mpct = pid->out_min_mpct; }
+    if( seed_mpct > pid->out_max_mpct ) { seed_mpct = pid->out_max_mpct; }
+
+    pid->integral_mpct = seed_mpct;
+    pid->is_running    = false;
+}
+
+// Step a PID controller; positive error raises the output
+// - Anti-windup: the integral doesn't grow while the output is saturated in the same
+//   direction, and is clamped to the output range
+long long pid_step( PidController *pid, long long error, long long now_ns ) {
+
+    if( ! pid->is_running ) {
+
+        pid->is_running = true;
+        pid->last_error = error;
+        pid->last_ns    = now_ns;
+    }
+
+    long long dt_ms = ( now_ns - pid->last_ns ) / 1000000;
+
+    long long p_mpct = pid->kp_milli * error / pid->error_scale;
+    long long d_mpct = dt_ms > 0 ? pid->kd_milli * ( error - pid->last_error ) * 1000 / ( pid->error_scale * dt_ms ) : 0;
+    long long i_mpct = pid->integral_mpct + pid->ki_milli * error * dt_ms / ( pid->error_scale * 1000LL );
+
+    long long out_mpct = p_mpct + i_mpct + d_mpct;
+
+    if( ( out_mpct > pid->out_max_mpct && error > 0 ) || ( out_mpct < pid->out_min_mpct && error < 0 ) ) {
+
+        i_mpct = pid->integral_mpct;
+    }
+
+    if( i_mpct < pid->out_min_mpct ) { i_mpct = pid->out_min_mpct; }
+    if( i_mpct > pid->out_max_mpct ) { i_mpct = pid->out_max_mpct; }
+
+    pid->integral_mpct = i_mpct;
+    pid->last_error    = error;
+    pid->last_ns       = now_ns;
+
+    out_mpct = p_mpct + i_mpct + d_mpct;
+
+    if( out_mpct < pid->out_min_mpct ) { out_mpct = pid->out_min_mpct; }
+    if( out_mpct > pid->out_max_mpct ) { out_mpct = pid->out_max_mpct; }
+
+    return out_mpct;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Decisions
+//
+
+// Duty cycle from the PID loops for the smoothed temp
+// - pid_rpm maps the temp loop's duty cycle to an RPM target and an inner loop holds it
+//   against the windowed tachometer RPM
+static unsigned short controller_pid_duty_cycle( Controller *ctl, const ControllerSample *sample ) {
+
+    if( ! ctl->temp_pid.is_running ) { pid_reset( &ctl->temp_pid, ctl->duty_cycle_set_val * 1000LL ); }
+
+    long long demand_mpct = pid_step( &ctl->temp_pid, sample->smooth_temp_mc - ctl->pid_target_mc, sample->now_ns );
+
+    if( ctl->control_mode == CONTROL_PID_RPM ) {
+
+        ctl->pid_rpm_target = demand_mpct * ctl->pid_max_rpm / ( ctl->max_duty_cycle * 1000LL );
+
+        if( ! ctl->rpm_pid.is_running ) { pid_reset( &ctl->rpm_pid, demand_mpct ); }
+
+        demand_mpct = pid_step( &ctl->rpm_pid, ( long long ) ctl->pid_rpm_target - sample->tach_rpm, sample->now_ns );
+    }
+
+    return ( demand_mpct + 500 ) / 1000;
+}
+
+// Start the fan off grace period from `now_ns`
+void controller_start( Controller *ctl, long long now_ns ) {
+
+    ctl->last_above_min_ns = now_ns;
+}
+
+// Decide the duty cycle and mode for one sample; the only state touched is the context's
+// - Bands use the instantaneous temp, the curve uses the smoothed temp
+ControllerDecision controller_step( Controller *ctl, const ControllerSample *sample ) {
+
+    ControllerDecision decision;
+    int use_min_temp_mc = ctl->min_on_temp_mc;
+
+    // If we're above min off temp then set last_above_min_ns
+    if( sample->cur_temp_mc > use_min_temp_mc ) {
+
+        ctl->last_above_min_ns = sample->now_ns;
+    }
+
+    ctl->grace_check_ms = ( sample->now_ns - ctl->last_above_min_ns ) / 1000000;
+
+    // If we're below min temp and within fan off grace period set to min duty cycle
+    if( sample->cur_temp_mc <= use_min_temp_mc && ctl->grace_check_ms < ctl->fan_off_grace_ms ) {
+
+        decision.duty_cycle = ctl->min_duty_cycle;
+        decision.mode       = FAN_BELOW_MIN;
+
+    } else if( sample->cur_temp_mc <= use_min_temp_mc ) {
+
+        decision.duty_cycle = 0;
+        decision.mode       = FAN_BELOW_OFF;
+
+    } else if( sample->cur_temp_mc >= ctl->max_temp_mc ) {
+
+        decision.duty_cycle = ctl->max_duty_cycle;
+        decision.mode       = FAN_ABOVE_MAX;
+
+    } else if( ctl->control_mode != CONTROL_CURVE ) {
+
+        decision.duty_cycle = controller_pid_duty_cycle( ctl, sample );
+        decision.mode       = FAN_PID;
+
+    } else {
+
+        decision.duty_cycle = curve_lookup( ctl, sample->smooth_temp_mc );
+        decision.mode       = FAN_ABOVE_EAS;
+    }
+
+    // Loops restart bumplessly from the current duty cycle whenever a band takes over
+    if( decision.mode != FAN_PID ) {
+
+        ctl->temp_pid.is_running = false;
+        ctl->rpm_pid.is_running  = false;
+    }
+
+    ctl->duty_cycle_set_val = decision.duty_cycle;
+    ctl->decided_mode_int   = decision.mode;
+
+    return decision;
+}
@@ -0,0 +1,179 @@
+#ifndef PWM_FAN_CONTROLLER_H
+#define PWM_FAN_CONTROLLER_H
+
+#include <stdbool.h>
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Fan decision library
+//  - Smoothing filters, compiled curves, PID loops and the per-tick mode/duty cycle decision
+//  - No globals, logging or I/O so the daemon, replay and the benchmark all run the exact
+//    same decisions; built standalone with `make lib`
+//
+
+// Define fan modes
+#define FAN_BELOW_OFF 0
+#define FAN_BELOW_MIN 1
+#define FAN_ABOVE_EAS 2
+#define FAN_ABOVE_MAX 3
+#define FAN_PID       4
+
+// # of fan modes for residency counters
+#define FAN_MODE_COUNT 5
+
+// Fan control modes
+#define CONTROL_CURVE   0
+#define CONTROL_PID     1
+#define CONTROL_PID_RPM 2
+
+// Smoothing filter types for the curve input temp
+#define SMOOTH_SMA    0
+#define SMOOTH_EMA    1
+#define SMOOTH_MEDIAN 2
+
+// Max smoothing window size in samples
+#define SMOOTH_WINDOW_MAX 4096
+
+// Max # of user points for the points curve
+#define CURVE_MAX_POINTS 16
+
+// Max # of measured duty cycle/RPM points from calibration
+#define CALIBRATION_MAX_POINTS 101
+
+// Fixed-point one for curve shapes (Q16)
+#define Q16_ONE 65536LL
+
+typedef struct {
+    int temp_mc;
+    unsigned short duty_cycle;
+} CurvePoint;
+
+// Steady RPM measured at a duty cycle
+typedef struct {
+    unsigned short duty_cycle;
+    unsigned int rpm;
+} RpmPoint;
+
+typedef struct {
+    int filter;
+    unsigned int window;
+
+    // Ring buffer of the last `window` samples in arrival order; oldest at `head` once full
+    int *ring;
+    unsigned int head;
+    unsigned int count;
+
+    // Moving average running sum
+    long long sum;
+
+    // Exponential moving average in millidegrees * 256
+    long long ema_q8;
+
+    // Median - the same samples kept sorted
+    int *sorted;
+} SmoothFilter;
+
+// Fixed-point PID controller; output in milli-percent duty cycle
+// - Gains are in milli-units per unit of error (ie: %/C * 1000) and `error_scale` is the
+//   error's units per gain unit (1000 for millidegrees, 1 for RPM)
+typedef struct {
+    int kp_milli;
+    int ki_milli;
+    int kd_milli;
+    int error_scale;
+
+    // Output clamp; the integral is clamped to the same range
+    long long out_min_mpct;
+    long long out_max_mpct;
+
+    long long integral_mpct;
+    long long last_error;
+    long long last_ns;
+    bool is_running;
+} PidController;
+
+// Curve shape; maps a Q16 position in the curve range to a Q16 fraction of the duty cycle range
+typedef long long ( *CurveShapeFunc )( long long pct_q16 );
+
+// One fan's decision context; limits and control config plus the state carried between steps
+typedef struct {
+
+    // Config
+    unsigned short min_duty_cycle,
+                   max_duty_cycle,
+                   fan_off_grace_ms;
+
+    int min_off_temp_mc,
+        min_on_temp_mc,
+        max_temp_mc;
+
+    int control_mode;
+    int pid_target_mc;
+    unsigned int pid_max_rpm;
+
+    // Temp and RPM loops
+    PidController temp_pid;
+    PidController rpm_pid;
+    unsigned int pid_rpm_target;
+
+    // Compiled fan curve; one duty cycle per millidegree starting at curve_table_min_mc
+    unsigned short *curve_table;
+    unsigned int curve_table_size;
+    long curve_table_min_mc;
+
+    // User points for the points curve
+    CurvePoint curve_points[ CURVE_MAX_POINTS ];
+    int curve_point_count;
+
+    // Calibrated duty cycle/RPM points, increasing in both; when set the curve is compiled
+    //    linear in RPM (airflow) instead of duty cycle
+    RpmPoint rpm_points[ CALIBRATION_MAX_POINTS ];
+    int rpm_point_count;
+
+    // Last time above the minimum on temp (ns) and the last step's decision
+    long long last_above_min_ns;
+    long long grace_check_ms;
+    unsigned short duty_cycle_set_val;
+    unsigned short decided_mode_int;
+} Controller;
+
+// One step's inputs; bands use the instantaneous temp, the curve and PID the smoothed temp
+typedef struct {
+    int cur_temp_mc;
+    int smooth_temp_mc;
+    unsigned int tach_rpm;
+    long long now_ns;
+} ControllerSample;
+
+typedef struct {
+    unsigned short duty_cycle;
+    unsigned short mode;
+} ControllerDecision;
+
+// Smoothing filters
+void smooth_free( SmoothFilter *smooth );
+bool smooth_setup( SmoothFilter *smooth, const char *filter_str, unsigned int window );
+void smooth_push( SmoothFilter *smooth, int value );
+int smooth_value( SmoothFilter *smooth );
+
+// Curves
+long long curve_shape_quartic( long long pct_q16 );
+long long curve_shape_cubic( long long pct_q16 );
+long long curve_shape_sine( long long pct_q16 );
+long long curve_shape_linear( long long pct_q16 );
+bool curve_shape_from_name( const char *curve_str, CurveShapeFunc *shape_func );
+unsigned short curve_points_duty_cycle( Controller *ctl, int temp_mc );
+unsigned int curve_rpm_at( Controller *ctl, unsigned short duty_cycle );
+bool curve_compile( Controller *ctl, CurveShapeFunc shape_func );
+void curve_free( Controller *ctl );
+unsigned short curve_lookup( Controller *ctl, int temp_mc );
+
+// PID loops
+void pid_reset( PidController *pid, long long seed_mpct );
+long long pid_step( PidController *pid, long long error, long long now_ns );
+
+// Decisions
+void controller_start( Controller *ctl, long long now_ns );
+ControllerDecision controller_step( Controller *ctl, const ControllerSample *sample );
+
+#endif
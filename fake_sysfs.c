@@ -0,0 +1,774 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Fake sysfs hardware backend for pwm_fan_control2
+//
+//  Builds a throw-away sysfs-shaped tree so the controller can be run, profiled
+//     and regression-tested on any Linux box with `PWM_FAN_SYSFS_ROOT` pointed at
+//     it:
+//  - `firmware/devicetree/base/model` - configurable model string
+//  - `class/thermal/thermal_zone0/temp` - driven from a keyframe script
+//  - `class/pwm/pwmchipN/pwmM/duty_cycle` - FIFOs; every write is recorded with a
+//     monotonic timestamp
+//  - `class/gpio/gpioN/value` - FIFOs; one byte written per synthetic tach edge, at
+//     a rate derived from the duty cycle of the channel the fan is wired to
+//  - `class/pwm/pwmchipN/device` and `class/gpio/gpiochipN/label` - controller metadata
+//     for topology discovery, including the Raspberry Pi 5's decoy fan PWM and GPIO
+//     controllers
+//
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Constants
+//
+
+// Max length of any path in the fake tree
+#define FAKE_PATH_MAX 256
+
+// Max # of PWM channels on any supported chip (Raspberry Pi 5 has 4)
+#define FAKE_MAX_PWM_CHANNELS 4
+
+// Max # of simulated fans with a tachometer
+#define FAKE_MAX_TACH 4
+
+// How often the thermal zone is re-written while following a script
+#define FAKE_TEMP_STEP_MS 50
+
+// Max # of keyframes in a temp script
+#define FAKE_MAX_KEYFRAMES 4096
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Types
+//
+
+typedef struct {
+    unsigned int t_ms;
+    int temp_mc;
+} TempKeyframe;
+
+typedef struct {
+    unsigned short bcm_pin;
+    unsigned short pwm_channel;
+    int fd_value;
+    pthread_t thread;
+} FakeTach;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Global scope vars
+//
+
+// CLI config
+char *root_path         = NULL;
+char *model_str         = "Raspberry Pi 4 Model B";
+char *temp_script_path  = NULL;
+char *pwm_log_path      = NULL;
+float temp_c            = 45;
+unsigned int max_rpm    = 5000;
+unsigned short tach_ppr = 2;
+unsigned short stall_pct = 10;
+int start_pct           = -1;
+long seize_from_ms      = -1;
+long seize_until_ms     = -1;
+unsigned short wear_pct = 100;
+bool keep_tree          = false;
+int pwm_chip_override   = -1;
+int gpio_base_override  = -1;
+
+// Derived from the model string
+short rpi_model        = 4;
+unsigned short pwm_chip_num;
+unsigned short pwm_channel_count;
+unsigned int gpio_base;
+char *pwm_device_str;
+char *pwm_compatible_str;
+char *gpio_label_str;
+
+// Temp script keyframes
+TempKeyframe keyframes[ FAKE_MAX_KEYFRAMES ];
+unsigned int keyframe_count = 0;
+
+// Fans wired to a tachometer
+FakeTach tachs[ FAKE_MAX_TACH ];
+unsigned short tach_count = 0;
+
+// Thermal zone temp file
+int fd_temp = -1;
+
+// PWM duty cycle FIFOs + last value seen per channel
+int fd_duty_cycle[ FAKE_MAX_PWM_CHANNELS ];
+volatile unsigned int duty_cycle_ns[ FAKE_MAX_PWM_CHANNELS ] = {0};
+
+// PWM write log
+FILE *fd_pwm_log = NULL;
+
+// Start time that all timestamps are relative to
+struct timespec start_ts;
+
+volatile sig_atomic_t halt_received = 0;
+
+pthread_t pwm_recorder_thread;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Functions
+//
+
+// SIGINT/SIGTERM handler
+void handle_halt( int noop ) { ( void ) noop; halt_received = 1; }
+
+// Die with a message
+void die( char* message_str, ... ) {
+
+    va_list args;
+
+    va_start( args, message_str );
+    vfprintf( stderr, message_str, args );
+    va_end( args );
+
+    exit( 1 );
+}
+
+// Milliseconds since start on the monotonic clock
+double elapsed_ms() {
+
+    struct timespec now_ts;
+    clock_gettime( CLOCK_MONOTONIC, &now_ts );
+
+    return ( now_ts.tv_sec - start_ts.tv_sec ) * 1000.0 + ( now_ts.tv_nsec - start_ts.tv_nsec ) / 1000000.0;
+}
+
+// Create a directory and all of its parents
+void make_dirs( const char *path_str ) {
+
+    char tmp_path_str[ FAKE_PATH_MAX ];
+    snprintf( tmp_path_str, sizeof( tmp_path_str ), "%s", path_str );
+
+    for( char *p = tmp_path_str + 1; *p; p++ ) {
+
+        if( *p != '/' ) { continue; }
+
+        *p = '\0';
+
+        if( mkdir( tmp_path_str, 0755 ) != 0 && errno != EEXIST ) {
+
+            die( "Unable to create %s: %s\n", tmp_path_str, strerror( errno ) );
+        }
+
+        *p = '/';
+    }
+
+    if( mkdir( tmp_path_str, 0755 ) != 0 && errno != EEXIST ) {
+
+        die( "Unable to create %s: %s\n", tmp_path_str, strerror( errno ) );
+    }
+}
+
+// Format a path relative to the root of the fake tree
+void fake_path( char *path_str, const char *format, va_list args ) {
+
+    char rel_path_str[ FAKE_PATH_MAX ];
+
+    vsnprintf( rel_path_str, sizeof( rel_path_str ), format, args );
+
+    if( snprintf( path_str, FAKE_PATH_MAX, "%s/%s", root_path, rel_path_str ) >= FAKE_PATH_MAX ) {
+
+        die( "Path exceeds %i characters: %s/%s\n", FAKE_PATH_MAX, root_path, rel_path_str );
+    }
+}
+
+// Create a regular file under the root with contents
+void make_file( const char *contents_str, const char *format, ... ) {
+
+    char path_str[ FAKE_PATH_MAX ];
+
+    va_list args;
+
+    va_start( args, format );
+    fake_path( path_str, format, args );
+    va_end( args );
+
+    FILE *fd = fopen( path_str, "w" );
+
+    if( fd == NULL ) { die( "Unable to create %s: %s\n", path_str, strerror( errno ) ); }
+
+    fputs( contents_str, fd );
+    fclose( fd );
+}
+
+// Create a FIFO under the root and hold it open read/write so it never hits EOF when the
+//    controller closes its end
+int make_fifo( const char *format, ... ) {
+
+    char path_str[ FAKE_PATH_MAX ];
+
+    va_list args;
+
+    va_start( args, format );
+    fake_path( path_str, format, args );
+    va_end( args );
+
+    if( mkfifo( path_str, 0644 ) != 0 ) { die( "Unable to create FIFO %s: %s\n", path_str, strerror( errno ) ); }
+
+    int fd = open( path_str, O_RDWR | O_NONBLOCK );
+
+    if( fd < 0 ) { die( "Unable to open FIFO %s: %s\n", path_str, strerror( errno ) ); }
+
+    return fd;
+}
+
+// Write the thermal zone in place with a fixed width so a reader never sees a truncated file
+void write_temp_mc( int temp_mc ) {
+
+    char buffer[16];
+    int len = snprintf( buffer, sizeof( buffer ), "%06d\n", temp_mc );
+
+    if( pwrite( fd_temp, buffer, len, 0 ) != len ) {
+
+        fprintf( stderr, "Unable to write thermal zone temp: %s\n", strerror( errno ) );
+    }
+}
+
+// Linearly interpolate the temp script at a point in time; holds the last keyframe
+int script_temp_mc( double t_ms ) {
+
+    if( t_ms <= keyframes[0].t_ms ) { return keyframes[0].temp_mc; }
+
+    for( unsigned int i = 1; i < keyframe_count; i++ ) {
+
+        if( t_ms <= keyframes[i].t_ms ) {
+
+            double pct = ( t_ms - keyframes[ i - 1 ].t_ms ) / ( keyframes[i].t_ms - keyframes[ i - 1 ].t_ms );
+            return keyframes[ i - 1 ].temp_mc + pct * ( keyframes[i].temp_mc - keyframes[ i - 1 ].temp_mc );
+        }
+    }
+
+    return keyframes[ keyframe_count - 1 ].temp_mc;
+}
+
+// Load a temp script of `<ms> <temp_c>` lines; `#` starts a comment
+void load_temp_script( const char *path_str ) {
+
+    FILE *fd = fopen( path_str, "r" );
+
+    if( fd == NULL ) { die( "Unable to open temp script %s: %s\n", path_str, strerror( errno ) ); }
+
+    char line[128];
+    unsigned int t_ms;
+    float t_c;
+
+    while( fgets( line, sizeof( line ), fd ) != NULL && keyframe_count < FAKE_MAX_KEYFRAMES ) {
+
+        if( line[0] == '#' ) { continue; }
+        if( sscanf( line, "%u %f", &t_ms, &t_c ) != 2 ) { continue; }
+
+        if( keyframe_count > 0 && t_ms <= keyframes[ keyframe_count - 1 ].t_ms ) {
+
+            die( "Temp script keyframes must be in increasing time order (%u ms)!\n", t_ms );
+        }
+
+        keyframes[ keyframe_count ].t_ms    = t_ms;
+        keyframes[ keyframe_count ].temp_mc = t_c * 1000;
+        keyframe_count++;
+    }
+
+    fclose( fd );
+
+    if( keyframe_count == 0 ) { die( "Temp script %s has no keyframes!\n", path_str ); }
+}
+
+// Read the period the controller configured for a channel; 0 if not yet set
+unsigned int read_period_ns( unsigned short channel ) {
+
+    char path_str[ FAKE_PATH_MAX ];
+    snprintf( path_str, sizeof( path_str ), "%s/class/pwm/pwmchip%i/pwm%i/period", root_path, pwm_chip_num, channel );
+
+    FILE *fd = fopen( path_str, "r" );
+    unsigned int period_ns = 0;
+
+    if( fd == NULL ) { return 0; }
+    if( fscanf( fd, "%u", &period_ns ) != 1 ) { period_ns = 0; }
+
+    fclose( fd );
+
+    return period_ns;
+}
+
+// Simulated fan speed for a channel; stalls below `stall_pct`, only starts from a
+//    standstill at `start_pct`, is locked from `seize_from_ms` until a kick at full duty after
+//    `seize_until_ms` frees it, and turns at `wear_pct` of its healthy speed
+unsigned int channel_rpm( unsigned short channel ) {
+
+    static bool is_spinning[ FAKE_MAX_PWM_CHANNELS ];
+    static bool is_freed[ FAKE_MAX_PWM_CHANNELS ];
+
+    unsigned int period_ns = read_period_ns( channel );
+
+    if( period_ns == 0 ) { return 0; }
+
+    double duty_pct = 100.0 * duty_cycle_ns[ channel ] / period_ns;
+    int use_start_pct = start_pct < 0 ? stall_pct : start_pct;
+
+    double t_ms = elapsed_ms();
+
+    if( seize_until_ms >= 0 && t_ms >= seize_until_ms && duty_pct >= 100 ) { is_freed[ channel ] = true; }
+
+    bool is_seized = seize_from_ms >= 0 && t_ms >= seize_from_ms && ! is_freed[ channel ];
+
+    if( duty_pct < stall_pct || is_seized ) { is_spinning[ channel ] = false; }
+    if( duty_pct >= use_start_pct && ! is_seized ) { is_spinning[ channel ] = true; }
+
+    if( ! is_spinning[ channel ] ) { return 0; }
+    if( duty_pct > 100 )           { duty_pct = 100; }
+
+    return max_rpm * duty_pct / 100 * wear_pct / 100;
+}
+
+// Record every duty cycle write on every channel FIFO
+void* pwm_recorder_func( void* arg ) {
+
+    ( void ) arg;
+
+    struct pollfd poll_fds[ FAKE_MAX_PWM_CHANNELS ];
+    char buffer[256];
+
+    for( int i = 0; i < pwm_channel_count; i++ ) {
+
+        poll_fds[i].fd     = fd_duty_cycle[i];
+        poll_fds[i].events = POLLIN;
+    }
+
+    while( ! halt_received ) {
+
+        if( poll( poll_fds, pwm_channel_count, 100 ) <= 0 ) { continue; }
+
+        for( int i = 0; i < pwm_channel_count; i++ ) {
+
+            if( ! ( poll_fds[i].revents & POLLIN ) ) { continue; }
+
+            ssize_t len = read( poll_fds[i].fd, buffer, sizeof( buffer ) - 1 );
+
+            if( len <= 0 ) { continue; }
+
+            buffer[ len ] = '\0';
+
+            double t_ms = elapsed_ms();
+
+            // One record per newline terminated write
+            for( char *record = strtok( buffer, "\n" ); record != NULL; record = strtok( NULL, "\n" ) ) {
+
+                duty_cycle_ns[i] = strtoul( record, NULL, 10 );
+
+                fprintf( fd_pwm_log, "%.3f,%i,%i,%u\n", t_ms, pwm_chip_num, i, duty_cycle_ns[i] );
+            }
+
+            fflush( fd_pwm_log );
+        }
+    }
+
+    return NULL;
+}
+
+// Emit one falling edge per tach pulse at the simulated fan speed
+void* tach_func( void* arg ) {
+
+    FakeTach *tach = ( FakeTach* ) arg;
+    struct timespec next_ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &next_ts );
+
+    while( ! halt_received ) {
+
+        unsigned int rpm = channel_rpm( tach->pwm_channel );
+
+        // Stopped fan; re-check for a speed change every 100ms
+        long interval_ns = 100000000;
+
+        if( rpm > 0 ) {
+
+            interval_ns = 60000000000LL / ( ( long long ) rpm * tach_ppr );
+
+            if( write( tach->fd_value, "0", 1 ) != 1 && errno != EAGAIN ) {
+
+                fprintf( stderr, "Unable to write tach edge: %s\n", strerror( errno ) );
+            }
+        }
+
+        next_ts.tv_nsec += interval_ns;
+
+        while( next_ts.tv_nsec >= 1000000000 ) {
+
+            next_ts.tv_nsec -= 1000000000;
+            next_ts.tv_sec++;
+        }
+
+        clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &next_ts, NULL );
+    }
+
+    return NULL;
+}
+
+// PWM chip's npwm and `device` symlink to a platform device with a devicetree compatible
+void make_pwm_chip( int chip_num, int npwm, const char *device_str, const char *compatible_str ) {
+
+    char path_str[ FAKE_PATH_MAX ];
+    char npwm_str[ 16 ];
+
+    snprintf( path_str, sizeof( path_str ), "%s/devices/platform/%s/of_node", root_path, device_str );
+    make_dirs( path_str );
+    make_file( compatible_str, "devices/platform/%s/of_node/compatible", device_str );
+
+    snprintf( path_str, sizeof( path_str ), "%s/class/pwm/pwmchip%i", root_path, chip_num );
+    make_dirs( path_str );
+
+    snprintf( npwm_str, sizeof( npwm_str ), "%i\n", npwm );
+    make_file( npwm_str, "class/pwm/pwmchip%i/npwm", chip_num );
+
+    char link_str[ FAKE_PATH_MAX ];
+
+    snprintf( link_str, sizeof( link_str ), "../../../devices/platform/%s", device_str );
+    snprintf( path_str, sizeof( path_str ), "%s/class/pwm/pwmchip%i/device", root_path, chip_num );
+
+    if( symlink( link_str, path_str ) != 0 ) { die( "Unable to create %s: %s\n", path_str, strerror( errno ) ); }
+}
+
+// GPIO chip's base, ngpio and label
+void make_gpio_chip( int base, int ngpio, const char *label_str ) {
+
+    char path_str[ FAKE_PATH_MAX ];
+    char value_str[ 16 ];
+
+    snprintf( path_str, sizeof( path_str ), "%s/class/gpio/gpiochip%i", root_path, base );
+    make_dirs( path_str );
+
+    snprintf( value_str, sizeof( value_str ), "%i\n", base );
+    make_file( value_str, "class/gpio/gpiochip%i/base", base );
+
+    snprintf( value_str, sizeof( value_str ), "%i\n", ngpio );
+    make_file( value_str, "class/gpio/gpiochip%i/ngpio", base );
+
+    make_file( label_str, "class/gpio/gpiochip%i/label", base );
+}
+
+// Build the fake tree
+void build_tree() {
+
+    char path_str[ FAKE_PATH_MAX ];
+
+    if( strstr( model_str, "Raspberry Pi 5" ) ) {
+
+        rpi_model          = 5;
+        pwm_chip_num       = 2;
+        pwm_channel_count  = 4;
+        gpio_base          = 571;
+        pwm_device_str     = "1f00098000.pwm";
+        pwm_compatible_str = "raspberrypi,rp1-pwm";
+        gpio_label_str     = "pinctrl-rp1\n";
+
+    } else {
+
+        rpi_model          = strstr( model_str, "Raspberry Pi 3" ) ? 3 : 4;
+        pwm_chip_num       = 0;
+        pwm_channel_count  = 2;
+        gpio_base          = 512;
+        pwm_device_str     = rpi_model == 3 ? "3f20c000.pwm" : "fe20c000.pwm";
+        pwm_compatible_str = "brcm,bcm2835-pwm";
+        gpio_label_str     = rpi_model == 3 ? "pinctrl-bcm2835\n" : "pinctrl-bcm2711\n";
+    }
+
+    if( pwm_chip_override >= 0 )  { pwm_chip_num = pwm_chip_override; }
+    if( gpio_base_override >= 0 ) { gpio_base = gpio_base_override; }
+
+    snprintf( path_str, sizeof( path_str ), "%s/firmware/devicetree/base", root_path );
+    make_dirs( path_str );
+    make_file( model_str, "firmware/devicetree/base/model" );
+
+    // Thermal zone
+    snprintf( path_str, sizeof( path_str ), "%s/class/thermal/thermal_zone0", root_path );
+    make_dirs( path_str );
+    make_file( "", "class/thermal/thermal_zone0/temp" );
+
+    snprintf( path_str, sizeof( path_str ), "%s/class/thermal/thermal_zone0/temp", root_path );
+    fd_temp = open( path_str, O_WRONLY );
+
+    if( fd_temp < 0 ) { die( "Unable to open %s: %s\n", path_str, strerror( errno ) ); }
+
+    write_temp_mc( keyframe_count > 0 ? keyframes[0].temp_mc : temp_c * 1000 );
+
+    // PWM chip with every channel pre-exported; export/unexport are plain files so the
+    //    controller's writes are accepted and ignored
+    for( int i = 0; i < pwm_channel_count; i++ ) {
+
+        snprintf( path_str, sizeof( path_str ), "%s/class/pwm/pwmchip%i/pwm%i", root_path, pwm_chip_num, i );
+        make_dirs( path_str );
+
+        make_file( "", "class/pwm/pwmchip%i/pwm%i/enable", pwm_chip_num, i );
+        make_file( "", "class/pwm/pwmchip%i/pwm%i/period", pwm_chip_num, i );
+        fd_duty_cycle[i] = make_fifo( "class/pwm/pwmchip%i/pwm%i/duty_cycle", pwm_chip_num, i );
+    }
+
+    make_file( "", "class/pwm/pwmchip%i/export", pwm_chip_num );
+    make_file( "", "class/pwm/pwmchip%i/unexport", pwm_chip_num );
+
+    make_pwm_chip( pwm_chip_num, pwm_channel_count, pwm_device_str, pwm_compatible_str );
+
+    // Raspberry Pi 5 also has the fan header's RP1 PWM; same compatible, different instance
+    if( rpi_model == 5 ) {
+
+        make_pwm_chip( pwm_chip_num == 0 ? 1 : 0, 4, "1f0009c000.pwm", "raspberrypi,rp1-pwm" );
+    }
+
+    // GPIO with every tach pin pre-exported
+    snprintf( path_str, sizeof( path_str ), "%s/class/gpio", root_path );
+    make_dirs( path_str );
+
+    make_file( "", "class/gpio/export" );
+    make_file( "", "class/gpio/unexport" );
+
+    make_gpio_chip( gpio_base, 54, gpio_label_str );
+
+    // Raspberry Pi 5's SoC GPIO sits below the RP1's and isn't wired to the header
+    if( rpi_model == 5 && gpio_base != 512 ) {
+
+        make_gpio_chip( 512, 32, "gpio-brcmstb@107d508500\n" );
+    }
+
+    for( int i = 0; i < tach_count; i++ ) {
+
+        unsigned int gpio_num = gpio_base + tachs[i].bcm_pin;
+
+        snprintf( path_str, sizeof( path_str ), "%s/class/gpio/gpio%u", root_path, gpio_num );
+        make_dirs( path_str );
+
+        make_file( "", "class/gpio/gpio%u/active_low", gpio_num );
+        make_file( "", "class/gpio/gpio%u/direction", gpio_num );
+        make_file( "", "class/gpio/gpio%u/edge", gpio_num );
+        tachs[i].fd_value = make_fifo( "class/gpio/gpio%u/value", gpio_num );
+    }
+}
+
+// Remove the fake tree
+void remove_tree() {
+
+    char command_str[ FAKE_PATH_MAX + 16 ];
+
+    snprintf( command_str, sizeof( command_str ), "rm -rf '%s'", root_path );
+
+    if( system( command_str ) != 0 ) {
+
+        fprintf( stderr, "Unable to remove %s!\n", root_path );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+int main( int argc, char* argv[] ) {
+
+    signal( SIGINT, handle_halt );
+    signal( SIGTERM, handle_halt );
+
+    for( int i = 1; i < argc; i++ ) {
+
+        bool has_value = i + 1 < argc;
+
+        if( strcmp( argv[i], "--help" ) == 0 ) {
+
+            printf( "\nFake sysfs hardware backend for pwm_fan_control2\n"
+                    "\n"
+                    "Usage: ./pwm_fan_fake_sysfs [options]\n"
+                    "\n"
+                    " - Prints the fake tree root on the first line of stdout, then runs until SIGINT/SIGTERM.\n"
+                    " - Point the controller at it with PWM_FAN_SYSFS_ROOT.\n"
+                    "\n"
+                    "Options:\n"
+                    "  --root DIR          Build the tree in DIR (default: mkdtemp in /tmp)\n"
+                    "  --keep              Do not remove the tree on exit\n"
+                    "  --model STR         Devicetree model string (default: \"Raspberry Pi 4 Model B\")\n"
+                    "  --pwm-chip N        Number the GPIO PWM chip N instead of the model's default\n"
+                    "  --gpio-base N       Base the SoC GPIO chip at N instead of the model's default\n"
+                    "  --temp C            Constant thermal zone temp in C (default: 45)\n"
+                    "  --temp-script FILE  Keyframes of \"<ms> <temp_c>\" lines, linearly interpolated\n"
+                    "  --pwm-log FILE      PWM write log \"t_ms,chip,channel,duty_cycle_ns\" (default: ROOT/pwm_writes.csv)\n"
+                    "  --tach PIN[:CH]     Emit tach edges on BCM GPIO PIN for the fan on PWM channel CH (default 0)\n"
+                    "  --tach-ppr N        Tach pulses per revolution (default: 2)\n"
+                    "  --max-rpm N         Simulated fan RPM at 100%% duty (default: 5000)\n"
+                    "  --stall-pct N       Simulated fan stalls below N%% duty (default: 10)\n"
+                    "  --start-pct N       Simulated fan only starts from a standstill at N%% duty (default: --stall-pct)\n"
+                    "  --seize MS[:MS2]    Simulated fan locks up MS after start; a full duty kick frees it after MS2\n"
+                    "  --wear-pct N        Simulated fan turns at N%% of its healthy RPM (default: 100)\n"
+                    "\n"
+                    "Example:\n"
+                    "\n"
+                    "  ./pwm_fan_fake_sysfs --root /tmp/fake_pi --tach 24 &\n"
+                    "  PWM_FAN_SYSFS_ROOT=/tmp/fake_pi ./pwm_fan_control2 debug 24 2\n"
+                    "\n"
+            );
+
+            return 0;
+
+        } else if( strcmp( argv[i], "--keep" ) == 0 ) {
+
+            keep_tree = true;
+
+        } else if( strcmp( argv[i], "--root" ) == 0 && has_value ) {
+
+            root_path = argv[ ++i ];
+
+        } else if( strcmp( argv[i], "--model" ) == 0 && has_value ) {
+
+            model_str = argv[ ++i ];
+
+        } else if( strcmp( argv[i], "--pwm-chip" ) == 0 && has_value ) {
+
+            pwm_chip_override = atoi( argv[ ++i ] );
+
+        } else if( strcmp( argv[i], "--gpio-base" ) == 0 && has_value ) {
+
+            gpio_base_override = atoi( argv[ ++i ] );
+
+        } else if( strcmp( argv[i], "--temp" ) == 0 && has_value ) {
+
+            temp_c = strtof( argv[ ++i ], NULL );
+
+        } else if( strcmp( argv[i], "--temp-script" ) == 0 && has_value ) {
+
+            temp_script_path = argv[ ++i ];
+
+        } else if( strcmp( argv[i], "--pwm-log" ) == 0 && has_value ) {
+
+            pwm_log_path = argv[ ++i ];
+
+        } else if( strcmp( argv[i], "--tach" ) == 0 && has_value ) {
+
+            if( tach_count >= FAKE_MAX_TACH ) { die( "At most %i tachometers supported!\n", FAKE_MAX_TACH ); }
+
+            unsigned int pin = 0, channel = 0;
+
+            if( sscanf( argv[ ++i ], "%u:%u", &pin, &channel ) < 1 ) { die( "Invalid --tach %s\n", argv[i] ); }
+
+            tachs[ tach_count ].bcm_pin     = pin;
+            tachs[ tach_count ].pwm_channel = channel;
+            tach_count++;
+
+        } else if( strcmp( argv[i], "--tach-ppr" ) == 0 && has_value ) {
+
+            tach_ppr = strtoul( argv[ ++i ], NULL, 10 );
+
+        } else if( strcmp( argv[i], "--max-rpm" ) == 0 && has_value ) {
+
+            max_rpm = strtoul( argv[ ++i ], NULL, 10 );
+
+        } else if( strcmp( argv[i], "--stall-pct" ) == 0 && has_value ) {
+
+            stall_pct = strtoul( argv[ ++i ], NULL, 10 );
+
+        } else if( strcmp( argv[i], "--start-pct" ) == 0 && has_value ) {
+
+            start_pct = strtoul( argv[ ++i ], NULL, 10 );
+
+        } else if( strcmp( argv[i], "--seize" ) == 0 && has_value ) {
+
+            if( sscanf( argv[ ++i ], "%ld:%ld", &seize_from_ms, &seize_until_ms ) < 1 ) { die( "Invalid --seize %s\n", argv[i] ); }
+
+        } else if( strcmp( argv[i], "--wear-pct" ) == 0 && has_value ) {
+
+            wear_pct = strtoul( argv[ ++i ], NULL, 10 );
+
+        } else {
+
+            die( "Unknown or incomplete option %s! Use --help for usage information.\n", argv[i] );
+        }
+    }
+
+    if( tach_ppr == 0 ) { die( "--tach-ppr must be at least 1!\n" ); }
+
+    if( temp_script_path != NULL ) { load_temp_script( temp_script_path ); }
+
+    static char root_template[] = "/tmp/pwm_fan_fake.XXXXXX";
+
+    if( root_path == NULL ) {
+
+        root_path = mkdtemp( root_template );
+
+        if( root_path == NULL ) { die( "Unable to create temp dir: %s\n", strerror( errno ) ); }
+
+    } else {
+
+        make_dirs( root_path );
+    }
+
+    build_tree();
+
+    for( int i = 0; i < tach_count; i++ ) {
+
+        if( tachs[i].pwm_channel >= pwm_channel_count ) {
+
+            die( "Tach PWM channel %i does not exist on this model!\n", tachs[i].pwm_channel );
+        }
+    }
+
+    // Open the PWM write log
+    char pwm_log_default_path[ FAKE_PATH_MAX ];
+
+    if( pwm_log_path == NULL ) {
+
+        snprintf( pwm_log_default_path, sizeof( pwm_log_default_path ), "%s/pwm_writes.csv", root_path );
+        pwm_log_path = pwm_log_default_path;
+    }
+
+    fd_pwm_log = fopen( pwm_log_path, "w" );
+
+    if( fd_pwm_log == NULL ) { die( "Unable to open PWM log %s: %s\n", pwm_log_path, strerror( errno ) ); }
+
+    fprintf( fd_pwm_log, "t_ms,chip,channel,duty_cycle_ns\n" );
+
+    clock_gettime( CLOCK_MONOTONIC, &start_ts );
+
+    // Announce the root so scripts can point the controller at it
+    printf( "%s\n", root_path );
+    fflush( stdout );
+
+    pthread_create( &pwm_recorder_thread, NULL, pwm_recorder_func, NULL );
+
+    for( int i = 0; i < tach_count; i++ ) {
+
+        pthread_create( &tachs[i].thread, NULL, tach_func, &tachs[i] );
+    }
+
+    // Follow the temp script until halted
+    struct timespec step_ts = { 0, FAKE_TEMP_STEP_MS * 1000000 };
+
+    while( ! halt_received ) {
+
+        if( keyframe_count > 0 ) { write_temp_mc( script_temp_mc( elapsed_ms() ) ); }
+
+        nanosleep( &step_ts, NULL );
+    }
+
+    pthread_join( pwm_recorder_thread, NULL );
+
+    for( int i = 0; i < tach_count; i++ ) {
+
+        pthread_join( tachs[i].thread, NULL );
+    }
+
+    fclose( fd_pwm_log );
+
+    if( ! keep_tree ) { remove_tree(); }
+
+    return 0;
+}
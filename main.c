@@ -1,19 +1,41 @@
+#include <arpa/inet.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <math.h>
+#include <linux/genetlink.h>
+#include <linux/gpio.h>
+#include <linux/netlink.h>
+#include <linux/thermal.h>
+#include <netdb.h>
+#include <netinet/in.h>
 #include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/utsname.h>
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
 
+#include "controller.h"
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  Constants
@@ -46,12 +68,15 @@
 #define MAX_GPIO     26
 #define MAX_GPIO_PWM 4
 
+// Highest BCM GPIO # on the SoC GPIO controller's first bank (GPIO 0-27 on every model)
+#define MAX_BCM_GPIO_NUM 27
+
+// Topology cache line length
+#define TOPOLOGY_LINE_MAX 256
+
+// Max # of fans; one per PWM channel
+#define MAX_FANS MAX_GPIO_PWM
 
-// Define fan modes
-#define FAN_BELOW_OFF 0
-#define FAN_BELOW_MIN 1
-#define FAN_ABOVE_EAS 2
-#define FAN_ABOVE_MAX 3
 
 // CPU temp out-of-bounds range where error is thrown (temp in C * 1000)
 #define CPU_TEMP_OOB_LOW 0
@@ -60,17 +85,129 @@
 // When is the duty cycle considered out of range
 // - High-end range is 50kHz (double that of our default Noctua fan)
 // - Should account for most PWM fans on the consumer/industrial markets
-#define DUTY_CYCLE_NS_OOB_LOW 0
+// - No low-end check; the duty cycle is unsigned so it can't go below 0
 #define DUTY_CYCLE_NS_OOB_HIGH 800000
 
 // Use a timeout for polling so that we can detect 0 RPM
 #define RPM_TIMEOUT_MS 100
 
+// Fan health from stall detection
+#define FAN_HEALTH_OK       0
+#define FAN_HEALTH_DEGRADED 1
+#define FAN_HEALTH_STALLED  2
+#define FAN_HEALTH_FAULT    3
+
+// # of fan health states for metrics
+#define FAN_HEALTH_COUNT 4
+
+// Exit status when a fan faults with STALL_EXIT set
+#define EXIT_FAN_FAULT 3
+
 // Define a minimum time between tach pulses to avoid spurious pulses
 #define TACH_MIN_TIME_DELTA_MS 2
 
-// Smooth temp bezier input array size
-#define CPU_TEMP_SMOOTH_ARR_SIZE 4
+// Tachometer backends
+#define TACH_BACKEND_SYSFS 0
+#define TACH_BACKEND_CDEV  1
+
+// Max # of GPIO character device edge events read per syscall
+#define TACH_CDEV_EVENT_BATCH 16
+
+// Max # of /dev/gpiochipN devices scanned for the SoC GPIO controller
+#define TACH_CDEV_MAX_CHIPS 16
+
+// Reactor event sources; packed with an index or fd into each epoll event's data
+#define REACTOR_TICK_TIMER     1
+#define REACTOR_THERMAL_EVENTS 2
+#define REACTOR_CONFIG_WATCH   3
+#define REACTOR_SIGNAL         4
+#define REACTOR_TACH           5
+#define REACTOR_METRICS_LISTEN 6
+#define REACTOR_METRICS_CLIENT 7
+#define REACTOR_PSI_TRIGGER    8
+
+// Max # of epoll events handled per reactor wakeup
+#define REACTOR_MAX_EVENTS 16
+
+// printf a millidegree temp as C rounded to 2 decimals; ie: `printf( MC_FMT, MC_FMT_ARGS( t ) )`
+#define MC_FMT "%i.%02i"
+#define MC_FMT_ARGS( mc ) ( ( mc ) + 5 ) / 1000, ( ( ( mc ) + 5 ) / 10 ) % 100
+
+// Max length of any sysfs path we build (root prefix + class path)
+#define SYSFS_PATH_MAX 256
+
+// Re-check interval while waiting for a sysfs node; kernel-created nodes don't always raise
+//    inotify events
+#define WAIT_FOR_FILE_RECHECK_MS 10
+
+// Receive buffer for thermal netlink messages
+#define THERMAL_EVENT_BUFFER_SIZE 4096
+
+// Last duty cycle written to the kernel is not known (startup or after a write error)
+#define PWM_DUTY_CYCLE_NS_UNKNOWN -1
+
+// Telemetry output formats
+#define TELEMETRY_OFF    0
+#define TELEMETRY_CSV    1
+#define TELEMETRY_JSONL  2
+#define TELEMETRY_BINARY 3
+
+// Telemetry ring capacity in samples (power of 2) and writer thread batching interval while
+//    samples keep coming
+#define TELEMETRY_RING_SIZE 1024
+#define TELEMETRY_FLUSH_MS  100
+
+// Telemetry writer batch buffer; flushed early when it can't fit another sample
+#define TELEMETRY_BUFFER_SIZE 65536
+#define TELEMETRY_LINE_MAX    512
+
+// Feed-forward PSI trigger window; the stall threshold is per this window
+#define FF_PSI_WINDOW_US 1000000
+
+// Feed-forward /proc/stat read buffer; only the aggregate `cpu` line is parsed
+#define FF_PROC_STAT_BUFFER_SIZE 256
+
+// Max # of peers a shared chassis listener tracks, and a peer id's length
+#define PEER_MAX    16
+#define PEER_ID_MAX 32
+
+// Peer datagram magic and version ("PFT" + 1)
+#define PEER_MAGIC 0x50465401
+
+// Peer temp aggregation
+#define PEER_AGGREGATE_MAX  0
+#define PEER_AGGREGATE_MEAN 1
+
+// Replay trace line length and max # of columns
+#define REPLAY_LINE_MAX    1024
+#define REPLAY_MAX_COLUMNS 64
+
+// Calibration file line length
+#define CALIBRATION_LINE_MAX 1024
+
+// Calibration RPM measurement window, how close (%) two windows in a row must be to count as
+//    steady, and the max # of windows per step
+#define CALIBRATE_WINDOW_MS   1000
+#define CALIBRATE_STEADY_PCT  3
+#define CALIBRATE_MAX_WINDOWS 5
+
+// Config file limits; # of keys, line length and key length
+#define CONFIG_FILE_MAX_KEYS 128
+#define CONFIG_LINE_MAX      512
+#define CONFIG_KEY_MAX       64
+
+// Timing histogram buckets in us; a final +Inf bucket is implied
+#define METRICS_BUCKETS_US { 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000 }
+#define METRICS_BUCKET_COUNT 14
+
+// Metrics response buffer, request read buffer and how long a client gets to send a request
+#define METRICS_RESPONSE_SIZE   16384
+#define METRICS_REQUEST_SIZE    1024
+#define METRICS_REQUEST_WAIT_MS 100
+#define METRICS_SEND_TIMEOUT_MS 1000
+
+// Scrapes the reactor serves at once; more are closed unanswered
+#define METRICS_REACTOR_CLIENTS 8
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -82,12 +219,326 @@ typedef struct {
     int sysfs_num;
 } PinMapping;
 
+// Tachometer snapshot as seen by readers
+typedef struct {
+    unsigned int rpm;
+    unsigned long long pulse_count;
+    long long last_edge_ns;
+    bool valid;
+} TachSnapshot;
+
+// Tachometer state published by the polling thread under a seqlock
+// - The single writer makes `seq` odd while updating; readers retry if `seq` was odd or changed,
+//   so readers never block the edge handling thread and never see a torn snapshot
+typedef struct {
+    atomic_uint seq;
+    atomic_uint rpm;
+    atomic_ullong pulse_count;
+    atomic_llong last_edge_ns;
+    atomic_bool valid;
+} TachState;
+
+// A PWM_FAN_* key set from the config file and the env value it replaced (NULL if unset)
+typedef struct {
+    char key[ CONFIG_KEY_MAX ];
+    char *env_value;
+} ConfigFileKey;
+
+// Timestamps of one control tick, all CLOCK_MONOTONIC (main loop only)
+typedef struct {
+    long long deadline_ns;
+    long long start_ns;
+    long long read_ns;
+    long long done_ns;
+
+    // Time spent in PWM duty cycle writes; the rest of read_ns..done_ns is the decision
+    long long write_ns;
+} TickTiming;
+
+// One telemetry sample per control tick
+typedef struct {
+    long long t_ns;
+    int temp_mc;
+    int smooth_temp_mc;
+
+    // Scheduled tick deadline to duty cycles written, and deadline to wakeup
+    unsigned int latency_ns;
+    unsigned int jitter_ns;
+
+    // Per-stage time; temp read, decision and PWM writes
+    unsigned int read_ns;
+    unsigned int decide_ns;
+    unsigned int write_ns;
+
+    // Running totals at this tick
+    unsigned int deadline_misses;
+    unsigned int sysfs_errors;
+
+    unsigned char mode[ MAX_FANS ];
+    unsigned short duty_cycle[ MAX_FANS ];
+    unsigned int rpm[ MAX_FANS ];
+} TelemetrySample;
+
+// Histogram with fixed METRICS_BUCKETS_US bounds; counts are per bucket, not cumulative
+typedef struct {
+    atomic_ullong buckets[ METRICS_BUCKET_COUNT ];
+    atomic_ullong sum_ns;
+    atomic_ullong max_ns;
+    atomic_ullong count;
+} MetricsHistogram;
+
+// Replay summary per fan; times are trace time the decision held for, until the next sample
+typedef struct {
+    long long on_ms;
+    long long over_max_ms;
+    long long mode_ms[ FAN_MODE_COUNT ];
+    long long duty_ms;
+    unsigned long transitions;
+    unsigned long starts;
+} ReplayStats;
+
+// One fan's calibration; keyed by PWM pin, frequency and duty cycle scale
+typedef struct {
+    bool valid;
+    unsigned short bcm_gpio_pin_pwm,
+                   pwm_freq_hz,
+                   max_duty_cycle;
+
+    // Lowest duty cycle that starts the fan from a standstill and lowest that keeps it spinning
+    unsigned short start_duty_cycle,
+                   stop_duty_cycle;
+
+    // Steady RPM per duty cycle step, increasing duty cycle
+    RpmPoint rpm_points[ CALIBRATION_MAX_POINTS ];
+    int rpm_point_count;
+} Calibration;
+
+// Feed-forward state (main loop only)
+typedef struct {
+    int fd_proc_stat;
+    int fd_cpufreq_cur;
+    long cpufreq_max_khz;
+    unsigned long long last_busy,
+                       last_total;
+
+    // Load average the temp has caught up to, in permille, and when it was last updated
+    long long load_avg_permille;
+    long long last_update_ns;
+} FeedForward;
+
+// Peer temp sample; one datagram per tick in network byte order with no padding
+typedef struct __attribute__(( packed )) {
+    unsigned int magic;
+    int temp_mc;
+    int smooth_temp_mc;
+    unsigned short weight;
+    char id[ PEER_ID_MAX ];
+} PeerDatagram;
+
+// A peer's latest sample and when it arrived
+typedef struct {
+    char id[ PEER_ID_MAX + 1 ];
+    int temp_mc;
+    int smooth_temp_mc;
+    unsigned short weight;
+    long long last_ns;
+} Peer;
+
+// Metrics published by the main loop for the metrics thread
+// - Single writer with relaxed atomics; a scrape may mix values from adjacent ticks
+typedef struct {
+    atomic_int temp_mc;
+    atomic_int smooth_temp_mc;
+    atomic_ullong ticks;
+
+    // Per fan last decision and ms spent in each mode
+    atomic_uint duty_cycle[ MAX_FANS ];
+    atomic_uint rpm[ MAX_FANS ];
+    atomic_uint mode[ MAX_FANS ];
+    atomic_uint health[ MAX_FANS ];
+    atomic_ullong mode_ms[ MAX_FANS ][ FAN_MODE_COUNT ];
+
+    // Failed or invalid sysfs reads/writes; CPU temp, PWM duty cycle and tach value
+    atomic_ulong sysfs_errors;
+
+    // Feed-forward CPU load and the temp lead it added at the last tick
+    atomic_uint load_permille;
+    atomic_int ff_offset_mc;
+
+    // Shared chassis peers by state and peer datagrams by result
+    atomic_uint peers_fresh;
+    atomic_uint peers_stale;
+    atomic_ulong peer_sent;
+    atomic_ulong peer_send_failed;
+    atomic_ulong peer_received;
+    atomic_ulong peer_rejected;
+
+    // When the loop started and the process wakeups up to then, for the wakeup rate
+    long long started_ns;
+    unsigned long started_wakeups;
+
+    // Tick deadline to duty cycles written, and tick deadline to wakeup
+    MetricsHistogram loop_latency;
+    MetricsHistogram wakeup_jitter;
+
+    // Per-stage time of each tick
+    MetricsHistogram stage_read;
+    MetricsHistogram stage_decide;
+    MetricsHistogram stage_write;
+} Metrics;
+
+// A reactor scrape; it keeps its response until the socket has taken all of it
+typedef struct {
+    bool is_active;
+    int fd;
+    long long deadline_ns;
+    char *out;
+    int out_len;
+    char response[ METRICS_RESPONSE_SIZE ];
+} MetricsClient;
+
+// Compact binary telemetry record; native byte order with no padding
+typedef struct __attribute__(( packed )) {
+    long long t_ns;
+    int temp_mc;
+    int smooth_temp_mc;
+    unsigned int latency_ns;
+    unsigned int jitter_ns;
+    unsigned int read_ns;
+    unsigned int decide_ns;
+    unsigned int write_ns;
+    unsigned int deadline_misses;
+    unsigned int sysfs_errors;
+    struct __attribute__(( packed )) {
+        unsigned char mode;
+        unsigned short duty_cycle;
+        unsigned short rpm;
+    } fans[ MAX_FANS ];
+} TelemetryRecord;
+
+// One fan; a PWM channel with its own limits, curve and optional tachometer
+typedef struct {
+
+    // Fan # for logs and PWM_FAN_<n>_* config
+    int idx;
+
+    // Config - defaults to the global ENV CONFIG values
+    unsigned short bcm_gpio_pin_pwm,
+                   pwm_freq_hz;
+
+    char *curve;
+    char *curve_points_str;
+
+    // Control mode; curve, pid (hold a temp) or pid_rpm (temp loop sets an RPM target held by
+    //    an inner RPM loop)
+    char *control;
+
+    // Limits, curve, PID loops and decision state
+    Controller ctl;
+
+    // Tachometer config; enabled when a tach pin is set
+    bool is_tach_enabled;
+    unsigned short bcm_gpio_pin_tach,
+                   tach_pulse_per_rev;
+
+    // PWM chip/channel and duty cycle period in ns
+    unsigned short pwm_chip_num;
+    unsigned short pwm_channel_num;
+    unsigned int pwm_duty_cycle_period_ns;
+
+    // File descriptors for control through /sys/class
+    FILE *fd_pwm_chip_export;
+    FILE *fd_pwm_chip_unexport;
+    FILE *fd_pwm_channel_enable;
+    FILE *fd_pwm_channel_set_duty_cycle_period;
+
+    // Duty cycle is written every tick so it uses a raw file descriptor instead of stdio
+    int fd_pwm_channel_set_duty_cycle;
+
+    // Last duty cycle in ns written to the kernel so no-op writes can be skipped
+    long pwm_last_duty_cycle_ns;
+
+    // Preallocated buffer for formatting duty cycle writes (max unsigned int + newline)
+    char pwm_duty_cycle_buffer[12];
+
+    // Duty cycle write counters
+    // - Atomic as the metrics thread reads them; only the main loop writes
+    atomic_ulong pwm_duty_cycle_writes,
+                 pwm_duty_cycle_writes_skipped;
+
+    // True GPIO tachometer GPIO # from /sys/kernel/debug/gpio
+    unsigned short gpio_true_tach_num;
+
+    // GPIO file descriptors
+    FILE *fd_gpio_tach_export;
+    FILE *fd_gpio_tach_unexport;
+    FILE *fd_gpio_tach_active_low;
+    FILE *fd_gpio_tach_direction;
+    FILE *fd_gpio_tach_edge;
+
+    // GPIO file descriptors - polling (sysfs) or line request (cdev)
+    int fd_gpio_tach_value;
+    int fd_gpio_tach_line;
+
+    // Set when the value node is a fake backend FIFO; it queues a byte per edge and can't seek
+    bool is_tach_value_fifo;
+
+    // Tachometer snapshot published by the polling thread
+    TachState tach_state;
+
+    // Polling thread only - last handled edge, last pulse seen and running pulse count
+    long long tach_last_fall_ns;
+    long long tach_last_pulse_ns;
+    unsigned long long tach_pulse_count;
+
+    // Main loop only - snapshot at the previous tick for windowed RPM, and that RPM
+    TachSnapshot tach_window_last;
+    unsigned int tach_rpm;
+
+    // Main loop only - stall detection; health, when the current RPM shortfall started (0 for
+    //    none), kick-starts tried since the fan last spun right and when the running kick ends
+    unsigned short health;
+    long long stall_since_ns;
+    unsigned short stall_kicks;
+    long long kick_until_ns;
+
+    // Main loop only - duty cycle written at the last tick for metrics and telemetry; the
+    //    decision (ctl.duty_cycle_set_val) unless the fan was held at max
+    unsigned short duty_cycle_applied;
+} Fan;
+
 typedef struct {
     int pwm_chip_num;
     PinMapping gpio_pwm_map[ MAX_GPIO_PWM ];
     PinMapping gpio_map[ MAX_GPIO ];
 } ModelMapping;
 
+// PWM controller by devicetree compatible with its GPIO pin to channel map; `device_suffix`
+//    picks one instance when an SoC has several (the Pi 5's second RP1 PWM drives the fan
+//    header, not GPIO 12/13/18/19)
+typedef struct {
+    const char *compatible;
+    const char *device_suffix;
+    PinMapping gpio_pwm_map[ MAX_GPIO_PWM ];
+} PwmController;
+
+// Resolved hardware topology; -1 when a part couldn't be resolved
+typedef struct {
+    int pwm_chip_num;
+    PinMapping gpio_pwm_map[ MAX_GPIO_PWM ];
+    int gpio_base;
+} Topology;
+
+// Known PWM controllers for discovery
+PwmController PWM_CONTROLLERS[] = {
+    { "brcm,bcm2835-pwm",    NULL,        { {12, 0}, {13, 1}, {18, 0}, {19, 1} } },
+    { "raspberrypi,rp1-pwm", "98000.pwm", { {18, 0}, {19, 1}, {12, 2}, {13, 3} } }
+};
+
+// SoC GPIO controller labels; line offsets (and sysfs GPIO #s from its base) are BCM GPIO #s
+const char* SOC_GPIO_LABELS[] = { "pinctrl-bcm2835", "pinctrl-bcm2711", "pinctrl-rp1" };
+
+// Fallback for when discovery fails, by model
 // IMPORTANT!!!
 // - Must be sequentially incremented based on Raspberry Pi model #; ie 3, 4, 5
 ModelMapping MODEL_SYSFS_MAP[] = {
@@ -152,8 +603,45 @@ ModelMapping MODEL_SYSFS_MAP[] = {
 //  Global scope vars
 //
 
-// Model of Raspberry Pi
+// Model of Raspberry Pi and its devicetree model string
 short rpi_model = -1;
+char rpi_model_str[ TOPOLOGY_LINE_MAX ] = "";
+
+// PWM chip, channel map and GPIO base resolved at startup
+Topology topology = { -1, { { -1, -1 } }, -1 };
+
+// ENV CONFIG - Cache of the discovered topology so later starts skip the scan; keyed by model,
+//    kernel release and SYSFS_ROOT (empty to disable)
+char *TOPOLOGY_CACHE = "/run/pwm_fan_control2.topology";
+
+// ENV CONFIG - Fan calibrations written by `calibrate`; loaded at start and on reload
+//    (empty to disable)
+char *CALIBRATION_FILE = "/var/lib/pwm_fan_control2.calibration";
+
+// ENV CONFIG - Calibration sweep step in % of MAX_DUTY_CYCLE and settle time per step
+unsigned short CALIBRATE_STEP = 5;
+unsigned int CALIBRATE_SETTLE_MS = 3000;
+
+// Calibrations loaded from CALIBRATION_FILE, by fan #
+Calibration calibrations[ MAX_FANS ];
+
+// ENV CONFIG - Stall detection for fans with a tachometer (STALL_DETECT_MS 0 to disable)
+// - A fan commanded to spin that reads 0 RPM for STALL_DETECT_MS is kick-started at
+//   MAX_DUTY_CYCLE for KICK_MS, up to STALL_KICKS times, then faults and is held at
+//   MAX_DUTY_CYCLE; STALL_EXIT exits with EXIT_FAN_FAULT on a fault instead
+// - A calibrated fan under STALL_DEGRADED_PCT of its calibrated RPM for as long is degraded
+unsigned int STALL_DETECT_MS = 3000;
+unsigned short STALL_DEGRADED_PCT = 50;
+unsigned int KICK_MS = 1000;
+unsigned short STALL_KICKS = 2;
+bool STALL_EXIT = false;
+
+// Set when a fan faults with STALL_EXIT so the main loop exits with EXIT_FAN_FAULT
+bool fan_fault_exit = false;
+
+// ENV CONFIG - Root of the sysfs tree; override to run against a fake tree
+// - See `pwm_fan_fake_sysfs` for a bundled fake hardware backend
+char *SYSFS_ROOT = "/sys";
 
 // ENV CONFIG - Declare configuration variables w/expected type
 unsigned short BCM_GPIO_PIN_PWM = 18,
@@ -165,10 +653,101 @@ unsigned short BCM_GPIO_PIN_PWM = 18,
 // ENV CONFIG - Time to sleep in main loop
 unsigned int SLEEP_MS = 250;
 
-// ENV CONFIG - Temp ranges
-float MIN_OFF_TEMP_C = 38,
-      MIN_ON_TEMP_C  = 40,
-      MAX_TEMP_C     = 46;
+// ENV CONFIG - Adaptive tick interval bounds; the interval is sized so the temp moves about
+//    ADAPT_STEP_MC per tick (default to SLEEP_MS so adaptation is off unless configured)
+unsigned int SLEEP_MIN_MS = 0,
+             SLEEP_MAX_MS = 0;
+int ADAPT_STEP_MC = 500;
+
+// ENV CONFIG - Temp ranges in millidegrees C (configured in C)
+int MIN_OFF_TEMP_MC = 38000,
+    MIN_ON_TEMP_MC  = 40000,
+    MAX_TEMP_MC     = 46000;
+
+// ENV CONFIG - Fan curve shape between MIN_OFF_TEMP_MC and MAX_TEMP_MC
+// - quartic|cubic|sine|linear, or points with CURVE_POINTS as `temp_c:duty_cycle,...`
+char *CURVE        = "quartic";
+char *CURVE_POINTS = "";
+
+// ENV CONFIG - Control mode (curve|pid|pid_rpm); PID gains are per C of error (ie: duty
+//    cycle %/C) stored * 1000, and the RPM loop's per RPM of error
+char *CONTROL = "curve";
+int PID_TARGET_MC = 43000;
+int PID_KP_MILLI  = 4000,
+    PID_KI_MILLI  = 200,
+    PID_KD_MILLI  = 0;
+int RPM_KP_MILLI  = 10,
+    RPM_KI_MILLI  = 20;
+
+// ENV CONFIG - pid_rpm - RPM at MAX_DUTY_CYCLE; the temp loop's duty cycle maps linearly to
+//    an RPM target up to this
+unsigned int PID_MAX_RPM = 5000;
+
+// ENV CONFIG - Smoothing filter for the curve input temp (sma|ema|median) and its window in
+//    samples; for ema the window sets alpha = 2 / ( window + 1 )
+char *SMOOTH_FILTER = "sma";
+unsigned int SMOOTH_WINDOW = 4;
+
+// ENV CONFIG - Event-driven mode; sleep until a thermal trip event or until the temp could
+//    have reached the next band edge at EVENT_MAX_SLEW_MC_S, bounded by EVENT_MAX_SLEEP_MS
+bool EVENT_MODE = false;
+unsigned int EVENT_MAX_SLEEP_MS = 10000;
+int EVENT_MAX_SLEW_MC_S = 4000;
+
+// ENV CONFIG - Power save mode; waits take TIMER_SLACK_US of timer slack, the tach thread
+//    parks while every fan is stopped, and the loop backs off to IDLE_SLEEP_MS while every
+//    fan is off and the temp is IDLE_MARGIN_MC or more below its MIN_ON_TEMP_MC
+bool POWER_SAVE = false;
+unsigned int TIMER_SLACK_US = 50000;
+unsigned int IDLE_SLEEP_MS = 15000;
+int IDLE_MARGIN_MC = 5000;
+
+// ENV CONFIG - Feed-forward from CPU load; the control temp leads the sensor by FF_GAIN_MC per
+//    100% of load above its FF_TAU_MS average so fans pre-ramp on a burst and ease off early
+//    when it ends, and a PSI trigger on FF_PSI_US of CPU stall per second wakes the loop
+bool FEEDFORWARD = false;
+int FF_GAIN_MC = 5000;
+unsigned int FF_TAU_MS = 30000;
+unsigned int FF_PSI_US = 100000;
+
+// Feed-forward load sources and state, and the PSI trigger (-1 when unavailable)
+FeedForward feedforward = { -1, -1, 0, 0, 0, -1, 0 };
+int fd_psi_trigger = -1;
+
+// ENV CONFIG - Shared chassis; publish this host's control temps to PEER_PUBLISH and/or fold
+//    the temps published to PEER_LISTEN into the control input (`udp:host:port` or
+//    `unix:/path`; empty to disable)
+// - PEER_AGGREGATE max|mean, where mean weighs each host by its PEER_WEIGHT
+// - Fans are held at MAX_DUTY_CYCLE while a peer heard from has been silent for
+//   PEER_TIMEOUT_MS, or fewer than PEER_EXPECT peers have been heard from
+char *PEER_PUBLISH = "";
+char *PEER_LISTEN = "";
+char *PEER_AGGREGATE = "max";
+char *PEER_ID = "";
+unsigned short PEER_WEIGHT = 1;
+unsigned int PEER_TIMEOUT_MS = 5000;
+unsigned int PEER_EXPECT = 0;
+int peer_aggregate = PEER_AGGREGATE_MAX;
+
+// Peer sockets, the publish address and the peers heard from (main loop only)
+int fd_peer_publish = -1;
+int fd_peer_listen  = -1;
+struct sockaddr_storage peer_publish_addr;
+socklen_t peer_publish_addr_len = 0;
+Peer peers[ PEER_MAX ];
+int peer_count = 0;
+char peer_id[ PEER_ID_MAX + 1 ];
+
+// Set while peers are stale so the fans are held at max
+bool is_peer_stale = false;
+
+// ENV CONFIG - Adopt PWM channels and tach GPIOs that are already exported instead of
+//    re-exporting them, and leave them exported at exit for the next start
+bool ADOPT = false;
+
+// ENV CONFIG - Full duty cycle blip at start; the main loop warms up the temp filter while
+//    it runs (0 to disable)
+unsigned int BLIP_MS = 2000;
 
 // Debug logging mode enabled
 bool debug_logging_enabled = false;
@@ -176,66 +755,159 @@ bool debug_logging_enabled = false;
 // CSV debugging - disables all logs minus telemetry
 bool csv_debug_logging_enabled = false;
 
+// ENV CONFIG - Telemetry format (off|csv|jsonl|binary; csvdebug defaults to csv), output file
+//    (`-` for stdout) and downsampling to every Nth tick
+char *TELEMETRY = "off";
+char *TELEMETRY_FILE = "-";
+unsigned int TELEMETRY_EVERY = 1;
+int telemetry_format = TELEMETRY_OFF;
+
+// Telemetry single-producer (main loop) single-consumer (writer thread) ring; the producer
+//    only advances head and the consumer only advances tail so no locks are needed
+TelemetrySample telemetry_ring[ TELEMETRY_RING_SIZE ];
+atomic_uint telemetry_head = 0;
+atomic_uint telemetry_tail = 0;
+
+// Main loop only - samples dropped on a full ring and ticks since the last kept sample
+unsigned long telemetry_dropped = 0;
+unsigned int telemetry_skip = 0;
+
+// Telemetry output file descriptor and writer thread
+int fd_telemetry = -1;
+pthread_t telemetry_thread;
+
+// Set while the writer thread is parked on an empty ring; the next sample wakes it through
+//    the eventfd
+atomic_bool telemetry_is_parked = false;
+int fd_telemetry_wake = -1;
+
+// ENV CONFIG - Prometheus text metrics on a Unix socket path and/or a localhost TCP port
+//    (empty/0 to disable)
+char *METRICS_SOCKET = "";
+unsigned short METRICS_PORT = 0;
+
+// Metrics and stage timing published every tick, listening sockets and the serving thread
+Metrics metrics;
+int fd_metrics_unix = -1;
+int fd_metrics_tcp  = -1;
+pthread_t metrics_thread;
+
+// Reactor only - scrapes waiting on their request, or on room to send the rest of the response
+MetricsClient metrics_clients[ METRICS_REACTOR_CLIENTS ];
+
 // Is setup flag to know if writing to the PWM is safe
 bool is_setup = false;
 
-// Is tachometer enabled?
+// Is tachometer enabled on any fan?
 bool is_tach_enabled = false;
 
-// Calculate the PWM duty cycle period in nano-seconds
-unsigned int pwm_duty_cycle_period_ns;
+// ENV CONFIG - # of fans; fan 0 uses the global config, every fan can override it with
+//    PWM_FAN_<n>_* variables
+unsigned int FAN_COUNT = 1;
 
-// Keep chip number and channel number in broad scope for clean-up
-unsigned short pwm_chip_num;
-unsigned short pwm_channel_num;
+// Configured fans; only the first fan_count are valid
+Fan fans[ MAX_FANS ];
+int fan_count = 0;
 
-// File descriptors for control through /sys/class
-FILE *fd_pwm_chip_export                   = NULL;
-FILE *fd_pwm_chip_unexport                 = NULL;
-FILE *fd_pwm_channel_enable                = NULL;
-FILE *fd_pwm_channel_set_duty_cycle        = NULL;
-FILE *fd_pwm_channel_set_duty_cycle_period = NULL;
+// File descriptor for the CPU temp; re-read in place with pread every tick
+int fd_cpu_temp = -1;
 
-// File handler for the CPU temp
-FILE *fd_cpu_temp = NULL;
+// Thermal generic netlink socket subscribed to trip point events (event mode only)
+int fd_thermal_events = -1;
 
-// Last time above the minimum off temp
-struct timeval last_above_min_epoch;
+// Tick scheduler - timerfd armed with absolute CLOCK_MONOTONIC deadlines so iteration cost
+//    never accumulates as drift
+int fd_tick_timer = -1;
+long long next_tick_deadline_ns;
+atomic_ulong scheduler_deadline_misses = 0;
 
-// Array of last X CPU temps to average for smoothing out bezier input
-float cpu_temp_smooth_arr[ CPU_TEMP_SMOOTH_ARR_SIZE ] = {0};
+// ENV CONFIG - Single-threaded epoll reactor over the tick timer, tach edges, signals and
+//    metrics sockets in place of the tachometer and metrics threads
+bool REACTOR = false;
+
+// Reactor epoll instance and the signalfd that replaces the signal handlers under it
+int fd_reactor = -1;
+int fd_signal  = -1;
+
+// Timing of the tick in progress
+TickTiming tick_timing;
+
+// Adaptive interval state
+unsigned int adaptive_interval_ms = 0;
+int adaptive_last_temp_mc;
+long long adaptive_last_sample_ns;
+
+// Smoothing filter over the last SMOOTH_WINDOW CPU temps for smoothing out curve input
+SmoothFilter cpu_temp_smooth = { 0 };
 
 // Setup a flag so we can notify the main loop to close when SIGINT is
 //    caught and our halt is called
 volatile sig_atomic_t halt_received = 0;
 
-// Declare configuration variables w/expected type
-unsigned short bcm_gpio_pin_tach,
-               tach_pulse_per_rev;
-
-// Track tachometer (only enabled during debug)
-// - RPM as volatile since it will be referenced from multiple threads
-volatile unsigned short tach_rpm = 0;
-struct timeval tach_last_fall_epoch;
+// Set by SIGUSR1 to log the timing stats and counters
+volatile sig_atomic_t dump_stats_received = 0;
+
+// ENV CONFIG - Tachometer backend; sysfs (legacy GPIO export/edge/value) or cdev (GPIO v2
+//    character device line events with kernel timestamps and debounce)
+char *TACH_BACKEND = "sysfs";
+int tach_backend = TACH_BACKEND_SYSFS;
+
+// ENV CONFIG - cdev backend GPIO chip (default: scan for the SoC GPIO controller) and kernel
+//    debounce period
+char *TACH_GPIOCHIP = NULL;
+unsigned int TACH_DEBOUNCE_US = 1000;
+
+// ENV CONFIG - KEY=VALUE file of PWM_FAN_* settings that override the environment; reloaded
+//    on SIGHUP or when the file changes (NULL to disable)
+char *CONFIG_FILE = NULL;
+
+// Keys the config file has set so a key dropped from the file reverts to its env value
+ConfigFileKey config_file_keys[ CONFIG_FILE_MAX_KEYS ];
+int config_file_key_count = 0;
+
+// inotify watch on the config file's directory; editors often replace rather than write it
+int fd_config_watch = -1;
+char *config_file_name = NULL;
+
+// Set by SIGHUP or the config watch to reload the config before the next tick
+volatile sig_atomic_t reload_config_received = 0;
+
+// Set when a reloaded config fails validation so the running config is kept
+bool config_reload_rejected = false;
+
+// PWM_FAN_[<n>_]* settings a reload may change; anything else (pins, frequency, fans,
+//    tachometers, telemetry, metrics) needs a restart to re-export
+const char *CONFIG_RELOADABLE_KEYS[] = {
+    "MIN_DUTY_CYCLE", "MAX_DUTY_CYCLE", "FAN_OFF_GRACE_MS", "SLEEP_MS", "SLEEP_MIN_MS", "SLEEP_MAX_MS",
+    "ADAPT_STEP_C", "MIN_OFF_TEMP_C", "MIN_ON_TEMP_C", "MAX_TEMP_C", "CURVE", "CURVE_POINTS",
+    "SMOOTH_FILTER", "SMOOTH_WINDOW", "CONTROL", "PID_TARGET_C", "PID_KP", "PID_KI", "PID_KD",
+    "RPM_KP", "RPM_KI", "PID_MAX_RPM", "EVENT_MAX_SLEEP_MS", "EVENT_MAX_SLEW_C_S", "IDLE_SLEEP_MS",
+    "IDLE_MARGIN_C", "FF_GAIN_C", "FF_TAU_MS", NULL
+};
 
-// True GPIO tachometer GPIO # from /sys/kernel/debug/gpio
-unsigned short gpio_true_tach_num;
+// Globals behind CONFIG_RELOADABLE_KEYS; a reload restarts from their defaults so a dropped
+//    key falls back the same way it would on a restart
+#define CONFIG_RELOADABLE_GLOBALS( X ) \
+    X( MIN_DUTY_CYCLE ) X( MAX_DUTY_CYCLE ) X( FAN_OFF_GRACE_MS ) X( SLEEP_MS ) X( SLEEP_MIN_MS ) \
+    X( SLEEP_MAX_MS ) X( ADAPT_STEP_MC ) X( MIN_OFF_TEMP_MC ) X( MIN_ON_TEMP_MC ) X( MAX_TEMP_MC ) \
+    X( CURVE ) X( CURVE_POINTS ) X( SMOOTH_FILTER ) X( SMOOTH_WINDOW ) X( CONTROL ) \
+    X( PID_TARGET_MC ) X( PID_KP_MILLI ) X( PID_KI_MILLI ) X( PID_KD_MILLI ) X( RPM_KP_MILLI ) \
+    X( RPM_KI_MILLI ) X( PID_MAX_RPM ) X( EVENT_MAX_SLEEP_MS ) X( EVENT_MAX_SLEW_MC_S ) \
+    X( IDLE_SLEEP_MS ) X( IDLE_MARGIN_MC ) X( FF_GAIN_MC ) X( FF_TAU_MS )
 
-// GPIO file descriptors
-FILE *fd_gpio_tach_export     = NULL;
-FILE *fd_gpio_tach_unexport   = NULL;
-FILE *fd_gpio_tach_active_low = NULL;
-FILE *fd_gpio_tach_direction  = NULL;
-FILE *fd_gpio_tach_edge       = NULL;
+#define CONFIG_GLOBAL_FIELD( name ) __typeof__( name ) name;
 
-// GPIO file descriptors - polling
-int fd_gpio_tach_value;
+typedef struct {
+    CONFIG_RELOADABLE_GLOBALS( CONFIG_GLOBAL_FIELD )
+} ConfigGlobals;
 
-// Setup stuct for the GPIO polling file descriptor
-struct pollfd poll_tach_gpio;
+// Reloadable globals before any env or config file was applied
+ConfigGlobals config_defaults;
 
-// Setup a mutex for the RPM monitoring thread
-pthread_mutex_t mutex_tach_rpm = PTHREAD_MUTEX_INITIALIZER;
+// Setup stucts for the GPIO polling file descriptors and the fan each belongs to
+struct pollfd poll_tach_gpio[ MAX_FANS ];
+Fan *poll_tach_fans[ MAX_FANS ];
+int poll_tach_count = 0;
 
 // Setup a thread for polling the GPIO
 pthread_t polling_thread_tach;
@@ -246,7 +918,13 @@ pthread_t polling_thread_tach;
 //
 
 // SIGINT/SIGTERM handler
-void handle_halt( int noop ) { halt_received = 1; }
+void handle_halt( int noop ) { ( void ) noop; halt_received = 1; }
+
+// SIGUSR1 handler
+void handle_dump_stats( int noop ) { ( void ) noop; dump_stats_received = 1; }
+
+// SIGHUP handler
+void handle_reload( int noop ) { ( void ) noop; reload_config_received = 1; }
 
 // Logging function DEBUG|INFO|ERROR constant for level; proxies vprintf and
 //    supports stderr for errors
@@ -285,111 +963,133 @@ void l( int level, char* message_str, ... ) {
     va_end( args );
 }
 
+// Current CLOCK_MONOTONIC time in ns; immune to wall-clock/NTP jumps
+long long monotonic_ns() {
+
+    struct timespec now_ts;
+    clock_gettime( CLOCK_MONOTONIC, &now_ts );
+
+    return now_ts.tv_sec * 1000000000LL + now_ts.tv_nsec;
+}
+
 // Enable/disable GPIO via sysfs
 // - NOTE: Must come before clean_up function due to being used to clean-up GPIO
-void gpio_set_export( bool is_enabled ) {
+void gpio_set_export( Fan *fan, bool is_enabled ) {
 
-    l( INFO, "GPIO %i %s...\n", gpio_true_tach_num, is_enabled ? "exporting" : "un-exporting" );
+    l( INFO, "GPIO %i %s...\n", fan->gpio_true_tach_num, is_enabled ? "exporting" : "un-exporting" );
 
-    fprintf( is_enabled ? fd_gpio_tach_export : fd_gpio_tach_unexport, "%i", gpio_true_tach_num );
-    fflush( is_enabled ? fd_gpio_tach_export : fd_gpio_tach_unexport );
+    fprintf( is_enabled ? fan->fd_gpio_tach_export : fan->fd_gpio_tach_unexport, "%i", fan->gpio_true_tach_num );
+    fflush( is_enabled ? fan->fd_gpio_tach_export : fan->fd_gpio_tach_unexport );
 
-    l( INFO, "GPIO %i %s!\n", gpio_true_tach_num, is_enabled ? "exported" : "un-exported" );
+    l( INFO, "GPIO %i %s!\n", fan->gpio_true_tach_num, is_enabled ? "exported" : "un-exported" );
 }
 
-// Clean-up file descriptors and free the tachometer GPIO if needed
-void clean_up() {
-
-    l( DEBUG, "Freeing file descriptors...\n" );
+// Close a stdio file descriptor if open
+void close_fd( FILE **file_descriptor, const char *name ) {
 
-    // Free PWM control resources:
-    if( fd_pwm_chip_export != NULL ) {
+    if( *file_descriptor != NULL ) {
 
-        l( DEBUG, "Freeing fd_pwm_chip_export...\n" );
-        fclose( fd_pwm_chip_export );
-        fd_pwm_chip_export = NULL;
+        l( DEBUG, "Freeing %s...\n", name );
+        fclose( *file_descriptor );
+        *file_descriptor = NULL;
     }
+}
 
-    if( fd_pwm_chip_unexport != NULL ) {
+// Close a raw file descriptor if open
+void close_raw_fd( int *file_descriptor, const char *name ) {
 
-        l( DEBUG, "Freeing fd_pwm_chip_unexport...\n" );
-        fclose( fd_pwm_chip_unexport );
-        fd_pwm_chip_unexport = NULL;
+    if( *file_descriptor >= 0 ) {
+
+        l( DEBUG, "Freeing %s...\n", name );
+        close( *file_descriptor );
+        *file_descriptor = -1;
     }
+}
 
-    if( fd_pwm_channel_enable != NULL ) {
+// Clean-up a fan's file descriptors and free its tachometer GPIO if needed
+void fan_clean_up( Fan *fan ) {
 
-        l( DEBUG, "Freeing fd_pwm_channel_enable...\n" );
-        fclose( fd_pwm_channel_enable );
-        fd_pwm_channel_enable = NULL;
-    }
+    l( DEBUG, "Freeing fan %i...\n", fan->idx );
+
+    // Free PWM control resources:
+    close_fd( &fan->fd_pwm_chip_export,                   "fd_pwm_chip_export" );
+    close_fd( &fan->fd_pwm_chip_unexport,                 "fd_pwm_chip_unexport" );
+    close_fd( &fan->fd_pwm_channel_enable,                "fd_pwm_channel_enable" );
+    close_raw_fd( &fan->fd_pwm_channel_set_duty_cycle,    "fd_pwm_channel_set_duty_cycle" );
+    close_fd( &fan->fd_pwm_channel_set_duty_cycle_period, "fd_pwm_channel_set_duty_cycle_period" );
 
-    if( fd_pwm_channel_set_duty_cycle != NULL ) {
+    if( fan->ctl.curve_table != NULL ) {
 
-        l( DEBUG, "Freeing fd_pwm_channel_set_duty_cycle...\n" );
-        fclose( fd_pwm_channel_set_duty_cycle );
-        fd_pwm_channel_set_duty_cycle = NULL;
+        l( DEBUG, "Freeing curve_table...\n" );
+        curve_free( &fan->ctl );
     }
 
-    if( fd_pwm_channel_set_duty_cycle_period != NULL ) {
+    // Free tachometer resources:
+    if( fan->fd_gpio_tach_unexport != NULL ) {
 
-        l( DEBUG, "Freeing fd_pwm_channel_set_duty_cycle_period...\n" );
-        fclose( fd_pwm_channel_set_duty_cycle_period );
-        fd_pwm_channel_set_duty_cycle_period = NULL;
+        gpio_set_export( fan, false );
     }
 
-    if( fd_cpu_temp != NULL ) {
+    close_fd( &fan->fd_gpio_tach_unexport,   "fd_gpio_tach_unexport" );
+    close_fd( &fan->fd_gpio_tach_export,     "fd_gpio_tach_export" );
+    close_fd( &fan->fd_gpio_tach_active_low, "fd_gpio_tach_active_low" );
+    close_fd( &fan->fd_gpio_tach_direction,  "fd_gpio_tach_direction" );
+    close_fd( &fan->fd_gpio_tach_edge,       "fd_gpio_tach_edge" );
+    close_raw_fd( &fan->fd_gpio_tach_value,  "fd_gpio_tach_value" );
+    close_raw_fd( &fan->fd_gpio_tach_line,   "fd_gpio_tach_line" );
+}
 
-        l( DEBUG, "Freeing fd_cpu_temp...\n" );
-        fclose( fd_cpu_temp );
-        fd_cpu_temp = NULL;
-    }
+// Clean-up file descriptors and free the tachometer GPIOs if needed
+void clean_up() {
 
-    // Free tachometer resources:
-    if( fd_gpio_tach_unexport != NULL ) {
+    l( DEBUG, "Freeing file descriptors...\n" );
 
-        gpio_set_export( false );
+    for( int i = 0; i < fan_count; i++ ) {
 
-        l( DEBUG, "Freeing fd_gpio_tach_unexport...\n" );
-        fclose( fd_gpio_tach_unexport );
-        fd_gpio_tach_unexport = NULL;
+        fan_clean_up( &fans[i] );
     }
 
-    if( fd_gpio_tach_export != NULL ) {
+    close_raw_fd( &fd_cpu_temp, "fd_cpu_temp" );
+
+    if( cpu_temp_smooth.ring != NULL ) {
 
-        l( DEBUG, "Freeing fd_gpio_tach_export...\n" );
-        fclose( fd_gpio_tach_export );
-        fd_gpio_tach_export = NULL;
+        l( DEBUG, "Freeing cpu_temp_smooth...\n" );
+        smooth_free( &cpu_temp_smooth );
     }
 
-    if( fd_gpio_tach_active_low != NULL ) {
+    close_raw_fd( &fd_metrics_tcp, "fd_metrics_tcp" );
 
-        l( DEBUG, "Freeing fd_gpio_tach_active_low...\n" );
-        fclose( fd_gpio_tach_active_low );
-        fd_gpio_tach_active_low = NULL;
+    if( fd_metrics_unix >= 0 ) {
+
+        close_raw_fd( &fd_metrics_unix, "fd_metrics_unix" );
+        unlink( METRICS_SOCKET );
     }
 
-    if( fd_gpio_tach_direction != NULL ) {
+    close_raw_fd( &fd_peer_publish, "fd_peer_publish" );
 
-        l( DEBUG, "Freeing fd_gpio_tach_direction...\n" );
-        fclose( fd_gpio_tach_direction );
-        fd_gpio_tach_direction = NULL;
-    }
+    if( fd_peer_listen >= 0 ) {
 
-    if( fd_gpio_tach_edge != NULL ) {
+        close_raw_fd( &fd_peer_listen, "fd_peer_listen" );
 
-        l( DEBUG, "Freeing fd_gpio_tach_edge...\n" );
-        fclose( fd_gpio_tach_edge );
-        fd_gpio_tach_edge = NULL;
+        if( strncmp( PEER_LISTEN, "unix:", 5 ) == 0 ) { unlink( PEER_LISTEN + 5 ); }
     }
 
-    if( fd_gpio_tach_value > 0 ) {
+    if( fd_telemetry > STDERR_FILENO ) {
 
-        l( DEBUG, "Freeing fd_gpio_tach_value...\n" );
-        close( fd_gpio_tach_value );
-        fd_gpio_tach_value = -1;
+        close_raw_fd( &fd_telemetry, "fd_telemetry" );
     }
 
+    close_raw_fd( &fd_telemetry_wake, "fd_telemetry_wake" );
+
+    close_raw_fd( &fd_tick_timer,     "fd_tick_timer" );
+    close_raw_fd( &fd_thermal_events, "fd_thermal_events" );
+    close_raw_fd( &fd_config_watch,   "fd_config_watch" );
+    close_raw_fd( &fd_psi_trigger,    "fd_psi_trigger" );
+    close_raw_fd( &feedforward.fd_proc_stat,   "fd_proc_stat" );
+    close_raw_fd( &feedforward.fd_cpufreq_cur, "fd_cpufreq_cur" );
+    close_raw_fd( &fd_signal,         "fd_signal" );
+    close_raw_fd( &fd_reactor,        "fd_reactor" );
+
     l( DEBUG, "File descriptors freed!\n" );
 }
 
@@ -408,35 +1108,109 @@ void clean_up_and_exit( int exit_code ) {
     exit( 0 );
 }
 
-// Simple wait for file function for waiting for interfaces after they are exported
+// Reject an invalid config value; fatal at startup, while a reload is rejected as a whole and
+//    the running config is kept
+void config_invalid() {
+
+    if( ! is_setup ) {
+
+        clean_up_and_exit( 1 );
+    }
+
+    config_reload_rejected = true;
+}
+
+// Watch the nearest existing directory above a path for entries appearing; -1 on failure
+int inotify_watch_nearest_dir( const char *filepath ) {
+
+    char dir[ SYSFS_PATH_MAX ];
+    int fd_watch = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+
+    if( fd_watch < 0 ) { return -1; }
+
+    snprintf( dir, sizeof( dir ), "%s", filepath );
+
+    for( char *slash = strrchr( dir, '/' ); slash != NULL && slash != dir; slash = strrchr( dir, '/' ) ) {
+
+        *slash = '\0';
+
+        if( inotify_add_watch( fd_watch, dir, IN_CREATE | IN_MOVED_TO | IN_ATTRIB ) >= 0 ) { return fd_watch; }
+
+        if( errno != ENOENT ) { break; }
+    }
+
+    close( fd_watch );
+
+    return -1;
+}
+
+// Wait for interfaces after they are exported; returns as soon as the file exists
+// - Sleeps on inotify for the file's directory so a node that shows up wakes the wait
+//   immediately, re-checking every WAIT_FOR_FILE_RECHECK_MS for nodes sysfs doesn't report
 void wait_for_file_with_timeout( const char *filepath, int timeout_seconds ) {
 
     l( DEBUG, "Waiting for %s to exist...\n", filepath );
 
-    // 50 ms
-    const useconds_t interval = 50000;
+    long long deadline_ns = monotonic_ns() + timeout_seconds * 1000000000LL;
+    int fd_watch = -1;
 
-    // Convert timeout to microseconds and divide by interval
-    int max_attempts = ( timeout_seconds * 500000 ) / interval;
+    while( access( filepath, F_OK ) == -1 ) {
 
-    for( int attempts = 0; attempts < max_attempts; attempts++ ) {
+        if( errno != ENOENT ) {
 
-        if( access( filepath, F_OK ) != -1 ) {
+            l( ERROR, "Error checking for %s exists!\n", filepath );
+            close_raw_fd( &fd_watch, "fd_watch" );
+            clean_up_and_exit( 1 );
+        }
 
-            l( DEBUG, "File %s exists! Continuing...\n", filepath );
-            return;
+        long long remaining_ms = ( deadline_ns - monotonic_ns() ) / 1000000;
 
-        } else if( errno != ENOENT ) {
+        if( remaining_ms <= 0 ) {
 
-            l( ERROR, "Error checking for %s exists!\n", filepath );
+            l( ERROR, "Timeout exceeded waiting for %s to exist!\n", filepath );
+            close_raw_fd( &fd_watch, "fd_watch" );
             clean_up_and_exit( 1 );
         }
 
-        usleep( interval );
+        if( fd_watch < 0 ) { fd_watch = inotify_watch_nearest_dir( filepath ); }
+
+        // A failed watch leaves a negative fd, which poll ignores, so this degrades to a sleep
+        struct pollfd poll_watch = { fd_watch, POLLIN, 0 };
+
+        if( poll( &poll_watch, 1, remaining_ms < WAIT_FOR_FILE_RECHECK_MS ? remaining_ms : WAIT_FOR_FILE_RECHECK_MS ) > 0 ) {
+
+            char buffer[1024] __attribute__(( aligned( __alignof__( struct inotify_event ) ) ));
+            while( read( fd_watch, buffer, sizeof( buffer ) ) > 0 );
+        }
     }
 
-    l( ERROR, "Timeout exceeded waiting for %s to exist!\n", filepath );
-    clean_up_and_exit( 1 );
+    close_raw_fd( &fd_watch, "fd_watch" );
+
+    l( DEBUG, "File %s exists! Continuing...\n", filepath );
+}
+
+// Read a sysfs attribute as a long; false if missing, unparseable or not a regular file
+// - Non-blocking and regular files only so a fake backend's FIFO nodes are never consumed
+bool sysfs_read_long( const char *path_str, long *value ) {
+
+    char buffer[32];
+    struct stat file_stat;
+    int fd = open( path_str, O_RDONLY | O_NONBLOCK );
+
+    if( fd < 0 ) { return false; }
+
+    ssize_t len = fstat( fd, &file_stat ) == 0 && S_ISREG( file_stat.st_mode ) ? read( fd, buffer, sizeof( buffer ) - 1 ) : -1;
+
+    close( fd );
+
+    if( len <= 0 ) { return false; }
+
+    buffer[ len ] = '\0';
+
+    char *end;
+    *value = strtol( buffer, &end, 10 );
+
+    return end != buffer;
 }
 
 // Open a file descriptor at path with specific mode and die on failure
@@ -455,15 +1229,32 @@ void open_fd( char* path_str, FILE **file_descriptor, char* mode ) {
     l( DEBUG, "\"%s\" opened!...\n", path_str );
 }
 
-// Get the Raspberry Pi model so we can get the correct PWM/GPIO mappings
+// Format a path under SYSFS_ROOT into a SYSFS_PATH_MAX sized buffer
+void sysfs_path( char *path_str, const char *format, ... ) {
+
+    char rel_path_str[ SYSFS_PATH_MAX ];
+
+    va_list args;
+
+    va_start( args, format );
+    vsnprintf( rel_path_str, sizeof( rel_path_str ), format, args );
+    va_end( args );
+
+    if( snprintf( path_str, SYSFS_PATH_MAX, "%s%s", SYSFS_ROOT, rel_path_str ) >= SYSFS_PATH_MAX ) {
+
+        l( ERROR, "sysfs path exceeds %i characters: %s%s\n", SYSFS_PATH_MAX, SYSFS_ROOT, rel_path_str );
+        clean_up_and_exit( 1 );
+    }
+}
+
+// Get the Raspberry Pi model for the fallback PWM/GPIO mappings; -1 when unknown
+// - CM and keyboard variants share their base model's mappings
 void get_raspberry_pi_model( void ) {
 
-    const char *devicetree_model_path = "/sys/firmware/devicetree/base/model";
+    char devicetree_model_path[ SYSFS_PATH_MAX ];
     FILE *fd_devicetree_model;
 
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t read;
+    sysfs_path( devicetree_model_path, "/firmware/devicetree/base/model" );
 
     l( INFO, "Getting Raspberry Pi model...\n" );
 
@@ -472,485 +1263,4591 @@ void get_raspberry_pi_model( void ) {
     if( fd_devicetree_model == NULL ) {
 
         l( ERROR, "Unable to open %s!\n", devicetree_model_path );
-        clean_up_and_exit( 1 );
+        return;
     }
 
-    // Read the contents of the file
-    if( ( read = getline( &line, &len, fd_devicetree_model ) ) != -1 ) {
-
-        if( strstr( line, "Raspberry Pi 3 Model B" ) ) {
-
-            rpi_model = 3;
-
-        } else if ( strstr( line, "Raspberry Pi 4 Model B" ) ) {
+    // Devicetree strings are NUL terminated rather than newline terminated
+    size_t len = fread( rpi_model_str, 1, sizeof( rpi_model_str ) - 1, fd_devicetree_model );
+    rpi_model_str[ len ] = '\0';
+    rpi_model_str[ strcspn( rpi_model_str, "\n" ) ] = '\0';
 
-            rpi_model = 4;
+    fclose( fd_devicetree_model );
 
-        } else if ( strstr( line, "Raspberry Pi 5 Model B" ) ) {
+    if( strstr( rpi_model_str, "Raspberry Pi 5" ) || strstr( rpi_model_str, "Compute Module 5" ) ) {
 
-            rpi_model = 5;
-        }
-    }
+        rpi_model = RPI_MODEL_5;
 
-    fclose( fd_devicetree_model );
+    } else if( strstr( rpi_model_str, "Raspberry Pi 4" ) || strstr( rpi_model_str, "Compute Module 4" ) ) {
 
-    if( line ) { free( line ); }
+        rpi_model = RPI_MODEL_4;
 
-    if( rpi_model < 3 ) {
+    } else if( strstr( rpi_model_str, "Raspberry Pi 3" ) || strstr( rpi_model_str, "Compute Module 3" ) ) {
 
-        l( ERROR, "Invalid Raspberry Pi model! [get_raspberry_pi_model]\n" );
-        clean_up_and_exit( 1 );
+        rpi_model = RPI_MODEL_3;
     }
 
-    l( INFO, "Raspberry Pi model is %i!\n", rpi_model );
+    l( INFO, "Raspberry Pi model is \"%s\" (%i)!\n", rpi_model_str, rpi_model );
 }
 
-// Get the GPIO or GPIO PWM sysfs interface #
-unsigned short get_gpio_sysfs_num( int lookup_type, int lookup_idx ) {
-
-    // Adjust index to start at Raspberry Pi model 3
-    int adj_model_idx = rpi_model - 3;
+// Read a sysfs/devicetree file into a buffer, NUL terminated; returns the # of bytes or -1
+ssize_t sysfs_read_str( const char *path_str, char *buffer, size_t buffer_size ) {
 
-    if( adj_model_idx < 0 || adj_model_idx > ( sizeof( MODEL_SYSFS_MAP ) - 1 ) ) {
+    int fd = open( path_str, O_RDONLY | O_NONBLOCK );
 
-        l( ERROR, "Invalid Raspberry Pi model! [get_gpio_pin]\n" );
-        clean_up_and_exit( 1 );
-    }
+    if( fd < 0 ) { return -1; }
 
-    ModelMapping cur_model = MODEL_SYSFS_MAP[ adj_model_idx ];
+    ssize_t len = read( fd, buffer, buffer_size - 1 );
 
-    // PWM chip # lookup is singular per-model
-    if( lookup_type == LOOKUP_PWM_CHIP ) { return cur_model.pwm_chip_num; }
+    close( fd );
 
-    // PWM channels or GPIO mappings require iterating over their respective # of member mappings
-    int loop_boundary;
+    if( len < 0 ) { return -1; }
 
-    if( lookup_type == LOOKUP_GPIO_PWM_CHANNEL ) {
+    buffer[ len ] = '\0';
 
-        loop_boundary = MAX_GPIO_PWM;
+    return len;
+}
 
-    } else {
+// Find the PWM controller by walking pwmchips and matching their devicetree compatible
+bool topology_discover_pwm() {
 
-        loop_boundary = MAX_GPIO;
-    }
+    char class_path_str[ SYSFS_PATH_MAX ];
+    sysfs_path( class_path_str, "/class/pwm" );
 
-    // Iterate over GPIO to sysfs interface mappings
-    for( int i = 0; i < loop_boundary; i++ ) {
+    DIR *dir = opendir( class_path_str );
 
-        PinMapping cur_mapping = ( lookup_type == LOOKUP_GPIO_PWM_CHANNEL ) ?
-            cur_model.gpio_pwm_map[ i ] :
-            cur_model.gpio_map[ i ];
+    if( dir == NULL ) { return false; }
 
-        // If the current mapping matches then return the sysfs number for that interface
-        if( cur_mapping.gpio_num == lookup_idx ) { return cur_mapping.sysfs_num; }
-    }
+    struct dirent *entry;
+    bool is_found = false;
 
-    // Should have returned by now - executing here is explicit error
-    l( ERROR, "Could not find GPIO mapping for lookup type %i and lookup idx %i!\n", lookup_type, lookup_idx );
-    clean_up_and_exit( 1 );
+    while( ! is_found && ( entry = readdir( dir ) ) != NULL ) {
 
-    return -1;
-}
+        int chip_num;
+        char path_str[ SYSFS_PATH_MAX ];
+        char compatible[ TOPOLOGY_LINE_MAX ];
+        char device_str[ SYSFS_PATH_MAX ];
 
-// Get the fan mode string from the integer representation
-const char* get_fan_mode_str( int fan_mode_int ) {
+        if( sscanf( entry->d_name, "pwmchip%i", &chip_num ) != 1 ) { continue; }
 
-    static const char* lookup[] = {
-        "BELOW_OFF",
-        "BELOW_MIN",
-        "ABOVE_EAS",
-        "ABOVE_MAX"
-    };
+        sysfs_path( path_str, "/class/pwm/pwmchip%i/device/of_node/compatible", chip_num );
+        ssize_t compatible_len = sysfs_read_str( path_str, compatible, sizeof( compatible ) );
 
-    return lookup[ fan_mode_int ];
-}
+        sysfs_path( path_str, "/class/pwm/pwmchip%i/device", chip_num );
+        ssize_t device_len = readlink( path_str, device_str, sizeof( device_str ) - 1 );
+        device_str[ device_len > 0 ? device_len : 0 ] = '\0';
 
-// Enable/disable the PWM chip control via sysfs
-void pwm_set_chip_export_channel( bool is_enabled ) {
+        // Compatible is a NUL separated list, most specific first
+        for( ssize_t pos = 0; ! is_found && pos < compatible_len; pos += strlen( compatible + pos ) + 1 ) {
 
-    l( DEBUG, "PWM channel %s...\n", is_enabled ? "exporting" : "un-exporting" );
+            for( size_t i = 0; i < sizeof( PWM_CONTROLLERS ) / sizeof( PWM_CONTROLLERS[0] ); i++ ) {
 
-    fprintf( is_enabled ? fd_pwm_chip_export : fd_pwm_chip_unexport, "%i", pwm_channel_num );
-    fflush( is_enabled ? fd_pwm_chip_export : fd_pwm_chip_unexport );
+                PwmController *controller = &PWM_CONTROLLERS[i];
+                size_t suffix_len = controller->device_suffix ? strlen( controller->device_suffix ) : 0;
 
-    l( DEBUG, "PWM channel %s!\n", is_enabled ? "exported" : "un-exported" );
-}
+                if( strcmp( compatible + pos, controller->compatible ) != 0 ) { continue; }
 
-// Set the duty-cycle to scaled value
-void pwm_set_duty_cycle( unsigned int duty_cycle ) {
+                if( suffix_len > 0 && ( strlen( device_str ) < suffix_len || strcmp( device_str + strlen( device_str ) - suffix_len, controller->device_suffix ) != 0 ) ) { continue; }
 
-    if( duty_cycle > MAX_DUTY_CYCLE ) {
+                topology.pwm_chip_num = chip_num;
+                memcpy( topology.gpio_pwm_map, controller->gpio_pwm_map, sizeof( topology.gpio_pwm_map ) );
 
-        l( ERROR, "ERROR: Duty cycle exceeds maximum allowed value!\n" );
-        return;
+                l( INFO, "Found PWM controller %s at pwmchip%i!\n", controller->compatible, chip_num );
+                is_found = true;
+                break;
+            }
+        }
     }
 
-    float duty_cycle_ns = ( ( float ) duty_cycle / MAX_DUTY_CYCLE ) * pwm_duty_cycle_period_ns;
+    closedir( dir );
 
-    if( duty_cycle_ns < DUTY_CYCLE_NS_OOB_LOW || duty_cycle_ns > DUTY_CYCLE_NS_OOB_HIGH ) {
+    return is_found;
+}
 
-        l( ERROR, "ERROR: Duty cycle exceeds OOB range!\n" );
-        return;
-    }
+// Find the SoC GPIO controller's sysfs GPIO base by walking gpiochips and matching labels
+bool topology_discover_gpio() {
 
-    fprintf( fd_pwm_channel_set_duty_cycle, "%.0f", duty_cycle_ns );
-    fflush( fd_pwm_channel_set_duty_cycle );
-}
+    char class_path_str[ SYSFS_PATH_MAX ];
+    sysfs_path( class_path_str, "/class/gpio" );
 
-// Set the duty cycle to max, but ensure value chages so sysfs picks up change
-void pwm_set_max_duty_cycle() {
+    DIR *dir = opendir( class_path_str );
 
-    // Ensure if alreayd MAX_DUTY_CYCLE that atomic update is seen by sysfs
-    pwm_set_duty_cycle( MAX_DUTY_CYCLE - 1 );
-    pwm_set_duty_cycle( MAX_DUTY_CYCLE );
-}
+    if( dir == NULL ) { return false; }
 
-// Setup the PWM controller for fan control
-void pwm_setup() {
+    struct dirent *entry;
+    bool is_found = false;
 
-    // Get PWM chip and channel numbers
-    pwm_chip_num = get_gpio_sysfs_num( LOOKUP_PWM_CHIP, -1 );
-    pwm_channel_num = get_gpio_sysfs_num( LOOKUP_GPIO_PWM_CHANNEL, BCM_GPIO_PIN_PWM );
+    while( ! is_found && ( entry = readdir( dir ) ) != NULL ) {
 
-    // Format to paths for /sys/class control
-    char pwm_chip_path_str[32];
-    char pwm_channel_path_str[48];
+        int chip_num;
+        long base;
+        char path_str[ SYSFS_PATH_MAX ];
+        char label[ TOPOLOGY_LINE_MAX ];
 
-    snprintf( pwm_chip_path_str, sizeof( pwm_chip_path_str ), "/sys/class/pwm/pwmchip%i/", pwm_chip_num );
-    snprintf( pwm_channel_path_str, sizeof( pwm_channel_path_str ), "%spwm%i/", pwm_chip_path_str, pwm_channel_num );
+        if( sscanf( entry->d_name, "gpiochip%i", &chip_num ) != 1 ) { continue; }
 
-    char chip_unexport_str[64];
-    snprintf( chip_unexport_str, sizeof( chip_unexport_str ), "%sunexport", pwm_chip_path_str );
-    open_fd( chip_unexport_str, &fd_pwm_chip_unexport, "w" );
+        sysfs_path( path_str, "/class/gpio/gpiochip%i/label", chip_num );
 
-    // Ensure unloaded before we start
-    pwm_set_chip_export_channel( false );
+        if( sysfs_read_str( path_str, label, sizeof( label ) ) <= 0 ) { continue; }
 
-    // Setup file descriptors/handles for /sys/class control points
-    char chip_export_str[64];
-    snprintf( chip_export_str, sizeof( chip_export_str ), "%sexport", pwm_chip_path_str );
-    open_fd( chip_export_str, &fd_pwm_chip_export, "w" );
+        label[ strcspn( label, "\n" ) ] = '\0';
 
-    // Setup the chip export channel
-    pwm_set_chip_export_channel( true );
+        sysfs_path( path_str, "/class/gpio/gpiochip%i/base", chip_num );
 
-    char channel_enable_path_str[64];
-    snprintf( channel_enable_path_str, sizeof( channel_enable_path_str ), "%senable", pwm_channel_path_str );
+        for( size_t i = 0; i < sizeof( SOC_GPIO_LABELS ) / sizeof( SOC_GPIO_LABELS[0] ); i++ ) {
 
-    // Wait for PWM channel enable to become available before opening it
-    wait_for_file_with_timeout( channel_enable_path_str, 5 );
+            if( strcmp( label, SOC_GPIO_LABELS[i] ) == 0 && sysfs_read_long( path_str, &base ) ) {
 
-    open_fd( channel_enable_path_str, &fd_pwm_channel_enable, "w" );
+                topology.gpio_base = base;
 
-    char channel_set_duty_cycle_path_str[64];
-    snprintf( channel_set_duty_cycle_path_str, sizeof( channel_set_duty_cycle_path_str ), "%sduty_cycle", pwm_channel_path_str );
-    open_fd( channel_set_duty_cycle_path_str, &fd_pwm_channel_set_duty_cycle, "w" );
+                l( INFO, "Found SoC GPIO controller %s at gpiochip%i with base %li!\n", label, chip_num, base );
+                is_found = true;
+                break;
+            }
+        }
+    }
 
-    char channel_set_duty_cycle_period_path_str[64];
-    snprintf( channel_set_duty_cycle_period_path_str, sizeof( channel_set_duty_cycle_period_path_str ), "%speriod", pwm_channel_path_str );
-    open_fd( channel_set_duty_cycle_period_path_str, &fd_pwm_channel_set_duty_cycle_period, "w" );
+    closedir( dir );
 
-    // Setup PWM duty cycle period
-    pwm_duty_cycle_period_ns = ( 1000000000 / PWM_FREQ_HZ );
+    return is_found;
+}
 
-    l( DEBUG, "Setting duty cycle period to %u...\n", pwm_duty_cycle_period_ns );
+// Fill unresolved topology parts from the model map
+void topology_from_model() {
 
-    fprintf( fd_pwm_channel_set_duty_cycle_period, "%u", pwm_duty_cycle_period_ns );
-    fflush( fd_pwm_channel_set_duty_cycle_period );
+    // Adjust index to start at Raspberry Pi model 3
+    int adj_model_idx = rpi_model - RPI_MODEL_3;
 
-    l( DEBUG, "Duty cycle period set to %u!\n", pwm_duty_cycle_period_ns );
+    if( adj_model_idx < 0 || adj_model_idx >= ( int ) ( sizeof( MODEL_SYSFS_MAP ) / sizeof( MODEL_SYSFS_MAP[0] ) ) ) { return; }
 
-    // Set the channel to enabled
-    l( DEBUG, "PWM channel enabling...\n" );
+    ModelMapping *cur_model = &MODEL_SYSFS_MAP[ adj_model_idx ];
 
-    fprintf( fd_pwm_channel_enable, "1" );
-    fflush( fd_pwm_channel_enable );
+    if( topology.pwm_chip_num < 0 ) {
 
-    l( DEBUG, "PWM channel enabled!\n" );
+        l( INFO, "Using the Raspberry Pi %i PWM mapping!\n", rpi_model );
 
-    // Set the last time we were above minimum off temp to now
-    gettimeofday( &last_above_min_epoch, NULL );
+        topology.pwm_chip_num = cur_model->pwm_chip_num;
+        memcpy( topology.gpio_pwm_map, cur_model->gpio_pwm_map, sizeof( topology.gpio_pwm_map ) );
+    }
 
-    l( DEBUG, "\nRuntime:\n" );
-    l( DEBUG, " - BCM_GPIO_PIN_PWM         = %i\n",  BCM_GPIO_PIN_PWM );
-    l( DEBUG, " - pwm_chip_num             = %i\n",  pwm_chip_num );
-    l( DEBUG, " - pwm_channel_num          = %i\n",  pwm_channel_num );
-    l( DEBUG, " - pwm_chip_path_str        = %s\n",  pwm_chip_path_str );
-    l( DEBUG, " - pwm_channel_path_str     = %s\n",  pwm_channel_path_str );
-    l( DEBUG, " - pwm_duty_cycle_period_ns = %i\n",  pwm_duty_cycle_period_ns );
-    l( DEBUG, " - MAX_DUTY_CYCLE           = %i\n",  MAX_DUTY_CYCLE );
-    l( DEBUG, " - last_above_min_epoch     = %li\n", last_above_min_epoch.tv_sec );
-    l( DEBUG, "\n" );
+    if( topology.gpio_base < 0 ) {
 
-    // CPU temp setup
-    // `/sys/class/thermal/thermal_zone0/temp` on Raspberry Pi contains current temp
-    //    in Celsius * 1000
-    open_fd( "/sys/class/thermal/thermal_zone0/temp", &fd_cpu_temp, "r" );
+        l( INFO, "Using the Raspberry Pi %i GPIO mapping!\n", rpi_model );
 
-    is_setup = true;
+        topology.gpio_base = cur_model->gpio_map[0].sysfs_num - cur_model->gpio_map[0].gpio_num;
+    }
 }
 
-// Get CPU temp as float
-float get_cpu_temp_c() {
+// Load the cached topology if it was saved for this model, kernel and sysfs root
+bool topology_cache_load( const char *kernel_str ) {
 
-    // Value in "temp" file is degrees in C * 1000
-    float cpu_temp_raw;
+    FILE *fd_cache = fopen( TOPOLOGY_CACHE, "r" );
 
-    // Read the temp into the `cpu_temp_raw` variable by reference
-    fflush( fd_cpu_temp );
-    rewind( fd_cpu_temp );
-    fscanf( fd_cpu_temp, "%f", &cpu_temp_raw );
+    if( fd_cache == NULL ) { return false; }
 
-    // Check if within reasonable range temps and return -1 to denote issue
-    if( cpu_temp_raw <= CPU_TEMP_OOB_LOW || cpu_temp_raw >= CPU_TEMP_OOB_HIGH ) {
+    char line[ TOPOLOGY_LINE_MAX ];
+    int matched_keys = 0;
+    Topology cached = { -1, { { -1, -1 } }, -1 };
 
-        return -1;
-    }
+    while( fgets( line, sizeof( line ), fd_cache ) != NULL ) {
 
-    // Convert to correct Celsius temp double
-    float cpu_temp_c = cpu_temp_raw / 1000;
+        line[ strcspn( line, "\n" ) ] = '\0';
 
-    // Shift the existing elements to the right
-    for( int i = CPU_TEMP_SMOOTH_ARR_SIZE - 1; i > 0; i-- ) {
+        char *value = strchr( line, '=' );
 
-        cpu_temp_smooth_arr[ i ] = cpu_temp_smooth_arr[ i - 1 ];
-    }
+        if( value == NULL ) { continue; }
 
-    // Set the value
-    cpu_temp_smooth_arr[0] = cpu_temp_c;
+        *value++ = '\0';
 
-    return cpu_temp_c;
-}
+        if( strcmp( line, "model" ) == 0 )           { matched_keys += strcmp( value, rpi_model_str ) == 0; }
+        else if( strcmp( line, "kernel" ) == 0 )     { matched_keys += strcmp( value, kernel_str ) == 0; }
+        else if( strcmp( line, "sysfs_root" ) == 0 ) { matched_keys += strcmp( value, SYSFS_ROOT ) == 0; }
+        else if( strcmp( line, "pwm_chip" ) == 0 )   { cached.pwm_chip_num = atoi( value ); }
+        else if( strcmp( line, "gpio_base" ) == 0 )  { cached.gpio_base = atoi( value ); }
+        else if( strcmp( line, "pwm_map" ) == 0 ) {
 
-// Get CPU temp average
-float get_cpu_temp_avg_c() {
+            int chars_read;
 
-    float sum = 0.0;
+            for( int i = 0; i < MAX_GPIO_PWM && sscanf( value, "%i:%i%n", &cached.gpio_pwm_map[i].gpio_num, &cached.gpio_pwm_map[i].sysfs_num, &chars_read ) == 2; i++ ) {
 
-    for( int i = 0; i < CPU_TEMP_SMOOTH_ARR_SIZE; i++ ) {
+                value += chars_read;
 
-        sum += cpu_temp_smooth_arr[ i ];
+                if( *value == ',' ) { value++; }
+            }
+        }
+    }
+
+    fclose( fd_cache );
+
+    // The cached chip must still exist; a stale cache falls back to a scan
+    char chip_path_str[ SYSFS_PATH_MAX ];
+    sysfs_path( chip_path_str, "/class/pwm/pwmchip%i", cached.pwm_chip_num );
+
+    if( matched_keys != 3 || cached.pwm_chip_num < 0 || access( chip_path_str, F_OK ) != 0 ) { return false; }
+
+    topology = cached;
+
+    return true;
+}
+
+// Save the topology for later starts; written to a temp file and renamed so a crash never
+//    leaves a partial cache
+void topology_cache_save( const char *kernel_str ) {
+
+    char tmp_path_str[ TOPOLOGY_LINE_MAX ];
+    snprintf( tmp_path_str, sizeof( tmp_path_str ), "%s.tmp", TOPOLOGY_CACHE );
+
+    FILE *fd_cache = fopen( tmp_path_str, "w" );
+
+    if( fd_cache == NULL ) {
+
+        l( DEBUG, "Unable to write topology cache %s: %s\n", tmp_path_str, strerror( errno ) );
+        return;
+    }
+
+    fprintf( fd_cache, "model=%s\nkernel=%s\nsysfs_root=%s\npwm_chip=%i\npwm_map=", rpi_model_str, kernel_str, SYSFS_ROOT, topology.pwm_chip_num );
+
+    for( int i = 0; i < MAX_GPIO_PWM; i++ ) {
+
+        fprintf( fd_cache, "%s%i:%i", i > 0 ? "," : "", topology.gpio_pwm_map[i].gpio_num, topology.gpio_pwm_map[i].sysfs_num );
+    }
+
+    fprintf( fd_cache, "\ngpio_base=%i\n", topology.gpio_base );
+
+    if( fclose( fd_cache ) != 0 || rename( tmp_path_str, TOPOLOGY_CACHE ) != 0 ) {
+
+        l( DEBUG, "Unable to write topology cache %s: %s\n", TOPOLOGY_CACHE, strerror( errno ) );
+        unlink( tmp_path_str );
+        return;
+    }
+
+    l( DEBUG, "Saved topology cache %s\n", TOPOLOGY_CACHE );
+}
+
+// Resolve the PWM chip, channel map and GPIO base; from the cache when it matches this
+//    model and kernel, otherwise by walking sysfs/devicetree with the model map as fallback
+void topology_setup() {
+
+    struct utsname uname_info;
+    const char *kernel_str = uname( &uname_info ) == 0 ? uname_info.release : "";
+    bool is_cache_enabled = TOPOLOGY_CACHE[0] != '\0';
+
+    get_raspberry_pi_model();
+
+    if( is_cache_enabled && topology_cache_load( kernel_str ) ) {
+
+        l( INFO, "Using cached hardware topology from %s\n", TOPOLOGY_CACHE );
+
+    } else {
+
+        l( INFO, "Discovering hardware topology...\n" );
+
+        if( ! topology_discover_pwm() )  { l( INFO, "No known PWM controller found in sysfs!\n" ); }
+        if( ! topology_discover_gpio() ) { l( INFO, "No SoC GPIO controller found in sysfs!\n" ); }
+
+        topology_from_model();
+
+        // Only a complete topology is worth caching
+        if( is_cache_enabled && topology.pwm_chip_num >= 0 && topology.gpio_base >= 0 ) {
+
+            topology_cache_save( kernel_str );
+        }
+    }
+
+    l( DEBUG, "\nTopology:\n" );
+    l( DEBUG, " - pwm_chip_num = %i\n", topology.pwm_chip_num );
+    l( DEBUG, " - gpio_base    = %i\n", topology.gpio_base );
+}
+
+// Get the GPIO or GPIO PWM sysfs interface #
+unsigned short get_gpio_sysfs_num( int lookup_type, int lookup_idx ) {
+
+    if( lookup_type == LOOKUP_PWM_CHIP || lookup_type == LOOKUP_GPIO_PWM_CHANNEL ) {
+
+        if( topology.pwm_chip_num < 0 ) {
+
+            l( ERROR, "Unable to find the PWM controller; is the PWM dtoverlay loaded on a supported Raspberry Pi?\n" );
+            clean_up_and_exit( 1 );
+        }
+
+        // PWM chip # lookup is singular
+        if( lookup_type == LOOKUP_PWM_CHIP ) { return topology.pwm_chip_num; }
+
+        for( int i = 0; i < MAX_GPIO_PWM; i++ ) {
+
+            if( topology.gpio_pwm_map[i].gpio_num == lookup_idx ) { return topology.gpio_pwm_map[i].sysfs_num; }
+        }
+
+    } else {
+
+        if( topology.gpio_base < 0 ) {
+
+            l( ERROR, "Unable to find the SoC GPIO controller in sysfs on a supported Raspberry Pi!\n" );
+            clean_up_and_exit( 1 );
+        }
+
+        if( lookup_idx >= 0 && lookup_idx <= MAX_BCM_GPIO_NUM ) { return topology.gpio_base + lookup_idx; }
+    }
+
+    // Should have returned by now - executing here is explicit error
+    l( ERROR, "Could not find GPIO mapping for lookup type %i and lookup idx %i!\n", lookup_type, lookup_idx );
+    clean_up_and_exit( 1 );
+
+    return -1;
+}
+
+// Get the fan mode string from the integer representation
+const char* get_fan_mode_str( int fan_mode_int ) {
+
+    static const char* lookup[] = {
+        "BELOW_OFF",
+        "BELOW_MIN",
+        "ABOVE_EAS",
+        "ABOVE_MAX",
+        "PID"
+    };
+
+    return lookup[ fan_mode_int ];
+}
+
+const char* get_fan_health_str( int fan_health_int ) {
+
+    static const char* lookup[] = {
+        "OK",
+        "DEGRADED",
+        "STALLED",
+        "FAULT"
+    };
+
+    return lookup[ fan_health_int ];
+}
+
+// Enable/disable the PWM chip control via sysfs
+void pwm_set_chip_export_channel( Fan *fan, bool is_enabled ) {
+
+    l( DEBUG, "PWM channel %s...\n", is_enabled ? "exporting" : "un-exporting" );
+
+    fprintf( is_enabled ? fan->fd_pwm_chip_export : fan->fd_pwm_chip_unexport, "%i", fan->pwm_channel_num );
+    fflush( is_enabled ? fan->fd_pwm_chip_export : fan->fd_pwm_chip_unexport );
+
+    l( DEBUG, "PWM channel %s!\n", is_enabled ? "exported" : "un-exported" );
+}
+
+// Format an unsigned int as newline terminated decimal into the buffer without printf;
+//    returns the # of bytes to write
+size_t format_uint_line( char *buffer, size_t buffer_size, unsigned int value ) {
+
+    char digits[10];
+    size_t digit_count = 0;
+
+    do {
+
+        digits[ digit_count++ ] = '0' + ( value % 10 );
+        value /= 10;
+
+    } while( value > 0 && digit_count < sizeof( digits ) );
+
+    if( digit_count + 1 > buffer_size ) { return 0; }
+
+    for( size_t i = 0; i < digit_count; i++ ) {
+
+        buffer[i] = digits[ digit_count - 1 - i ];
+    }
+
+    // Newline terminated so each write is a distinct record on a fake FIFO node
+    buffer[ digit_count ] = '\n';
+
+    return digit_count + 1;
+}
+
+// Write a duty cycle in ns to the kernel unless it is already the last value written
+void pwm_write_duty_cycle_ns( Fan *fan, unsigned int duty_cycle_ns ) {
+
+    if( fan->pwm_last_duty_cycle_ns == ( long ) duty_cycle_ns ) {
+
+        atomic_fetch_add_explicit( &fan->pwm_duty_cycle_writes_skipped, 1, memory_order_relaxed );
+        return;
+    }
+
+    long long write_start_ns = monotonic_ns();
+    size_t len = format_uint_line( fan->pwm_duty_cycle_buffer, sizeof( fan->pwm_duty_cycle_buffer ), duty_cycle_ns );
+    ssize_t written = write( fan->fd_pwm_channel_set_duty_cycle, fan->pwm_duty_cycle_buffer, len );
+
+    tick_timing.write_ns += monotonic_ns() - write_start_ns;
+
+    if( written != ( ssize_t ) len ) {
+
+        atomic_fetch_add_explicit( &metrics.sysfs_errors, 1, memory_order_relaxed );
+        l( ERROR, "ERROR: Unable to write fan %i duty cycle %u: %s\n", fan->idx, duty_cycle_ns, strerror( errno ) );
+
+        // Kernel state is unknown after a failed write so never skip the next one
+        fan->pwm_last_duty_cycle_ns = PWM_DUTY_CYCLE_NS_UNKNOWN;
+        return;
+    }
+
+    fan->pwm_last_duty_cycle_ns = duty_cycle_ns;
+    atomic_fetch_add_explicit( &fan->pwm_duty_cycle_writes, 1, memory_order_relaxed );
+}
+
+// Set the duty-cycle to scaled value
+void pwm_set_duty_cycle( Fan *fan, unsigned int duty_cycle ) {
+
+    if( duty_cycle > fan->ctl.max_duty_cycle ) {
+
+        l( ERROR, "ERROR: Duty cycle exceeds maximum allowed value!\n" );
+        return;
+    }
+
+    // Rounded to the nearest ns
+    unsigned int duty_cycle_ns = ( ( unsigned long long ) duty_cycle * fan->pwm_duty_cycle_period_ns + fan->ctl.max_duty_cycle / 2 ) / fan->ctl.max_duty_cycle;
+
+    if( duty_cycle_ns > DUTY_CYCLE_NS_OOB_HIGH ) {
+
+        l( ERROR, "ERROR: Duty cycle exceeds OOB range!\n" );
+        return;
+    }
+
+    pwm_write_duty_cycle_ns( fan, duty_cycle_ns );
+}
+
+// Set the duty cycle to max, but ensure value chages so sysfs picks up change
+void pwm_set_max_duty_cycle( Fan *fan ) {
+
+    // Only when the kernel value is unknown do we need to force a visible change; otherwise
+    //    the last written value tells us whether a write is needed at all
+    if( fan->pwm_last_duty_cycle_ns == PWM_DUTY_CYCLE_NS_UNKNOWN ) {
+
+        pwm_set_duty_cycle( fan, fan->ctl.max_duty_cycle - 1 );
+    }
+
+    pwm_set_duty_cycle( fan, fan->ctl.max_duty_cycle );
+}
+
+// Set every fan to max
+void pwm_set_max_duty_cycle_all() {
+
+    for( int i = 0; i < fan_count; i++ ) {
+
+        pwm_set_max_duty_cycle( &fans[i] );
+    }
+}
+
+// Setup the PWM controller for fan control
+void pwm_setup( Fan *fan ) {
+
+    // Get PWM chip and channel numbers
+    fan->pwm_chip_num    = get_gpio_sysfs_num( LOOKUP_PWM_CHIP, -1 );
+    fan->pwm_channel_num = get_gpio_sysfs_num( LOOKUP_GPIO_PWM_CHANNEL, fan->bcm_gpio_pin_pwm );
+
+    // Two fans can't share a channel; ie: GPIO 12 and 18 are both channel 0 before the Pi 5
+    for( int i = 0; i < fan->idx; i++ ) {
+
+        if( fans[i].pwm_chip_num == fan->pwm_chip_num && fans[i].pwm_channel_num == fan->pwm_channel_num ) {
+
+            l( ERROR, "Error: Fans %i and %i both use PWM channel %i!\n", i, fan->idx, fan->pwm_channel_num );
+            clean_up_and_exit( 1 );
+        }
+    }
+
+    // Format to paths for /sys/class control
+    char pwm_chip_path_str[ SYSFS_PATH_MAX ];
+    char pwm_channel_path_str[ SYSFS_PATH_MAX ];
+
+    sysfs_path( pwm_chip_path_str, "/class/pwm/pwmchip%i/", fan->pwm_chip_num );
+    sysfs_path( pwm_channel_path_str, "/class/pwm/pwmchip%i/pwm%i/", fan->pwm_chip_num, fan->pwm_channel_num );
+
+    char channel_enable_path_str[ SYSFS_PATH_MAX ];
+    sysfs_path( channel_enable_path_str, "/class/pwm/pwmchip%i/pwm%i/enable", fan->pwm_chip_num, fan->pwm_channel_num );
+
+    // An adopted channel is left exported (and running) as found
+    bool is_adopted = ADOPT && access( channel_enable_path_str, F_OK ) == 0;
+
+    // An adopted channel already at our period and enabled needs no writes, and its current
+    //    duty cycle seeds the skip-unchanged check so it isn't rewritten either
+    // - Read before the attributes are opened for writing
+    long adopted_period_ns = -1,
+         adopted_enable    = -1,
+         adopted_duty_ns   = -1;
+
+    if( is_adopted ) {
+
+        l( INFO, "Adopting exported PWM channel %i on pwmchip%i...\n", fan->pwm_channel_num, fan->pwm_chip_num );
+
+        char channel_path_str[ SYSFS_PATH_MAX ];
+
+        sysfs_path( channel_path_str, "/class/pwm/pwmchip%i/pwm%i/period", fan->pwm_chip_num, fan->pwm_channel_num );
+        sysfs_read_long( channel_path_str, &adopted_period_ns );
+
+        sysfs_path( channel_path_str, "/class/pwm/pwmchip%i/pwm%i/enable", fan->pwm_chip_num, fan->pwm_channel_num );
+        sysfs_read_long( channel_path_str, &adopted_enable );
+
+        sysfs_path( channel_path_str, "/class/pwm/pwmchip%i/pwm%i/duty_cycle", fan->pwm_chip_num, fan->pwm_channel_num );
+        sysfs_read_long( channel_path_str, &adopted_duty_ns );
+
+    } else {
+
+        char chip_unexport_str[ SYSFS_PATH_MAX ];
+        sysfs_path( chip_unexport_str, "/class/pwm/pwmchip%i/unexport", fan->pwm_chip_num );
+        open_fd( chip_unexport_str, &fan->fd_pwm_chip_unexport, "w" );
+
+        // Ensure unloaded before we start
+        pwm_set_chip_export_channel( fan, false );
+
+        // Setup file descriptors/handles for /sys/class control points
+        char chip_export_str[ SYSFS_PATH_MAX ];
+        sysfs_path( chip_export_str, "/class/pwm/pwmchip%i/export", fan->pwm_chip_num );
+        open_fd( chip_export_str, &fan->fd_pwm_chip_export, "w" );
+
+        // Setup the chip export channel
+        pwm_set_chip_export_channel( fan, true );
+
+        // Wait for PWM channel enable to become available before opening it
+        wait_for_file_with_timeout( channel_enable_path_str, 5 );
+    }
+
+    open_fd( channel_enable_path_str, &fan->fd_pwm_channel_enable, "w" );
+
+    char channel_set_duty_cycle_path_str[ SYSFS_PATH_MAX ];
+    sysfs_path( channel_set_duty_cycle_path_str, "/class/pwm/pwmchip%i/pwm%i/duty_cycle", fan->pwm_chip_num, fan->pwm_channel_num );
+    l( DEBUG, "Opening \"%s\" for raw writes...\n", channel_set_duty_cycle_path_str );
+
+    fan->fd_pwm_channel_set_duty_cycle = open( channel_set_duty_cycle_path_str, O_WRONLY );
+
+    if( fan->fd_pwm_channel_set_duty_cycle < 0 ) {
+
+        l( ERROR, "Error opening \"%s\"... Exiting with status 1...\n", channel_set_duty_cycle_path_str );
+        clean_up_and_exit( 1 );
+    }
+
+    char channel_set_duty_cycle_period_path_str[ SYSFS_PATH_MAX ];
+    sysfs_path( channel_set_duty_cycle_period_path_str, "/class/pwm/pwmchip%i/pwm%i/period", fan->pwm_chip_num, fan->pwm_channel_num );
+    open_fd( channel_set_duty_cycle_period_path_str, &fan->fd_pwm_channel_set_duty_cycle_period, "w" );
+
+    // Setup PWM duty cycle period
+    fan->pwm_duty_cycle_period_ns = ( 1000000000 / fan->pwm_freq_hz );
+
+    if( adopted_period_ns != fan->pwm_duty_cycle_period_ns ) {
+
+        // The kernel rejects a period shorter than the current duty cycle
+        if( is_adopted ) { pwm_write_duty_cycle_ns( fan, 0 ); }
+
+        l( DEBUG, "Setting duty cycle period to %u...\n", fan->pwm_duty_cycle_period_ns );
+
+        fprintf( fan->fd_pwm_channel_set_duty_cycle_period, "%u", fan->pwm_duty_cycle_period_ns );
+        fflush( fan->fd_pwm_channel_set_duty_cycle_period );
+
+        l( DEBUG, "Duty cycle period set to %u!\n", fan->pwm_duty_cycle_period_ns );
+
+    } else if( adopted_duty_ns >= 0 && adopted_duty_ns <= adopted_period_ns ) {
+
+        fan->pwm_last_duty_cycle_ns = adopted_duty_ns;
+    }
+
+    if( adopted_enable != 1 ) {
+
+        // Set the channel to enabled
+        l( DEBUG, "PWM channel enabling...\n" );
+
+        fprintf( fan->fd_pwm_channel_enable, "1" );
+        fflush( fan->fd_pwm_channel_enable );
+
+        l( DEBUG, "PWM channel enabled!\n" );
+    }
+
+    // Set the last time we were above minimum off temp to now
+    controller_start( &fan->ctl, monotonic_ns() );
+
+    l( DEBUG, "\nRuntime (fan %i):\n", fan->idx );
+    l( DEBUG, " - bcm_gpio_pin_pwm         = %i\n",  fan->bcm_gpio_pin_pwm );
+    l( DEBUG, " - pwm_chip_num             = %i\n",  fan->pwm_chip_num );
+    l( DEBUG, " - pwm_channel_num          = %i\n",  fan->pwm_channel_num );
+    l( DEBUG, " - pwm_chip_path_str        = %s\n",  pwm_chip_path_str );
+    l( DEBUG, " - pwm_channel_path_str     = %s\n",  pwm_channel_path_str );
+    l( DEBUG, " - pwm_duty_cycle_period_ns = %i\n",  fan->pwm_duty_cycle_period_ns );
+    l( DEBUG, " - max_duty_cycle           = %i\n",  fan->ctl.max_duty_cycle );
+    l( DEBUG, " - last_above_min_ns        = %lli\n", fan->ctl.last_above_min_ns );
+    l( DEBUG, "\n" );
+}
+
+// Setup the CPU temp file descriptor shared by all fans
+void cpu_temp_setup() {
+
+    // `/sys/class/thermal/thermal_zone0/temp` on Raspberry Pi contains current temp
+    //    in Celsius * 1000
+    char cpu_temp_path_str[ SYSFS_PATH_MAX ];
+    sysfs_path( cpu_temp_path_str, "/class/thermal/thermal_zone0/temp" );
+
+    l( DEBUG, "Opening \"%s\" for raw reads...\n", cpu_temp_path_str );
+
+    fd_cpu_temp = open( cpu_temp_path_str, O_RDONLY );
+
+    if( fd_cpu_temp < 0 ) {
+
+        l( ERROR, "Error opening \"%s\"... Exiting with status 1...\n", cpu_temp_path_str );
+        clean_up_and_exit( 1 );
+    }
+}
+
+// Parse a decimal C string (ie: "38.5") into integer millidegrees without floats; extra
+//    fractional digits past millidegrees are ignored
+bool parse_millidegrees( const char *str, int *temp_mc ) {
+
+    int sign = 1, whole = 0, frac = 0, frac_digits = 0;
+    bool has_digits = false;
+
+    while( *str == ' ' ) { str++; }
+
+    if( *str == '-' || *str == '+' ) { sign = *str == '-' ? -1 : 1; str++; }
+
+    for( ; *str >= '0' && *str <= '9'; str++ ) {
+
+        whole = whole * 10 + ( *str - '0' );
+        has_digits = true;
+    }
+
+    if( *str == '.' ) {
+
+        for( str++; *str >= '0' && *str <= '9'; str++ ) {
+
+            if( frac_digits < 3 ) { frac = frac * 10 + ( *str - '0' ); frac_digits++; }
+            has_digits = true;
+        }
+    }
+
+    for( ; frac_digits < 3; frac_digits++ ) { frac *= 10; }
+
+    if( ! has_digits || ( *str != '\0' && *str != '\n' && *str != ' ' ) ) { return false; }
+
+    *temp_mc = sign * ( whole * 1000 + frac );
+
+    return true;
+}
+
+// Get a temp env var in C as millidegrees; an unparseable value is an invalid config
+void getenv_millidegrees( const char *name, int *temp_mc ) {
+
+    if( getenv( name ) && ! parse_millidegrees( getenv( name ), temp_mc ) ) {
+
+        l( ERROR, "Error: %s must be a decimal temp in C!\n", name );
+        config_invalid();
+    }
+}
+
+// Get CPU temp in millidegrees C; -1 on a read error or out-of-range temp
+int get_cpu_temp_mc() {
+
+    // Value in "temp" file is already degrees in C * 1000
+    char buffer[16];
+    ssize_t len = pread( fd_cpu_temp, buffer, sizeof( buffer ) - 1, 0 );
+
+    if( len <= 0 ) {
+
+        atomic_fetch_add_explicit( &metrics.sysfs_errors, 1, memory_order_relaxed );
+        return -1;
+    }
+
+    int cpu_temp_mc = 0;
+
+    for( ssize_t i = 0; i < len && buffer[i] >= '0' && buffer[i] <= '9'; i++ ) {
+
+        cpu_temp_mc = cpu_temp_mc * 10 + ( buffer[i] - '0' );
+    }
+
+    // Check if within reasonable range temps and return -1 to denote issue
+    if( cpu_temp_mc <= CPU_TEMP_OOB_LOW || cpu_temp_mc >= CPU_TEMP_OOB_HIGH ) {
+
+        atomic_fetch_add_explicit( &metrics.sysfs_errors, 1, memory_order_relaxed );
+        return -1;
+    }
+
+    smooth_push( &cpu_temp_smooth, cpu_temp_mc );
+
+    return cpu_temp_mc;
+}
+
+// Resolve the thermal generic netlink family and join its trip point event multicast group
+// - Returns false when the kernel has no thermal netlink support; band watching still works
+bool thermal_events_subscribe( int fd ) {
+
+    // Request the family by name
+    struct {
+        struct nlmsghdr n;
+        struct genlmsghdr g;
+        char buffer[64];
+    } request;
+
+    memset( &request, 0, sizeof( request ) );
+
+    request.n.nlmsg_type  = GENL_ID_CTRL;
+    request.n.nlmsg_flags = NLM_F_REQUEST;
+    request.n.nlmsg_seq   = 1;
+    request.g.cmd         = CTRL_CMD_GETFAMILY;
+    request.g.version     = 1;
+
+    struct nlattr *family_name_attr = ( struct nlattr* ) request.buffer;
+    family_name_attr->nla_type = CTRL_ATTR_FAMILY_NAME;
+    family_name_attr->nla_len  = NLA_HDRLEN + sizeof( THERMAL_GENL_FAMILY_NAME );
+    memcpy( ( char* ) family_name_attr + NLA_HDRLEN, THERMAL_GENL_FAMILY_NAME, sizeof( THERMAL_GENL_FAMILY_NAME ) );
+
+    request.n.nlmsg_len = NLMSG_LENGTH( GENL_HDRLEN ) + NLA_ALIGN( family_name_attr->nla_len );
+
+    if( send( fd, &request, request.n.nlmsg_len, 0 ) < 0 ) { return false; }
+
+    char buffer[ THERMAL_EVENT_BUFFER_SIZE ];
+    ssize_t len = recv( fd, buffer, sizeof( buffer ), 0 );
+
+    struct nlmsghdr *reply = ( struct nlmsghdr* ) buffer;
+
+    if( len < 0 || ! NLMSG_OK( reply, len ) || reply->nlmsg_type == NLMSG_ERROR ) { return false; }
+
+    // Walk the reply attributes for the event multicast group id
+    int attrs_len = reply->nlmsg_len - NLMSG_LENGTH( GENL_HDRLEN );
+    struct nlattr *attr = ( struct nlattr* ) ( ( char* ) NLMSG_DATA( reply ) + GENL_HDRLEN );
+
+    for( ; attrs_len >= NLA_HDRLEN && attr->nla_len <= attrs_len; attrs_len -= NLA_ALIGN( attr->nla_len ), attr = ( struct nlattr* ) ( ( char* ) attr + NLA_ALIGN( attr->nla_len ) ) ) {
+
+        if( ( attr->nla_type & NLA_TYPE_MASK ) != CTRL_ATTR_MCAST_GROUPS ) { continue; }
+
+        int groups_len = attr->nla_len - NLA_HDRLEN;
+        struct nlattr *group = ( struct nlattr* ) ( ( char* ) attr + NLA_HDRLEN );
+
+        for( ; groups_len >= NLA_HDRLEN && group->nla_len <= groups_len; groups_len -= NLA_ALIGN( group->nla_len ), group = ( struct nlattr* ) ( ( char* ) group + NLA_ALIGN( group->nla_len ) ) ) {
+
+            int group_attrs_len = group->nla_len - NLA_HDRLEN;
+            struct nlattr *group_attr = ( struct nlattr* ) ( ( char* ) group + NLA_HDRLEN );
+
+            const char *group_name = NULL;
+            unsigned int group_id  = 0;
+
+            for( ; group_attrs_len >= NLA_HDRLEN && group_attr->nla_len <= group_attrs_len; group_attrs_len -= NLA_ALIGN( group_attr->nla_len ), group_attr = ( struct nlattr* ) ( ( char* ) group_attr + NLA_ALIGN( group_attr->nla_len ) ) ) {
+
+                if( group_attr->nla_type == CTRL_ATTR_MCAST_GRP_NAME ) { group_name = ( char* ) group_attr + NLA_HDRLEN; }
+                if( group_attr->nla_type == CTRL_ATTR_MCAST_GRP_ID )   { group_id = *( unsigned int* ) ( ( char* ) group_attr + NLA_HDRLEN ); }
+            }
+
+            if( group_name != NULL && strcmp( group_name, THERMAL_GENL_EVENT_GROUP_NAME ) == 0 ) {
+
+                return setsockopt( fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group_id, sizeof( group_id ) ) == 0;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Setup the thermal trip point event socket for event mode
+void thermal_events_setup() {
+
+    l( INFO, "Subscribing to thermal trip point events...\n" );
+
+    fd_thermal_events = socket( AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC );
+
+    if( fd_thermal_events < 0 || ! thermal_events_subscribe( fd_thermal_events ) ) {
+
+        l( INFO, "Thermal trip point events unavailable; using temperature band watching only!\n" );
+
+        if( fd_thermal_events >= 0 ) { close( fd_thermal_events ); }
+        fd_thermal_events = -1;
+
+        return;
+    }
+
+    fcntl( fd_thermal_events, F_SETFL, O_NONBLOCK );
+
+    l( INFO, "Subscribed to thermal trip point events!\n" );
+}
+
+// CPU load since the last call in permille, scaled by the current over max CPU frequency when
+//    cpufreq is available since heat follows cycles rather than busy time; -1 on error
+int feedforward_read_load() {
+
+    char buffer[ FF_PROC_STAT_BUFFER_SIZE ];
+    unsigned long long user, nice, system, idle, iowait, irq, softirq, steal;
+
+    ssize_t len = pread( feedforward.fd_proc_stat, buffer, sizeof( buffer ) - 1, 0 );
+
+    if( len <= 0 ) { return -1; }
+
+    buffer[ len ] = '\0';
+
+    if( sscanf( buffer, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal ) != 8 ) { return -1; }
+
+    unsigned long long busy  = user + nice + system + irq + softirq + steal;
+    unsigned long long total = busy + idle + iowait;
+
+    unsigned long long delta_busy  = busy - feedforward.last_busy;
+    unsigned long long delta_total = total - feedforward.last_total;
+
+    feedforward.last_busy  = busy;
+    feedforward.last_total = total;
+
+    if( delta_total == 0 ) { return -1; }
+
+    long long load_permille = delta_busy * 1000 / delta_total;
+
+    if( feedforward.fd_cpufreq_cur >= 0 ) {
+
+        len = pread( feedforward.fd_cpufreq_cur, buffer, sizeof( buffer ) - 1, 0 );
+
+        if( len > 0 ) {
+
+            buffer[ len ] = '\0';
+            load_permille = load_permille * strtol( buffer, NULL, 10 ) / feedforward.cpufreq_max_khz;
+        }
+    }
+
+    return load_permille > 1000 ? 1000 : load_permille;
+}
+
+// Temp lead for this tick from the load's step above (or below) its FF_TAU_MS average
+// - The average follows the load about as fast as the heatsink follows the SoC, so a burst
+//   leads by up to FF_GAIN_MC and the lead fades as the temp catches up on its own
+int feedforward_offset_mc() {
+
+    int load_permille = feedforward_read_load();
+    long long now_ns  = monotonic_ns();
+
+    if( load_permille < 0 ) { return 0; }
+
+    if( feedforward.load_avg_permille < 0 ) {
+
+        feedforward.load_avg_permille = load_permille;
+
+    } else {
+
+        long long dt_ms = ( now_ns - feedforward.last_update_ns ) / 1000000;
+
+        feedforward.load_avg_permille += ( load_permille - feedforward.load_avg_permille ) * dt_ms / ( FF_TAU_MS + dt_ms );
+    }
+
+    feedforward.last_update_ns = now_ns;
+
+    int offset_mc = ( long long ) FF_GAIN_MC * ( load_permille - feedforward.load_avg_permille ) / 1000;
+
+    atomic_store_explicit( &metrics.load_permille, load_permille, memory_order_relaxed );
+    atomic_store_explicit( &metrics.ff_offset_mc,  offset_mc,     memory_order_relaxed );
+
+    return offset_mc;
+}
+
+// Setup the feed-forward load sources; /proc/stat is required, cpufreq and the PSI trigger
+//    are used when available
+void feedforward_setup() {
+
+    char path_str[ SYSFS_PATH_MAX ];
+    long cur_khz;
+
+    l( INFO, "Setting up feed-forward from CPU load...\n" );
+
+    feedforward.fd_proc_stat = open( "/proc/stat", O_RDONLY | O_CLOEXEC );
+
+    if( feedforward.fd_proc_stat < 0 ) {
+
+        l( ERROR, "Unable to open /proc/stat: %s\n", strerror( errno ) );
+        clean_up_and_exit( 1 );
+    }
+
+    sysfs_path( path_str, "/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq" );
+
+    if( sysfs_read_long( path_str, &feedforward.cpufreq_max_khz ) && feedforward.cpufreq_max_khz > 0 ) {
+
+        sysfs_path( path_str, "/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq" );
+
+        if( sysfs_read_long( path_str, &cur_khz ) ) {
+
+            feedforward.fd_cpufreq_cur = open( path_str, O_RDONLY | O_CLOEXEC );
+        }
+    }
+
+    l( INFO, "CPU frequency scaling %s\n", feedforward.fd_cpufreq_cur >= 0 ? "found; load is weighted by frequency" : "unavailable; using utilization only" );
+
+    // The trigger fires at most once per window while tasks stall on the CPU for FF_PSI_US
+    char trigger_str[64];
+    int trigger_len = snprintf( trigger_str, sizeof( trigger_str ), "some %u %u", FF_PSI_US, FF_PSI_WINDOW_US );
+
+    fd_psi_trigger = open( "/proc/pressure/cpu", O_RDWR | O_NONBLOCK | O_CLOEXEC );
+
+    if( fd_psi_trigger >= 0 && write( fd_psi_trigger, trigger_str, trigger_len + 1 ) < 0 ) {
+
+        close_raw_fd( &fd_psi_trigger, "fd_psi_trigger" );
+    }
+
+    if( fd_psi_trigger < 0 ) {
+
+        l( INFO, "CPU pressure (PSI) triggers unavailable; load is only sampled each tick!\n" );
+
+    } else {
+
+        l( INFO, "Subscribed to CPU pressure trigger \"%s\"!\n", trigger_str );
+    }
+
+    // Prime the CPU times so the first tick sees the load since now
+    feedforward_read_load();
+}
+
+// Wake early on a CPU pressure trigger so a load burst is seen without waiting out the tick
+void psi_trigger_drain() {
+
+    next_tick_deadline_ns = monotonic_ns();
+
+    l( DEBUG, "CPU pressure trigger; re-evaluating early...\n" );
+}
+
+// Resolve a `udp:host:port` or `unix:/path` peer address; a listen address may leave out the
+//    host (`udp:port`) to bind every interface
+// - An IPv6 host goes in brackets, ie: `udp:[::1]:9720`, which are stripped for getaddrinfo
+bool peer_address_parse( const char *address_str, bool is_listen, struct sockaddr_storage *addr, socklen_t *addr_len ) {
+
+    memset( addr, 0, sizeof( *addr ) );
+
+    if( strncmp( address_str, "unix:", 5 ) == 0 ) {
+
+        struct sockaddr_un *addr_un = ( struct sockaddr_un* ) addr;
+        const char *path_str = address_str + 5;
+
+        if( path_str[0] == '\0' || strlen( path_str ) >= sizeof( addr_un->sun_path ) ) { return false; }
+
+        addr_un->sun_family = AF_UNIX;
+        strcpy( addr_un->sun_path, path_str );
+        *addr_len = sizeof( *addr_un );
+
+        return true;
+    }
+
+    if( strncmp( address_str, "udp:", 4 ) != 0 ) { return false; }
+
+    char host_str[256];
+    const char *port_str = strrchr( address_str + 4, ':' );
+    bool has_host = port_str != NULL;
+
+    if( has_host ) {
+
+        const char *host_start = address_str + 4;
+        int host_len = port_str - host_start;
+
+        if( host_len >= 2 && host_start[0] == '[' && host_start[ host_len - 1 ] == ']' ) {
+
+            host_start++;
+            host_len -= 2;
+
+        // An unbracketed IPv6 host can't be told apart from its port
+        } else if( memchr( host_start, ':', host_len ) != NULL ) {
+
+            return false;
+        }
+
+        snprintf( host_str, sizeof( host_str ), "%.*s", host_len, host_start );
+        port_str++;
+
+    } else if( is_listen ) {
+
+        port_str = address_str + 4;
+
+    } else {
+
+        return false;
+    }
+
+    struct addrinfo hints = { .ai_family = has_host ? AF_UNSPEC : AF_INET, .ai_socktype = SOCK_DGRAM, .ai_flags = is_listen ? AI_PASSIVE : 0 };
+    struct addrinfo *result;
+
+    if( getaddrinfo( has_host ? host_str : NULL, port_str, &hints, &result ) != 0 ) { return false; }
+
+    memcpy( addr, result->ai_addr, result->ai_addrlen );
+    *addr_len = result->ai_addrlen;
+
+    freeaddrinfo( result );
+
+    return true;
+}
+
+// Setup the shared chassis sockets; the id defaults to the hostname
+void peers_setup() {
+
+    if( PEER_ID[0] != '\0' ) {
+
+        snprintf( peer_id, sizeof( peer_id ), "%s", PEER_ID );
+
+    } else if( gethostname( peer_id, PEER_ID_MAX ) != 0 ) {
+
+        snprintf( peer_id, sizeof( peer_id ), "%s", "pwm_fan" );
+    }
+
+    if( PEER_PUBLISH[0] != '\0' ) {
+
+        if( ! peer_address_parse( PEER_PUBLISH, false, &peer_publish_addr, &peer_publish_addr_len ) ) {
+
+            l( ERROR, "Error: PWM_FAN_PEER_PUBLISH \"%s\" must be udp:host:port, udp:[ipv6]:port or unix:/path!\n", PEER_PUBLISH );
+            clean_up_and_exit( 1 );
+        }
+
+        fd_peer_publish = socket( peer_publish_addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+
+        if( fd_peer_publish < 0 ) {
+
+            l( ERROR, "Unable to create the peer publish socket: %s\n", strerror( errno ) );
+            clean_up_and_exit( 1 );
+        }
+
+        l( INFO, "Publishing temps as \"%s\" to %s\n", peer_id, PEER_PUBLISH );
+    }
+
+    if( PEER_LISTEN[0] != '\0' ) {
+
+        struct sockaddr_storage addr;
+        socklen_t addr_len;
+
+        if( ! peer_address_parse( PEER_LISTEN, true, &addr, &addr_len ) ) {
+
+            l( ERROR, "Error: PWM_FAN_PEER_LISTEN \"%s\" must be udp:port, udp:host:port, udp:[ipv6]:port or unix:/path!\n", PEER_LISTEN );
+            clean_up_and_exit( 1 );
+        }
+
+        // A stale socket from an unclean exit would fail the bind
+        if( addr.ss_family == AF_UNIX ) { unlink( ( ( struct sockaddr_un* ) &addr )->sun_path ); }
+
+        fd_peer_listen = socket( addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+
+        if( fd_peer_listen < 0 || bind( fd_peer_listen, ( struct sockaddr* ) &addr, addr_len ) != 0 ) {
+
+            l( ERROR, "Unable to listen for peers on %s: %s\n", PEER_LISTEN, strerror( errno ) );
+            clean_up_and_exit( 1 );
+        }
+
+        l( INFO, "Listening for peer temps on %s (%s, %ums timeout)\n", PEER_LISTEN, PEER_AGGREGATE, PEER_TIMEOUT_MS );
+    }
+}
+
+// Publish this tick's control temps in one datagram; a listener that isn't up yet only
+//    counts as a failed send
+void peer_publish( int temp_mc, int smooth_temp_mc ) {
+
+    PeerDatagram datagram = {
+        .magic          = htonl( PEER_MAGIC ),
+        .temp_mc        = ( int ) htonl( ( unsigned int ) temp_mc ),
+        .smooth_temp_mc = ( int ) htonl( ( unsigned int ) smooth_temp_mc ),
+        .weight         = htons( PEER_WEIGHT )
+    };
+
+    memcpy( datagram.id, peer_id, strlen( peer_id ) );
+
+    if( sendto( fd_peer_publish, &datagram, sizeof( datagram ), 0, ( struct sockaddr* ) &peer_publish_addr, peer_publish_addr_len ) == sizeof( datagram ) ) {
+
+        atomic_fetch_add_explicit( &metrics.peer_sent, 1, memory_order_relaxed );
+
+    } else {
+
+        atomic_fetch_add_explicit( &metrics.peer_send_failed, 1, memory_order_relaxed );
+    }
+}
+
+// Drain the peer datagrams that arrived since the last tick into `peers`; the latest per id
+//    wins
+void peers_drain( long long now_ns ) {
+
+    char buffer[ sizeof( PeerDatagram ) + 1 ];
+    PeerDatagram datagram;
+    ssize_t len;
+
+    while( ( len = recv( fd_peer_listen, buffer, sizeof( buffer ), MSG_DONTWAIT ) ) >= 0 ) {
+
+        memcpy( &datagram, buffer, sizeof( datagram ) );
+
+        if( len != sizeof( datagram ) || ntohl( datagram.magic ) != PEER_MAGIC ) {
+
+            atomic_fetch_add_explicit( &metrics.peer_rejected, 1, memory_order_relaxed );
+            continue;
+        }
+
+        char id[ PEER_ID_MAX + 1 ] = { 0 };
+        Peer *peer = NULL;
+
+        memcpy( id, datagram.id, PEER_ID_MAX );
+
+        for( int i = 0; i < peer_count && peer == NULL; i++ ) {
+
+            if( strcmp( peers[i].id, id ) == 0 ) { peer = &peers[i]; }
+        }
+
+        if( peer == NULL ) {
+
+            if( peer_count == PEER_MAX ) {
+
+                atomic_fetch_add_explicit( &metrics.peer_rejected, 1, memory_order_relaxed );
+                continue;
+            }
+
+            peer = &peers[ peer_count++ ];
+            memcpy( peer->id, id, sizeof( id ) );
+
+            l( INFO, "Peer \"%s\" joined\n", peer->id );
+        }
+
+        peer->temp_mc        = ( int ) ntohl( ( unsigned int ) datagram.temp_mc );
+        peer->smooth_temp_mc = ( int ) ntohl( ( unsigned int ) datagram.smooth_temp_mc );
+        peer->weight         = ntohs( datagram.weight );
+        peer->last_ns        = now_ns;
+
+        atomic_fetch_add_explicit( &metrics.peer_received, 1, memory_order_relaxed );
+    }
+}
+
+// Forget the peers already stale, ie: a host taken out of the chassis, so they stop holding the
+//    fans at max; fresh peers are kept so a reload doesn't hold the fans at max until each
+//    sends again
+void peers_forget_stale( long long now_ns ) {
+
+    int kept_count = 0;
+
+    for( int i = 0; i < peer_count; i++ ) {
+
+        if( now_ns - peers[i].last_ns > PEER_TIMEOUT_MS * 1000000LL ) {
+
+            l( INFO, "Peer \"%s\" forgotten\n", peers[i].id );
+            continue;
+        }
+
+        peers[ kept_count++ ] = peers[i];
+    }
+
+    peer_count = kept_count;
+}
+
+// Fold the fresh peers' temps into this host's control temps by PEER_AGGREGATE, and hold the
+//    fans at max while any peer heard from is stale or fewer than PEER_EXPECT are fresh
+void peers_aggregate( int *control_temp_mc, int *control_smooth_mc, long long now_ns ) {
+
+    unsigned int fresh_count = 0,
+                 stale_count = 0;
+
+    int max_temp_mc        = *control_temp_mc,
+        max_smooth_temp_mc = *control_smooth_mc;
+
+    long long weight_sum      = PEER_WEIGHT,
+              temp_sum        = ( long long ) *control_temp_mc * PEER_WEIGHT,
+              smooth_temp_sum = ( long long ) *control_smooth_mc * PEER_WEIGHT;
+
+    for( int i = 0; i < peer_count; i++ ) {
+
+        Peer *peer = &peers[i];
+
+        if( now_ns - peer->last_ns > PEER_TIMEOUT_MS * 1000000LL ) {
+
+            stale_count++;
+            continue;
+        }
+
+        fresh_count++;
+
+        if( peer->temp_mc > max_temp_mc )               { max_temp_mc = peer->temp_mc; }
+        if( peer->smooth_temp_mc > max_smooth_temp_mc ) { max_smooth_temp_mc = peer->smooth_temp_mc; }
+
+        weight_sum      += peer->weight;
+        temp_sum        += ( long long ) peer->temp_mc * peer->weight;
+        smooth_temp_sum += ( long long ) peer->smooth_temp_mc * peer->weight;
+    }
+
+    bool is_stale = stale_count > 0 || fresh_count < PEER_EXPECT;
+
+    if( is_stale && ! is_peer_stale ) {
+
+        l( ERROR, "Peers stale: %u of %i heard from within %ums, %u expected; holding fans at MAX_DUTY_CYCLE\n", fresh_count, peer_count, PEER_TIMEOUT_MS, PEER_EXPECT );
+
+    } else if( ! is_stale && is_peer_stale ) {
+
+        l( INFO, "Peers fresh: %u heard from within %ums\n", fresh_count, PEER_TIMEOUT_MS );
+    }
+
+    is_peer_stale = is_stale;
+
+    atomic_store_explicit( &metrics.peers_fresh, fresh_count, memory_order_relaxed );
+    atomic_store_explicit( &metrics.peers_stale, stale_count, memory_order_relaxed );
+
+    if( peer_aggregate == PEER_AGGREGATE_MEAN ) {
+
+        *control_temp_mc   = temp_sum / weight_sum;
+        *control_smooth_mc = smooth_temp_sum / weight_sum;
+
+    } else {
+
+        *control_temp_mc   = max_temp_mc;
+        *control_smooth_mc = max_smooth_temp_mc;
+    }
+}
+
+// Sleep time until the temp could first reach the edge of the band it is in
+// - The band only has an edge worth waking for when the fan state is stable across it; the
+//   easing range tracks every change so it returns 0 and the tick scheduler decides
+unsigned int event_band_sleep_ms( Fan *fan, int cur_temp_mc ) {
+
+    long long edge_distance_mc;
+    long long grace_remaining_ms = fan->ctl.fan_off_grace_ms - fan->ctl.grace_check_ms;
+    unsigned short decided_mode_int = fan->ctl.decided_mode_int;
+
+    switch( decided_mode_int ) {
+
+        // Fan is off and only turns on at min_on_temp_mc
+        case FAN_BELOW_OFF:
+            edge_distance_mc = fan->ctl.min_on_temp_mc - cur_temp_mc;
+            break;
+
+        // Fan is at max and only slows once below max_temp_mc
+        case FAN_ABOVE_MAX:
+            edge_distance_mc = cur_temp_mc - fan->ctl.max_temp_mc;
+            break;
+
+        // Fan is at min until min_on_temp_mc or the grace period runs out
+        case FAN_BELOW_MIN:
+            edge_distance_mc = fan->ctl.min_on_temp_mc - cur_temp_mc;
+            break;
+
+        default:
+            return 0;
+    }
+
+    long long sleep_ms = edge_distance_mc * 1000 / EVENT_MAX_SLEW_MC_S;
+
+    if( decided_mode_int == FAN_BELOW_MIN && grace_remaining_ms < sleep_ms ) { sleep_ms = grace_remaining_ms; }
+
+    if( sleep_ms < 0 )                  { return 0; }
+    if( sleep_ms > EVENT_MAX_SLEEP_MS ) { return EVENT_MAX_SLEEP_MS; }
+
+    return sleep_ms;
+}
+
+// Power save deep idle sleep; IDLE_SLEEP_MS while the fan is off with the temp well below
+//    where it turns on, otherwise 0 to leave the interval to the tick scheduler
+unsigned int power_save_idle_sleep_ms( Fan *fan, int cur_temp_mc ) {
+
+    if( fan->ctl.decided_mode_int == FAN_BELOW_OFF && cur_temp_mc <= fan->ctl.min_on_temp_mc - IDLE_MARGIN_MC ) {
+
+        return IDLE_SLEEP_MS;
+    }
+
+    return 0;
+}
+
+// Wakeups of every thread so far; each voluntary context switch is a sleep that ended
+unsigned long process_wakeups() {
+
+    struct rusage usage;
+
+    if( getrusage( RUSAGE_SELF, &usage ) != 0 ) { return 0; }
+
+    return usage.ru_nvcsw;
+}
+
+// Add an observation in ns to a histogram
+void metrics_observe( MetricsHistogram *histogram, long long value_ns ) {
+
+    static const unsigned int bounds_us[] = METRICS_BUCKETS_US;
+    unsigned int bucket = 0;
+
+    if( value_ns < 0 ) { value_ns = 0; }
+
+    while( bucket < METRICS_BUCKET_COUNT - 1 && value_ns > bounds_us[ bucket ] * 1000LL ) { bucket++; }
+
+    atomic_fetch_add_explicit( &histogram->buckets[ bucket ], 1,        memory_order_relaxed );
+    atomic_fetch_add_explicit( &histogram->sum_ns,            value_ns, memory_order_relaxed );
+    atomic_fetch_add_explicit( &histogram->count,             1,        memory_order_relaxed );
+
+    // Single writer so load and store can't race another max
+    if( ( unsigned long long ) value_ns > atomic_load_explicit( &histogram->max_ns, memory_order_relaxed ) ) {
+
+        atomic_store_explicit( &histogram->max_ns, value_ns, memory_order_relaxed );
+    }
+}
+
+// Upper bound in us of the bucket holding a quantile (in 1/1000ths); the max when in +Inf
+unsigned long long metrics_quantile_us( MetricsHistogram *histogram, unsigned int quantile_permille ) {
+
+    static const unsigned int bounds_us[] = METRICS_BUCKETS_US;
+    unsigned long long count = atomic_load_explicit( &histogram->count, memory_order_relaxed ),
+                       rank  = ( count * quantile_permille + 999 ) / 1000,
+                       cumulative = 0;
+
+    for( int i = 0; i < METRICS_BUCKET_COUNT - 1 && count > 0; i++ ) {
+
+        cumulative += atomic_load_explicit( &histogram->buckets[i], memory_order_relaxed );
+
+        if( cumulative >= rank ) { return bounds_us[i]; }
+    }
+
+    return atomic_load_explicit( &histogram->max_ns, memory_order_relaxed ) / 1000;
+}
+
+// Log one timing histogram summary
+void metrics_log_histogram( const char *name, MetricsHistogram *histogram ) {
+
+    unsigned long long count = atomic_load_explicit( &histogram->count, memory_order_relaxed );
+
+    l( INFO, " - %-8s n=%llu mean=%lluus p50<=%lluus p99<=%lluus max=%lluus\n",
+        name,
+        count,
+        count > 0 ? atomic_load_explicit( &histogram->sum_ns, memory_order_relaxed ) / count / 1000 : 0,
+        metrics_quantile_us( histogram, 500 ),
+        metrics_quantile_us( histogram, 990 ),
+        atomic_load_explicit( &histogram->max_ns, memory_order_relaxed ) / 1000 );
+}
+
+// Log the timing stats and counters; on SIGUSR1 and at exit
+void metrics_log_stats() {
+
+    dump_stats_received = 0;
+
+    l( INFO, "Control loop stats after %llu ticks: %lu deadline misses, %lu sysfs errors\n",
+        atomic_load_explicit( &metrics.ticks, memory_order_relaxed ),
+        atomic_load_explicit( &scheduler_deadline_misses, memory_order_relaxed ),
+        atomic_load_explicit( &metrics.sysfs_errors, memory_order_relaxed ) );
+
+    // Against the fixed SLEEP_MS loop's one wakeup per tick to check what power save buys
+    long long elapsed_ms = ( monotonic_ns() - metrics.started_ns ) / 1000000;
+
+    if( metrics.started_ns > 0 && elapsed_ms > 0 ) {
+
+        l( INFO, " - wakeups: %.2f/s over %llims (a fixed PWM_FAN_SLEEP_MS loop is %.2f/s)\n",
+            ( process_wakeups() - metrics.started_wakeups ) * 1000.0 / elapsed_ms, elapsed_ms, 1000.0 / SLEEP_MS );
+    }
+
+    metrics_log_histogram( "jitter",  &metrics.wakeup_jitter );
+    metrics_log_histogram( "read",    &metrics.stage_read );
+    metrics_log_histogram( "decide",  &metrics.stage_decide );
+    metrics_log_histogram( "write",   &metrics.stage_write );
+    metrics_log_histogram( "latency", &metrics.loop_latency );
+}
+
+// Setup the tick scheduler timer with the first deadline at now
+void scheduler_setup() {
+
+    fd_tick_timer = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC );
+
+    if( fd_tick_timer < 0 ) {
+
+        l( ERROR, "Unable to create tick timer: %s\n", strerror( errno ) );
+        clean_up_and_exit( 1 );
+    }
+
+    next_tick_deadline_ns = monotonic_ns();
+
+    metrics.started_ns      = next_tick_deadline_ns;
+    metrics.started_wakeups = process_wakeups();
+}
+
+// Give every wait in this thread and any thread it starts generous timer slack so the kernel
+//    can batch the wakeup with others
+void power_save_setup() {
+
+    if( prctl( PR_SET_TIMERSLACK, TIMER_SLACK_US * 1000UL, 0, 0, 0 ) != 0 ) {
+
+        l( ERROR, "Unable to set timer slack: %s\n", strerror( errno ) );
+        return;
+    }
+
+    l( INFO, "Power save enabled with %uus timer slack\n", TIMER_SLACK_US );
+}
+
+// Size the next tick interval from how fast the temp is moving
+// - Snaps straight to a short interval on fast change, but only doubles per tick while
+//   steady so a single quiet sample can't stretch it to SLEEP_MAX_MS
+unsigned int scheduler_adaptive_interval_ms( int cur_temp_mc ) {
+
+    long long now_ns = monotonic_ns();
+
+    if( SLEEP_MIN_MS == SLEEP_MAX_MS ) { return SLEEP_MIN_MS; }
+
+    if( adaptive_interval_ms == 0 ) {
+
+        adaptive_interval_ms = SLEEP_MS;
+
+    } else {
+
+        // Interval over which the temp would move ADAPT_STEP_MC at the last observed rate
+        long long delta_mc  = cur_temp_mc > adaptive_last_temp_mc ? cur_temp_mc - adaptive_last_temp_mc : adaptive_last_temp_mc - cur_temp_mc;
+        long long target_ms = delta_mc > 0 ? ADAPT_STEP_MC * ( now_ns - adaptive_last_sample_ns ) / ( delta_mc * 1000000 ) : SLEEP_MAX_MS;
+
+        if( target_ms > adaptive_interval_ms * 2LL ) { target_ms = adaptive_interval_ms * 2LL; }
+        if( target_ms < SLEEP_MIN_MS )               { target_ms = SLEEP_MIN_MS; }
+        if( target_ms > SLEEP_MAX_MS )               { target_ms = SLEEP_MAX_MS; }
+
+        adaptive_interval_ms = target_ms;
+    }
+
+    adaptive_last_temp_mc   = cur_temp_mc;
+    adaptive_last_sample_ns = now_ns;
+
+    return adaptive_interval_ms;
+}
+
+// Advance to the next absolute tick deadline and arm the tick timer for it; false when the
+//    deadline already passed and the tick should run now
+// - Deadlines advance from the previous deadline rather than from now so iteration cost
+//   does not drift the period; an overrun counts as a miss and restarts from now
+bool scheduler_arm_next_tick( unsigned int sleep_ms ) {
+
+    next_tick_deadline_ns += sleep_ms * 1000000LL;
+
+    if( next_tick_deadline_ns <= monotonic_ns() ) {
+
+        atomic_fetch_add_explicit( &scheduler_deadline_misses, 1, memory_order_relaxed );
+        next_tick_deadline_ns = monotonic_ns();
+
+        return false;
+    }
+
+    // Power save waits out the deadline as a poll/epoll timeout instead
+    if( POWER_SAVE ) { return true; }
+
+    struct itimerspec tick_timer_spec = {
+        { 0, 0 },
+        { next_tick_deadline_ns / 1000000000LL, next_tick_deadline_ns % 1000000000LL }
+    };
+
+    if( timerfd_settime( fd_tick_timer, TFD_TIMER_ABSTIME, &tick_timer_spec, NULL ) != 0 ) {
+
+        l( ERROR, "Unable to arm tick timer: %s\n", strerror( errno ) );
+        return false;
+    }
+
+    return true;
+}
+
+// Poll/epoll timeout until the tick deadline, or -1 to wait on the tick timer alone
+// - Power save uses the timeout since timer slack applies to poll/epoll timeouts while timerfd
+//   expirations are exact
+int scheduler_wait_timeout_ms() {
+
+    if( ! POWER_SAVE ) { return -1; }
+
+    long long remaining_ns = next_tick_deadline_ns - monotonic_ns();
+
+    return remaining_ns > 0 ? ( remaining_ns + 999999 ) / 1000000 : 0;
+}
+
+// Clear the tick timer's expirations
+void tick_timer_drain() {
+
+    unsigned long long expirations;
+    read( fd_tick_timer, &expirations, sizeof( expirations ) );
+}
+
+// Drain thermal trip point events and re-anchor the schedule at the early wakeup
+void thermal_events_drain() {
+
+    char buffer[ THERMAL_EVENT_BUFFER_SIZE ];
+
+    // Any trip point crossing warrants a re-evaluation so just drain the socket
+    while( recv( fd_thermal_events, buffer, sizeof( buffer ), 0 ) > 0 );
+
+    next_tick_deadline_ns = monotonic_ns();
+
+    l( DEBUG, "Thermal trip point event received; re-evaluating early...\n" );
+}
+
+// Drain the config watch and flag a reload when the config file itself changed
+void config_watch_drain() {
+
+    char buffer[4096] __attribute__(( aligned( __alignof__( struct inotify_event ) ) ));
+    ssize_t len;
+
+    // Only changes to the config file itself matter, not its neighbours
+    while( ( len = read( fd_config_watch, buffer, sizeof( buffer ) ) ) > 0 ) {
+
+        for( char *ptr = buffer; ptr < buffer + len; ptr += sizeof( struct inotify_event ) + ( ( struct inotify_event* ) ptr )->len ) {
+
+            struct inotify_event *event = ( struct inotify_event* ) ptr;
+
+            if( event->len > 0 && strcmp( event->name, config_file_name ) == 0 ) { reload_config_received = 1; }
+        }
+    }
+
+    if( reload_config_received ) {
+
+        next_tick_deadline_ns = monotonic_ns();
+
+        l( DEBUG, "Config file changed; reloading...\n" );
+    }
+}
+
+// Sleep in poll until the next tick deadline, waking early on a thermal trip point event or
+//    a config change
+void poll_wait_for_next_tick( unsigned int sleep_ms ) {
+
+    if( ! scheduler_arm_next_tick( sleep_ms ) ) { return; }
+
+    struct pollfd poll_fds[4] = {
+        { fd_tick_timer,     POLLIN,  0 },
+        { fd_thermal_events, POLLIN,  0 },
+        { fd_config_watch,   POLLIN,  0 },
+        { fd_psi_trigger,    POLLPRI, 0 }
+    };
+
+    int poll_return;
+
+    // Negative fds are ignored by poll so thermal events, the config watch and PSI are optional;
+    //    EINTR on halt falls through to the main loop check while a SIGUSR1 stats dump goes
+    //    back to sleep
+    while( ( poll_return = poll( poll_fds, 4, scheduler_wait_timeout_ms() ) ) < 0 && errno == EINTR && ! halt_received && dump_stats_received ) {
+
+        metrics_log_stats();
+    }
+
+    if( poll_return <= 0 ) {
+
+        // SIGHUP reloads on a tick started now
+        if( reload_config_received ) { next_tick_deadline_ns = monotonic_ns(); }
+
+        return;
+    }
+
+    if( poll_fds[0].revents & POLLIN ) { tick_timer_drain(); }
+    if( poll_fds[1].revents & POLLIN ) { thermal_events_drain(); }
+    if( poll_fds[2].revents & POLLIN ) { config_watch_drain(); }
+    if( poll_fds[3].revents & POLLPRI ) { psi_trigger_drain(); }
+}
+
+// Parse `temp_c:duty_cycle,...` points for the points curve
+void curve_points_parse( Fan *fan, const char *points_str ) {
+
+    CurvePoint *curve_points = fan->ctl.curve_points;
+    int curve_point_count = 0;
+
+    const char *cur_str = points_str;
+    char temp_str[16];
+    int chars_read;
+
+    while( curve_point_count < CURVE_MAX_POINTS && sscanf( cur_str, " %15[0-9.+-]:%hu%n", temp_str, &curve_points[ curve_point_count ].duty_cycle, &chars_read ) == 2 ) {
+
+        if( ! parse_millidegrees( temp_str, &curve_points[ curve_point_count ].temp_mc ) ) {
+
+            l( ERROR, "Error: PWM_FAN_CURVE_POINTS temp \"%s\" is invalid!\n", temp_str );
+            config_invalid();
+            return;
+        }
+
+        if( curve_points[ curve_point_count ].duty_cycle > fan->ctl.max_duty_cycle ) {
+
+            l( ERROR, "Error: PWM_FAN_CURVE_POINTS duty cycle %i exceeds MAX_DUTY_CYCLE!\n", curve_points[ curve_point_count ].duty_cycle );
+            config_invalid();
+            return;
+        }
+
+        if( curve_point_count > 0 && curve_points[ curve_point_count ].temp_mc <= curve_points[ curve_point_count - 1 ].temp_mc ) {
+
+            l( ERROR, "Error: PWM_FAN_CURVE_POINTS temps must be increasing!\n" );
+            config_invalid();
+            return;
+        }
+
+        curve_point_count++;
+        cur_str += chars_read;
+
+        if( *cur_str != ',' ) { break; }
+        cur_str++;
+    }
+
+    if( curve_point_count < 2 ) {
+
+        l( ERROR, "Error: PWM_FAN_CURVE_POINTS needs at least 2 \"temp_c:duty_cycle\" points!\n" );
+        config_invalid();
+        return;
+    }
+
+    fan->ctl.curve_point_count = curve_point_count;
+}
+
+// Compile the fan's curve into a lookup table with one entry per millidegree from
+//    min_off_temp_mc to max_temp_mc so per-tick evaluation is a single array load
+void curve_setup( Fan *fan ) {
+
+    CurveShapeFunc shape_func;
+
+    if( ! curve_shape_from_name( fan->curve, &shape_func ) ) {
+
+        l( ERROR, "Error: Unknown fan %i PWM_FAN_CURVE \"%s\"!\n", fan->idx, fan->curve );
+        config_invalid();
+        return;
+    }
+
+    if( shape_func == NULL ) { curve_points_parse( fan, fan->curve_points_str ); }
+
+    if( config_reload_rejected ) { return; }
+
+    if( fan->ctl.max_temp_mc <= fan->ctl.min_off_temp_mc ) {
+
+        l( ERROR, "Error: Fan %i MAX_TEMP_C must be greater than MIN_OFF_TEMP_C!\n", fan->idx );
+        config_invalid();
+        return;
+    }
+
+    if( ! curve_compile( &fan->ctl, shape_func ) ) {
+
+        l( ERROR, "Unable to allocate %u entry curve table!\n", fan->ctl.curve_table_size );
+        clean_up_and_exit( 1 );
+    }
+
+    l( DEBUG, "Compiled fan %i %s curve into %u entry lookup table (" MC_FMT "C - " MC_FMT "C)\n", fan->idx, fan->curve, fan->ctl.curve_table_size, MC_FMT_ARGS( fan->ctl.min_off_temp_mc ), MC_FMT_ARGS( fan->ctl.max_temp_mc ) );
+}
+
+// RPM for `pulse_count` pulses over `span_ns`, rounded
+unsigned int tach_rpm_from_pulses( Fan *fan, unsigned long long pulse_count, long long span_ns ) {
+
+    if( span_ns <= 0 || fan->tach_pulse_per_rev == 0 ) return 0;
+
+    // Pulses per minute / pulses per revolution
+    long long revs_period_ns = span_ns * fan->tach_pulse_per_rev;
+
+    return ( 60000000000LL * pulse_count + revs_period_ns / 2 ) / revs_period_ns;
+}
+
+// Publish a tachometer snapshot (polling thread only)
+void tach_publish( Fan *fan, unsigned int rpm, long long last_edge_ns, bool valid ) {
+
+    TachState *tach_state = &fan->tach_state;
+    unsigned int seq = atomic_load_explicit( &tach_state->seq, memory_order_relaxed );
+
+    atomic_store_explicit( &tach_state->seq, seq + 1, memory_order_relaxed );
+    atomic_thread_fence( memory_order_release );
+
+    atomic_store_explicit( &tach_state->rpm,          rpm,                   memory_order_relaxed );
+    atomic_store_explicit( &tach_state->pulse_count,  fan->tach_pulse_count, memory_order_relaxed );
+    atomic_store_explicit( &tach_state->last_edge_ns, last_edge_ns,          memory_order_relaxed );
+    atomic_store_explicit( &tach_state->valid,        valid,                 memory_order_relaxed );
+
+    atomic_store_explicit( &tach_state->seq, seq + 2, memory_order_release );
+}
+
+// Read a consistent tachometer snapshot without blocking the writer
+TachSnapshot tach_read_snapshot( Fan *fan ) {
+
+    TachState *tach_state = &fan->tach_state;
+    TachSnapshot snapshot;
+    unsigned int seq_begin, seq_end;
+
+    do {
+
+        seq_begin = atomic_load_explicit( &tach_state->seq, memory_order_acquire );
+
+        snapshot.rpm          = atomic_load_explicit( &tach_state->rpm,          memory_order_relaxed );
+        snapshot.pulse_count  = atomic_load_explicit( &tach_state->pulse_count,  memory_order_relaxed );
+        snapshot.last_edge_ns = atomic_load_explicit( &tach_state->last_edge_ns, memory_order_relaxed );
+        snapshot.valid        = atomic_load_explicit( &tach_state->valid,        memory_order_relaxed );
+
+        atomic_thread_fence( memory_order_acquire );
+        seq_end = atomic_load_explicit( &tach_state->seq, memory_order_relaxed );
+
+    } while( ( seq_begin & 1 ) || seq_begin != seq_end );
+
+    return snapshot;
+}
+
+// RPM averaged over all pulses since the previous call (main loop only)
+// - Falls back to the latest instantaneous RPM when no full pulse landed in the window, and
+//   reads 0 once the tach thread has flagged the fan as stopped
+unsigned int tach_window_rpm( Fan *fan ) {
+
+    TachSnapshot cur = tach_read_snapshot( fan );
+    unsigned int rpm;
+
+    if( ! cur.valid ) {
+
+        rpm = 0;
+
+    } else if( fan->tach_window_last.valid && cur.pulse_count > fan->tach_window_last.pulse_count ) {
+
+        rpm = tach_rpm_from_pulses( fan, cur.pulse_count - fan->tach_window_last.pulse_count, cur.last_edge_ns - fan->tach_window_last.last_edge_ns );
+
+    } else {
+
+        rpm = cur.rpm;
+    }
+
+    fan->tach_window_last = cur;
+
+    return rpm;
+}
+
+// Handler for tachometer pull-downs (ie: rotation pulses)
+// - `pulse_count` pulses ending at `edge_ns` (CLOCK_MONOTONIC) since the last handled edge;
+//   RPM is measured across the whole span so a batch of edges averages out jitter
+void on_tach_pull_down( Fan *fan, long long edge_ns, unsigned int pulse_count ) {
+
+    long long delta_time_ns = edge_ns - fan->tach_last_fall_ns;
+
+    fan->tach_last_fall_ns = edge_ns;
+
+    if( delta_time_ns <= 0 ) return;
+
+    fan->tach_pulse_count += pulse_count;
+
+    // The first edge after a stop only starts a new span, the time since the last edge before
+    //   the stop is not a rotation period
+    if( ! atomic_load_explicit( &fan->tach_state.valid, memory_order_relaxed ) ) {
+
+        tach_publish( fan, 0, edge_ns, true );
+        return;
+    }
+
+    tach_publish( fan, tach_rpm_from_pulses( fan, pulse_count, delta_time_ns ), edge_ns, true );
+}
+
+// Add a fan's tachometer file descriptor to the polling thread's set
+void tach_poll_add( Fan *fan, int fd, short events ) {
+
+    poll_tach_gpio[ poll_tach_count ].fd     = fd;
+    poll_tach_gpio[ poll_tach_count ].events = events;
+    poll_tach_fans[ poll_tach_count ]        = fan;
+
+    poll_tach_count++;
+}
+
+// Find the SoC GPIO controller character device by label, where line offsets are BCM GPIO #s
+bool tach_cdev_find_gpiochip( char *chip_path_str, size_t chip_path_size ) {
+
+    for( int i = 0; i < TACH_CDEV_MAX_CHIPS; i++ ) {
+
+        snprintf( chip_path_str, chip_path_size, "/dev/gpiochip%i", i );
+
+        int fd_chip = open( chip_path_str, O_RDONLY | O_CLOEXEC );
+
+        if( fd_chip < 0 ) { continue; }
+
+        struct gpiochip_info chip_info;
+        int ioctl_status = ioctl( fd_chip, GPIO_GET_CHIPINFO_IOCTL, &chip_info );
+
+        close( fd_chip );
+
+        if( ioctl_status != 0 ) { continue; }
+
+        for( size_t j = 0; j < sizeof( SOC_GPIO_LABELS ) / sizeof( SOC_GPIO_LABELS[0] ); j++ ) {
+
+            if( strcmp( chip_info.label, SOC_GPIO_LABELS[j] ) == 0 ) {
+
+                l( INFO, "Found SoC GPIO controller %s at %s!\n", chip_info.label, chip_path_str );
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Setup the tachometer on the GPIO v2 character device line event API
+// - Falling edge events carry CLOCK_MONOTONIC kernel timestamps and the kernel debounces the
+//   line, so there is no userspace timing or spurious pulse rejection
+void tach_cdev_setup( Fan *fan ) {
+
+    char chip_path_str[64];
+
+    l( INFO, "Tachometer support enabled on GPIO #%i via GPIO character device!\n", fan->bcm_gpio_pin_tach );
+
+    if( TACH_GPIOCHIP != NULL ) {
+
+        snprintf( chip_path_str, sizeof( chip_path_str ), "%s", TACH_GPIOCHIP );
+
+    } else if( ! tach_cdev_find_gpiochip( chip_path_str, sizeof( chip_path_str ) ) ) {
+
+        l( ERROR, "Unable to find the SoC GPIO controller character device; set PWM_FAN_TACH_GPIOCHIP!\n" );
+        clean_up_and_exit( 1 );
+    }
+
+    int fd_chip = open( chip_path_str, O_RDONLY | O_CLOEXEC );
+
+    if( fd_chip < 0 ) {
+
+        l( ERROR, "Failed to open GPIO chip %s, error: %s\n", chip_path_str, strerror( errno ) );
+        clean_up_and_exit( 1 );
+    }
+
+    struct gpio_v2_line_request line_request;
+    memset( &line_request, 0, sizeof( line_request ) );
+
+    line_request.offsets[0]        = fan->bcm_gpio_pin_tach;
+    line_request.num_lines         = 1;
+    line_request.event_buffer_size = TACH_CDEV_EVENT_BATCH * 4;
+    line_request.config.flags      = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+
+    snprintf( line_request.consumer, sizeof( line_request.consumer ), "pwm_fan_control2" );
+
+    if( TACH_DEBOUNCE_US > 0 ) {
+
+        line_request.config.num_attrs                        = 1;
+        line_request.config.attrs[0].attr.id                 = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+        line_request.config.attrs[0].attr.debounce_period_us = TACH_DEBOUNCE_US;
+        line_request.config.attrs[0].mask                    = 1;
+    }
+
+    int ioctl_status = ioctl( fd_chip, GPIO_V2_GET_LINE_IOCTL, &line_request );
+
+    close( fd_chip );
+
+    if( ioctl_status != 0 ) {
+
+        l( ERROR, "Failed to request GPIO line %i on %s, error: %s\n", fan->bcm_gpio_pin_tach, chip_path_str, strerror( errno ) );
+        clean_up_and_exit( 1 );
+    }
+
+    fan->fd_gpio_tach_line = line_request.fd;
+
+    // Setup polling file descriptor
+    tach_poll_add( fan, fan->fd_gpio_tach_line, POLLIN );
+
+    l( INFO, "Tachometer line %i requested on %s with %uus debounce!\n", fan->bcm_gpio_pin_tach, chip_path_str, TACH_DEBOUNCE_US );
+}
+
+// Read a batch of character device edge events; returns the # of pulses handled
+unsigned int tach_cdev_read_events( Fan *fan ) {
+
+    struct gpio_v2_line_event events[ TACH_CDEV_EVENT_BATCH ];
+
+    ssize_t len = read( fan->fd_gpio_tach_line, events, sizeof( events ) );
+
+    if( len < ( ssize_t ) sizeof( struct gpio_v2_line_event ) ) { return 0; }
+
+    unsigned int event_count = len / sizeof( struct gpio_v2_line_event );
+
+    on_tach_pull_down( fan, events[ event_count - 1 ].timestamp_ns, event_count );
+
+    return event_count;
+}
+
+// Setup the GPIO polling interrupt for the tachomter using the true GPIO number
+void setup_tach_gpio_interrupt( Fan *fan ) {
+
+    unsigned short true_gpio_num = fan->gpio_true_tach_num;
+
+    l( INFO, "Setting up GPIO polling interrupt on true GPIO #%i...\n", true_gpio_num );
+
+    char gpio_value_path[ SYSFS_PATH_MAX ];
+    sysfs_path( gpio_value_path, "/class/gpio/gpio%i/value", true_gpio_num );
+
+    fan->fd_gpio_tach_value = open( gpio_value_path, O_RDONLY | O_NONBLOCK );
+
+    if( fan->fd_gpio_tach_value < 0 ) {
+
+        l( ERROR, "Failed to open GPIO value file %s, error: %s\n", gpio_value_path, strerror( errno ) );
+        clean_up_and_exit( 1 );
+    }
+
+    // Dummy read to clear any initial value
+    char dumb_buffer[2];
+    read( fan->fd_gpio_tach_value, dumb_buffer, sizeof( dumb_buffer ) );
+
+    // Priority data (rising or rising edge)
+    short poll_events = POLLPRI;
+
+    // A fake backend exposes the value node as a FIFO with one byte written per edge; real
+    //    sysfs attributes always report POLLIN so it can only be used for the fake
+    struct stat gpio_value_stat;
+
+    if( fstat( fan->fd_gpio_tach_value, &gpio_value_stat ) == 0 && S_ISFIFO( gpio_value_stat.st_mode ) ) {
+
+        l( INFO, "GPIO value node is a FIFO; polling for fake tachometer edges...\n" );
+        poll_events = POLLIN;
+        fan->is_tach_value_fifo = true;
+    }
+
+    // Setup polling file descriptor
+    tach_poll_add( fan, fan->fd_gpio_tach_value, poll_events );
+
+    l( INFO, "GPIO polling interrupt setup on true GPIO #%i!\n", true_gpio_num );
+}
+
+// Setup the tachometer for measuring fan RPM
+void tach_gpio_setup( Fan *fan ) {
+
+    l( INFO, "Tachometer support enabled on GPIO #%i! Setting up pull-down event handler...\n", fan->bcm_gpio_pin_tach );
+
+    fan->gpio_true_tach_num = get_gpio_sysfs_num( LOOKUP_GPIO, fan->bcm_gpio_pin_tach );
+    l( INFO, "Tachometer true GPIO found: %i\n", fan->gpio_true_tach_num );
+
+    char gpio_active_low_path_str[ SYSFS_PATH_MAX ];
+    sysfs_path( gpio_active_low_path_str, "/class/gpio/gpio%i/active_low", fan->gpio_true_tach_num );
+
+    // An adopted GPIO has no unexport handle so it also stays exported at exit
+    if( ADOPT && access( gpio_active_low_path_str, F_OK ) == 0 ) {
+
+        l( INFO, "Adopting exported GPIO %i...\n", fan->gpio_true_tach_num );
+
+    } else {
+
+        // Ensure unloaded before we start
+        char gpio_unexport_path_str[ SYSFS_PATH_MAX ];
+        sysfs_path( gpio_unexport_path_str, "/class/gpio/unexport" );
+        open_fd( gpio_unexport_path_str, &fan->fd_gpio_tach_unexport, "w" );
+        gpio_set_export( fan, false );
+
+        // Setup file descriptors/handles for /sys/class control points
+        char gpio_export_path_str[ SYSFS_PATH_MAX ];
+        sysfs_path( gpio_export_path_str, "/class/gpio/export" );
+        open_fd( gpio_export_path_str, &fan->fd_gpio_tach_export, "w" );
+        gpio_set_export( fan, true );
+
+        // Wait for GPIO settings interface before continuing
+        wait_for_file_with_timeout( gpio_active_low_path_str, 5 );
+    }
+
+    open_fd( gpio_active_low_path_str, &fan->fd_gpio_tach_active_low, "w" );
+
+    char gpio_direction_path_str[ SYSFS_PATH_MAX ];
+    sysfs_path( gpio_direction_path_str, "/class/gpio/gpio%i/direction", fan->gpio_true_tach_num );
+    open_fd( gpio_direction_path_str, &fan->fd_gpio_tach_direction, "w" );
+
+    char gpio_edge_path_str[ SYSFS_PATH_MAX ];
+    sysfs_path( gpio_edge_path_str, "/class/gpio/gpio%i/edge", fan->gpio_true_tach_num );
+    open_fd( gpio_edge_path_str, &fan->fd_gpio_tach_edge, "w" );
+
+    l( INFO, "Setting active low to 0...\n" );
+
+    fprintf( fan->fd_gpio_tach_active_low, "0" );
+    fflush( fan->fd_gpio_tach_active_low );
+
+    l( INFO, "Active low set to 0! Setting direction to \"in\"...\n" );
+
+    fprintf( fan->fd_gpio_tach_direction, "in" );
+    fflush( fan->fd_gpio_tach_direction );
+
+    l( INFO, "Direction set to \"in\"! Setting edge to \"falling\"...\n" );
+
+    fprintf( fan->fd_gpio_tach_edge, "falling" );
+    fflush( fan->fd_gpio_tach_edge );
+
+    l( INFO, "Edge set to \"falling\"!\n" );
+
+    setup_tach_gpio_interrupt( fan );
+
+    l( INFO, "Tachometer support setup!\n" );
+}
+
+// Handle a tachometer edge for a sysfs GPIO value node
+void tach_sysfs_read_event( Fan *fan, int fd ) {
+
+    char dumb_buffer[64];
+    unsigned int pulse_count = 1;
+
+    // Reset the file pointer to read from the start
+    if( ! fan->is_tach_value_fifo ) { lseek( fd, 0, SEEK_SET ); }
+
+    // Read to clear the event; a FIFO's edges can queue up between polls, a byte each
+    ssize_t read_len = read( fd, dumb_buffer, sizeof( dumb_buffer ) );
+
+    if( read_len < 0 ) {
+
+        atomic_fetch_add_explicit( &metrics.sysfs_errors, 1, memory_order_relaxed );
+
+    } else if( fan->is_tach_value_fifo ) {
+
+        if( read_len == 0 ) { return; }
+
+        pulse_count = read_len;
+    }
+
+    // Update the last pulse time
+    fan->tach_last_pulse_ns = monotonic_ns();
+
+    // Reject spuriously short pulses, then calculate the RPM; a FIFO's edges are exact and a
+    //    batch of them spans its own time
+    if( fan->is_tach_value_fifo || fan->tach_last_pulse_ns - fan->tach_last_fall_ns >= TACH_MIN_TIME_DELTA_MS * 1000000LL ) {
+
+        on_tach_pull_down( fan, fan->tach_last_pulse_ns, pulse_count );
+
+    } else {
+
+        fan->tach_last_fall_ns = fan->tach_last_pulse_ns;
+    }
+}
+
+// Handle an edge on the tachometer at `poll_idx` in the polling set
+void tach_read_event( int poll_idx ) {
+
+    Fan *fan = poll_tach_fans[ poll_idx ];
+
+    if( tach_backend == TACH_BACKEND_CDEV ) {
+
+        // Kernel timestamped events; one read for the whole batch
+        if( tach_cdev_read_events( fan ) > 0 ) {
+
+            fan->tach_last_pulse_ns = monotonic_ns();
+        }
+
+    } else {
+
+        tach_sysfs_read_event( fan, poll_tach_gpio[ poll_idx ].fd );
+    }
+}
+
+// Publish the fan as stopped once the time since its last pulse exceeds RPM_TIMEOUT_MS
+void tach_check_stopped( Fan *fan ) {
+
+    long long time_since_last_pulse_ms = ( monotonic_ns() - fan->tach_last_pulse_ns ) / 1000000;
+
+    if( time_since_last_pulse_ms >= RPM_TIMEOUT_MS && atomic_load_explicit( &fan->tach_state.valid, memory_order_relaxed ) ) {
+
+        tach_publish( fan, 0, fan->tach_last_fall_ns, false );
+    }
+}
+
+// Track time since last pulse so we can detect 0 RPM; start as if a pulse just happened
+void tach_reset_last_pulse() {
+
+    for( int i = 0; i < poll_tach_count; i++ ) {
+
+        poll_tach_fans[i]->tach_last_pulse_ns = monotonic_ns();
+    }
+}
+
+// Is every polled fan published as stopped?
+bool tach_all_stopped() {
+
+    for( int i = 0; i < poll_tach_count; i++ ) {
+
+        if( atomic_load_explicit( &poll_tach_fans[i]->tach_state.valid, memory_order_relaxed ) ) { return false; }
+    }
+
+    return true;
+}
+
+// Polling thread function for the tachometer
+// - Uses own thread for independent polling loop to monitor for GPIO events on every fan
+void* polling_thread_tach_func(void* arg) {
+
+    ( void ) arg;
+
+    int poll_return;
+
+    tach_reset_last_pulse();
+
+    while( ! halt_received ) {
+
+        // Once every fan is published as stopped only an edge can change anything, so power
+        //    save parks until one arrives instead of checking every RPM_TIMEOUT_MS
+        int timeout_ms = POWER_SAVE && tach_all_stopped() ? -1 : RPM_TIMEOUT_MS;
+
+        // Wait for an event on any tachometer GPIO pin
+        poll_return = poll( poll_tach_gpio, poll_tach_count, timeout_ms );
+
+        for( int i = 0; i < poll_tach_count; i++ ) {
+
+            if( poll_return > 0 && poll_tach_gpio[i].revents & poll_tach_gpio[i].events ) {
+
+                tach_read_event( i );
+
+            } else {
+
+                // No edge on this fan (timeout, error or another fan's edge)
+                tach_check_stopped( poll_tach_fans[i] );
+            }
+        }
+    }
+
+    pthread_exit( NULL );
+}
+
+// Setup the tachometer polling thread
+void tach_polling_setup() {
+
+    int thread_create_status;
+
+    // Creating the polling thread
+    thread_create_status = pthread_create( &polling_thread_tach, NULL, polling_thread_tach_func, NULL );
+
+    if( thread_create_status != 0 ) {
+
+        l( ERROR, "Failed to create the polling thread\n" );
+        clean_up_and_exit( 1 );
+    }
+}
+
+// Stop the tachometer polling thread once halt_received is set
+void tach_polling_stop() {
+
+    l( INFO, "Waiting for tachometer polling thread to finish...\n" );
+
+    // A parked thread sleeps in poll without a timeout; the signal interrupts it
+    pthread_kill( polling_thread_tach, SIGINT );
+
+    pthread_join( polling_thread_tach, NULL );
+
+    l( INFO, "Tachometer polling thread to finished!\n" );
+}
+
+// Watch a file descriptor on the reactor; `idx` comes back with its events
+bool reactor_add( int fd, unsigned int events, int source, int idx ) {
+
+    // Optional sources are left at -1 when disabled
+    if( fd < 0 ) { return true; }
+
+    struct epoll_event event = { .events = events, .data.u64 = ( ( unsigned long long ) source << 32 ) | ( unsigned int ) idx };
+
+    if( epoll_ctl( fd_reactor, EPOLL_CTL_ADD, fd, &event ) != 0 ) {
+
+        l( ERROR, "Unable to add fd %i to the reactor: %s\n", fd, strerror( errno ) );
+        return false;
+    }
+
+    return true;
+}
+
+// Setup the reactor over the tick timer, thermal events, signals and tachometers
+// - Signals are blocked before any thread starts so every thread inherits the mask and they
+//   only ever arrive through the signalfd
+void reactor_setup() {
+
+    sigset_t signal_mask;
+
+    sigemptyset( &signal_mask );
+    sigaddset( &signal_mask, SIGINT );
+    sigaddset( &signal_mask, SIGTERM );
+    sigaddset( &signal_mask, SIGUSR1 );
+    sigaddset( &signal_mask, SIGHUP );
+
+    if( sigprocmask( SIG_BLOCK, &signal_mask, NULL ) != 0 ) {
+
+        l( ERROR, "Unable to block signals for the reactor: %s\n", strerror( errno ) );
+        clean_up_and_exit( 1 );
+    }
+
+    fd_signal  = signalfd( -1, &signal_mask, SFD_NONBLOCK | SFD_CLOEXEC );
+    fd_reactor = epoll_create1( EPOLL_CLOEXEC );
+
+    if( fd_signal < 0 || fd_reactor < 0 ) {
+
+        l( ERROR, "Unable to create the reactor: %s\n", strerror( errno ) );
+        clean_up_and_exit( 1 );
+    }
+
+    bool is_added = reactor_add( fd_tick_timer, EPOLLIN, REACTOR_TICK_TIMER, 0 ) &&
+                    reactor_add( fd_thermal_events, EPOLLIN, REACTOR_THERMAL_EVENTS, 0 ) &&
+                    reactor_add( fd_signal, EPOLLIN, REACTOR_SIGNAL, 0 ) &&
+                    reactor_add( fd_psi_trigger, EPOLLPRI, REACTOR_PSI_TRIGGER, 0 );
+
+    // Sysfs GPIO value nodes signal edges with POLLPRI and are otherwise always readable
+    for( int i = 0; is_added && i < poll_tach_count; i++ ) {
+
+        is_added = reactor_add( poll_tach_gpio[i].fd, poll_tach_gpio[i].events & POLLPRI ? EPOLLPRI : EPOLLIN, REACTOR_TACH, i );
+    }
+
+    if( ! is_added ) { clean_up_and_exit( 1 ); }
+
+    tach_reset_last_pulse();
+
+    l( INFO, "Reactor started; tick timer, tachometers and signals share one thread\n" );
+}
+
+// Push a telemetry sample for this tick (main loop only); never blocks, drops when full
+void telemetry_push( int temp_mc, int smooth_temp_mc, TickTiming *timing ) {
+
+    if( telemetry_format == TELEMETRY_OFF ) { return; }
+
+    // Downsample to every Nth tick
+    if( ++telemetry_skip < TELEMETRY_EVERY ) { return; }
+    telemetry_skip = 0;
+
+    unsigned int head = atomic_load_explicit( &telemetry_head, memory_order_relaxed );
+
+    if( head - atomic_load_explicit( &telemetry_tail, memory_order_acquire ) >= TELEMETRY_RING_SIZE ) {
+
+        telemetry_dropped++;
+        return;
+    }
+
+    TelemetrySample *sample = &telemetry_ring[ head % TELEMETRY_RING_SIZE ];
+
+    sample->t_ns            = timing->done_ns;
+    sample->temp_mc         = temp_mc;
+    sample->smooth_temp_mc  = smooth_temp_mc;
+    sample->latency_ns      = timing->done_ns - timing->deadline_ns;
+    sample->jitter_ns       = timing->start_ns > timing->deadline_ns ? timing->start_ns - timing->deadline_ns : 0;
+    sample->read_ns         = timing->read_ns - timing->start_ns;
+    sample->decide_ns       = timing->done_ns - timing->read_ns - timing->write_ns;
+    sample->write_ns        = timing->write_ns;
+    sample->deadline_misses = atomic_load_explicit( &scheduler_deadline_misses, memory_order_relaxed );
+    sample->sysfs_errors    = atomic_load_explicit( &metrics.sysfs_errors, memory_order_relaxed );
+
+    for( int i = 0; i < fan_count; i++ ) {
+
+        sample->mode[i]       = fans[i].ctl.decided_mode_int;
+        sample->duty_cycle[i] = fans[i].duty_cycle_applied;
+        sample->rpm[i]        = fans[i].tach_rpm;
+    }
+
+    atomic_store_explicit( &telemetry_head, head + 1, memory_order_release );
+
+    // Only a parked writer costs a syscall
+    if( atomic_exchange( &telemetry_is_parked, false ) ) { eventfd_write( fd_telemetry_wake, 1 ); }
+}
+
+// Write all of a buffer, retrying short writes; only ever blocks the writer thread
+void telemetry_write( const char *buffer, size_t len ) {
+
+    while( len > 0 ) {
+
+        ssize_t written = write( fd_telemetry, buffer, len );
+
+        if( written < 0 && errno == EINTR ) { continue; }
+
+        if( written <= 0 ) {
+
+            l( ERROR, "Unable to write telemetry: %s\n", strerror( errno ) );
+            return;
+        }
+
+        buffer += written;
+        len    -= written;
+    }
+}
+
+// Write the telemetry header; a single fan keeps the unprefixed CSV columns
+void telemetry_write_header() {
+
+    char header[ TELEMETRY_LINE_MAX ];
+    int len = 0;
+
+    if( telemetry_format == TELEMETRY_CSV ) {
+
+        len += snprintf( header + len, sizeof( header ) - len, "cur_temp_c" );
+
+        for( int i = 0; i < fan_count; i++ ) {
+
+            if( fan_count == 1 ) {
+
+                len += snprintf( header + len, sizeof( header ) - len, ",decided_mode,duty_cycle_set_val%s", fans[i].is_tach_enabled ? ",tach_rpm" : "" );
+
+            } else {
+
+                len += snprintf( header + len, sizeof( header ) - len, ",fan%i_decided_mode,fan%i_duty_cycle_set_val", i, i );
+
+                if( fans[i].is_tach_enabled ) { len += snprintf( header + len, sizeof( header ) - len, ",fan%i_tach_rpm", i ); }
+            }
+        }
+
+        len += snprintf( header + len, sizeof( header ) - len, ",t_ms,smooth_temp_c,latency_us,jitter_us,read_us,decide_us,write_us,deadline_misses,sysfs_errors\n" );
+
+    } else if( telemetry_format == TELEMETRY_BINARY ) {
+
+        // Magic, record version, fan count, record size
+        memcpy( header, "PFT1", 4 );
+        header[4] = 3;
+        header[5] = fan_count;
+        header[6] = sizeof( TelemetryRecord ) & 0xff;
+        header[7] = sizeof( TelemetryRecord ) >> 8;
+        len = 8;
+    }
+
+    if( len > 0 ) { telemetry_write( header, len ); }
+}
+
+// Format one sample into the buffer; returns the # of bytes
+int telemetry_format_sample( char *buffer, TelemetrySample *sample ) {
+
+    int len = 0;
+
+    if( telemetry_format == TELEMETRY_BINARY ) {
+
+        TelemetryRecord record;
+        memset( &record, 0, sizeof( record ) );
+
+        record.t_ns            = sample->t_ns;
+        record.temp_mc         = sample->temp_mc;
+        record.smooth_temp_mc  = sample->smooth_temp_mc;
+        record.latency_ns      = sample->latency_ns;
+        record.jitter_ns       = sample->jitter_ns;
+        record.read_ns         = sample->read_ns;
+        record.decide_ns       = sample->decide_ns;
+        record.write_ns        = sample->write_ns;
+        record.deadline_misses = sample->deadline_misses;
+        record.sysfs_errors    = sample->sysfs_errors;
+
+        for( int i = 0; i < fan_count; i++ ) {
+
+            record.fans[i].mode       = sample->mode[i];
+            record.fans[i].duty_cycle = sample->duty_cycle[i];
+            record.fans[i].rpm        = sample->rpm[i] > 0xffff ? 0xffff : sample->rpm[i];
+        }
+
+        memcpy( buffer, &record, sizeof( record ) );
+
+        return sizeof( record );
+    }
+
+    if( telemetry_format == TELEMETRY_CSV ) {
+
+        len += snprintf( buffer + len, TELEMETRY_LINE_MAX - len, MC_FMT, MC_FMT_ARGS( sample->temp_mc ) );
+
+        for( int i = 0; i < fan_count; i++ ) {
+
+            len += snprintf( buffer + len, TELEMETRY_LINE_MAX - len, ",%s,%i", get_fan_mode_str( sample->mode[i] ), sample->duty_cycle[i] );
+
+            if( fans[i].is_tach_enabled ) { len += snprintf( buffer + len, TELEMETRY_LINE_MAX - len, ",%u", sample->rpm[i] ); }
+        }
+
+        len += snprintf( buffer + len, TELEMETRY_LINE_MAX - len, ",%lli," MC_FMT ",%u,%u,%u,%u,%u,%u,%u\n",
+            sample->t_ns / 1000000, MC_FMT_ARGS( sample->smooth_temp_mc ), sample->latency_ns / 1000, sample->jitter_ns / 1000,
+            sample->read_ns / 1000, sample->decide_ns / 1000, sample->write_ns / 1000, sample->deadline_misses, sample->sysfs_errors );
+
+        return len;
+    }
+
+    len += snprintf( buffer + len, TELEMETRY_LINE_MAX - len,
+        "{\"t_ms\":%lli,\"temp_c\":" MC_FMT ",\"smooth_temp_c\":" MC_FMT ",\"latency_us\":%u,\"jitter_us\":%u,\"read_us\":%u,\"decide_us\":%u,\"write_us\":%u,\"deadline_misses\":%u,\"sysfs_errors\":%u,\"fans\":[",
+        sample->t_ns / 1000000, MC_FMT_ARGS( sample->temp_mc ), MC_FMT_ARGS( sample->smooth_temp_mc ), sample->latency_ns / 1000, sample->jitter_ns / 1000,
+        sample->read_ns / 1000, sample->decide_ns / 1000, sample->write_ns / 1000, sample->deadline_misses, sample->sysfs_errors );
+
+    for( int i = 0; i < fan_count; i++ ) {
+
+        len += snprintf( buffer + len, TELEMETRY_LINE_MAX - len, "%s{\"mode\":\"%s\",\"duty_cycle\":%i", i > 0 ? "," : "", get_fan_mode_str( sample->mode[i] ), sample->duty_cycle[i] );
+
+        if( fans[i].is_tach_enabled ) { len += snprintf( buffer + len, TELEMETRY_LINE_MAX - len, ",\"rpm\":%u", sample->rpm[i] ); }
+
+        len += snprintf( buffer + len, TELEMETRY_LINE_MAX - len, "}" );
+    }
+
+    len += snprintf( buffer + len, TELEMETRY_LINE_MAX - len, "]}\n" );
+
+    return len;
+}
+
+// Drain every queued sample with one write per full buffer; returns the # of samples
+unsigned int telemetry_drain() {
+
+    static char buffer[ TELEMETRY_BUFFER_SIZE ];
+    size_t len = 0;
+
+    unsigned int tail  = atomic_load_explicit( &telemetry_tail, memory_order_relaxed ),
+                 head  = atomic_load_explicit( &telemetry_head, memory_order_acquire ),
+                 count = head - tail;
+
+    for( ; tail != head; tail++ ) {
+
+        if( len + TELEMETRY_LINE_MAX > sizeof( buffer ) ) {
+
+            telemetry_write( buffer, len );
+            len = 0;
+        }
+
+        len += telemetry_format_sample( buffer + len, &telemetry_ring[ tail % TELEMETRY_RING_SIZE ] );
+
+        // Hand the slot back as soon as it is formatted
+        atomic_store_explicit( &telemetry_tail, tail + 1, memory_order_release );
+    }
+
+    if( len > 0 ) { telemetry_write( buffer, len ); }
+
+    return count;
+}
+
+// Telemetry writer thread; drains the ring in batches until halt, then once more
+// - Parks on the eventfd once the ring is empty, so slow or idle ticks don't wake it every
+//   TELEMETRY_FLUSH_MS
+void* telemetry_thread_func( void* arg ) {
+
+    ( void ) arg;
+
+    struct timespec flush_ts = { 0, TELEMETRY_FLUSH_MS * 1000000L };
+    eventfd_t wake_count;
+
+    while( ! halt_received ) {
+
+        if( telemetry_drain() > 0 ) {
+
+            nanosleep( &flush_ts, NULL );
+            continue;
+        }
+
+        atomic_store( &telemetry_is_parked, true );
+
+        // A sample pushed before the flag was set won't wake it
+        if( atomic_load( &telemetry_head ) == atomic_load_explicit( &telemetry_tail, memory_order_relaxed ) ) {
+
+            eventfd_read( fd_telemetry_wake, &wake_count );
+        }
+
+        atomic_store( &telemetry_is_parked, false );
+    }
+
+    telemetry_drain();
+
+    pthread_exit( NULL );
+}
+
+// Open the telemetry output and write its header; the daemon appends so restarts keep
+//    earlier runs, while `is_truncate` starts the file over (replay)
+void telemetry_open( bool is_truncate ) {
+
+    if( strcmp( TELEMETRY_FILE, "-" ) == 0 ) {
+
+        fd_telemetry = STDOUT_FILENO;
+
+    } else {
+
+        fd_telemetry = open( TELEMETRY_FILE, O_WRONLY | O_CREAT | ( is_truncate ? O_TRUNC : O_APPEND ) | O_CLOEXEC, 0644 );
+
+        if( fd_telemetry < 0 ) {
+
+            l( ERROR, "Unable to open telemetry file %s: %s\n", TELEMETRY_FILE, strerror( errno ) );
+            clean_up_and_exit( 1 );
+        }
+    }
+
+    telemetry_write_header();
+}
+
+// Open the telemetry output and start the writer thread
+void telemetry_setup() {
+
+    if( telemetry_format == TELEMETRY_OFF ) { return; }
+
+    telemetry_open( false );
+
+    fd_telemetry_wake = eventfd( 0, EFD_CLOEXEC );
+
+    if( fd_telemetry_wake < 0 ) {
+
+        l( ERROR, "Unable to create the telemetry eventfd: %s\n", strerror( errno ) );
+        clean_up_and_exit( 1 );
+    }
+
+    if( pthread_create( &telemetry_thread, NULL, telemetry_thread_func, NULL ) != 0 ) {
+
+        l( ERROR, "Failed to create the telemetry thread\n" );
+        clean_up_and_exit( 1 );
+    }
+}
+
+// Publish this tick's metrics and stage timing (main loop only); a handful of relaxed
+//    stores, no syscalls
+// - Residency adds the time until the next tick to each fan's current mode
+void metrics_record_tick( int temp_mc, int smooth_temp_mc, TickTiming *timing, unsigned int next_sleep_ms ) {
+
+    atomic_store_explicit( &metrics.temp_mc,        temp_mc,        memory_order_relaxed );
+    atomic_store_explicit( &metrics.smooth_temp_mc, smooth_temp_mc, memory_order_relaxed );
+    atomic_fetch_add_explicit( &metrics.ticks, 1, memory_order_relaxed );
+
+    for( int i = 0; i < fan_count; i++ ) {
+
+        atomic_store_explicit( &metrics.duty_cycle[i], fans[i].duty_cycle_applied, memory_order_relaxed );
+        atomic_store_explicit( &metrics.rpm[i],        fans[i].tach_rpm,           memory_order_relaxed );
+        atomic_store_explicit( &metrics.mode[i],       fans[i].ctl.decided_mode_int,   memory_order_relaxed );
+        atomic_store_explicit( &metrics.health[i],     fans[i].health,             memory_order_relaxed );
+        atomic_fetch_add_explicit( &metrics.mode_ms[i][ fans[i].ctl.decided_mode_int ], next_sleep_ms, memory_order_relaxed );
+    }
+
+    metrics_observe( &metrics.loop_latency,  timing->done_ns - timing->deadline_ns );
+    metrics_observe( &metrics.wakeup_jitter, timing->start_ns - timing->deadline_ns );
+    metrics_observe( &metrics.stage_read,    timing->read_ns - timing->start_ns );
+    metrics_observe( &metrics.stage_decide,  timing->done_ns - timing->read_ns - timing->write_ns );
+    metrics_observe( &metrics.stage_write,   timing->write_ns );
+}
+
+// Format a histogram in Prometheus text format in seconds
+int metrics_format_histogram( char *buffer, size_t buffer_size, const char *name, const char *help, MetricsHistogram *histogram ) {
+
+    static const unsigned int bounds_us[] = METRICS_BUCKETS_US;
+    unsigned long long cumulative = 0;
+    int len = 0;
+
+    len += snprintf( buffer + len, buffer_size - len, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name );
+
+    for( int i = 0; i < METRICS_BUCKET_COUNT - 1; i++ ) {
+
+        cumulative += atomic_load_explicit( &histogram->buckets[i], memory_order_relaxed );
+        len += snprintf( buffer + len, buffer_size - len, "%s_bucket{le=\"%u.%06u\"} %llu\n", name, bounds_us[i] / 1000000, bounds_us[i] % 1000000, cumulative );
+    }
+
+    cumulative += atomic_load_explicit( &histogram->buckets[ METRICS_BUCKET_COUNT - 1 ], memory_order_relaxed );
+
+    unsigned long long sum_ns = atomic_load_explicit( &histogram->sum_ns, memory_order_relaxed );
+
+    len += snprintf( buffer + len, buffer_size - len, "%s_bucket{le=\"+Inf\"} %llu\n", name, cumulative );
+    len += snprintf( buffer + len, buffer_size - len, "%s_sum %llu.%09llu\n", name, sum_ns / 1000000000ULL, sum_ns % 1000000000ULL );
+    len += snprintf( buffer + len, buffer_size - len, "%s_count %llu\n", name, cumulative );
+
+    return len;
+}
+
+// Format the metrics snapshot in Prometheus text format; returns the # of bytes
+int metrics_format( char *buffer, size_t buffer_size ) {
+
+    int len = 0;
+    int temp_mc        = atomic_load_explicit( &metrics.temp_mc,        memory_order_relaxed ),
+        smooth_temp_mc = atomic_load_explicit( &metrics.smooth_temp_mc, memory_order_relaxed );
+
+    len += snprintf( buffer + len, buffer_size - len,
+        "# HELP pwm_fan_cpu_temp_celsius CPU temp at the last tick.\n"
+        "# TYPE pwm_fan_cpu_temp_celsius gauge\n"
+        "pwm_fan_cpu_temp_celsius %s%i.%03i\n"
+        "# HELP pwm_fan_smoothed_temp_celsius Smoothed CPU temp the curve/PID used at the last tick.\n"
+        "# TYPE pwm_fan_smoothed_temp_celsius gauge\n"
+        "pwm_fan_smoothed_temp_celsius %s%i.%03i\n"
+        "# HELP pwm_fan_ticks_total Control ticks run.\n"
+        "# TYPE pwm_fan_ticks_total counter\n"
+        "pwm_fan_ticks_total %llu\n"
+        "# HELP pwm_fan_deadline_misses_total Ticks that started after their scheduled deadline had passed.\n"
+        "# TYPE pwm_fan_deadline_misses_total counter\n"
+        "pwm_fan_deadline_misses_total %lu\n"
+        "# HELP pwm_fan_sysfs_errors_total Failed or invalid sysfs reads and writes.\n"
+        "# TYPE pwm_fan_sysfs_errors_total counter\n"
+        "pwm_fan_sysfs_errors_total %lu\n"
+        "# HELP pwm_fan_wakeups_total Voluntary context switches of every thread; each is a sleep that ended.\n"
+        "# TYPE pwm_fan_wakeups_total counter\n"
+        "pwm_fan_wakeups_total %lu\n",
+        temp_mc < 0 ? "-" : "", abs( temp_mc ) / 1000, abs( temp_mc ) % 1000,
+        smooth_temp_mc < 0 ? "-" : "", abs( smooth_temp_mc ) / 1000, abs( smooth_temp_mc ) % 1000,
+        atomic_load_explicit( &metrics.ticks, memory_order_relaxed ),
+        atomic_load_explicit( &scheduler_deadline_misses, memory_order_relaxed ),
+        atomic_load_explicit( &metrics.sysfs_errors, memory_order_relaxed ),
+        process_wakeups() );
+
+    len += snprintf( buffer + len, buffer_size - len, "# HELP pwm_fan_duty_cycle_percent Duty cycle written at the last tick, including full duty holds.\n# TYPE pwm_fan_duty_cycle_percent gauge\n" );
+
+    for( int i = 0; i < fan_count; i++ ) {
+
+        len += snprintf( buffer + len, buffer_size - len, "pwm_fan_duty_cycle_percent{fan=\"%i\"} %u\n", i, atomic_load_explicit( &metrics.duty_cycle[i], memory_order_relaxed ) );
+    }
+
+    if( FEEDFORWARD ) {
+
+        unsigned int load_permille = atomic_load_explicit( &metrics.load_permille, memory_order_relaxed );
+        int ff_offset_mc           = atomic_load_explicit( &metrics.ff_offset_mc,  memory_order_relaxed );
+
+        len += snprintf( buffer + len, buffer_size - len,
+            "# HELP pwm_fan_cpu_load_ratio CPU load feed-forward saw at the last tick, weighted by frequency when available.\n"
+            "# TYPE pwm_fan_cpu_load_ratio gauge\n"
+            "pwm_fan_cpu_load_ratio %u.%03u\n"
+            "# HELP pwm_fan_feedforward_celsius Lead feed-forward added to the control temp at the last tick.\n"
+            "# TYPE pwm_fan_feedforward_celsius gauge\n"
+            "pwm_fan_feedforward_celsius %s%i.%03i\n",
+            load_permille / 1000, load_permille % 1000,
+            ff_offset_mc < 0 ? "-" : "", abs( ff_offset_mc ) / 1000, abs( ff_offset_mc ) % 1000 );
+    }
+
+    if( fd_peer_publish >= 0 || fd_peer_listen >= 0 ) {
+
+        len += snprintf( buffer + len, buffer_size - len,
+            "# HELP pwm_fan_peers Shared chassis peers heard from, by whether their last sample is within the timeout.\n"
+            "# TYPE pwm_fan_peers gauge\n"
+            "pwm_fan_peers{state=\"fresh\"} %u\n"
+            "pwm_fan_peers{state=\"stale\"} %u\n"
+            "# HELP pwm_fan_peer_datagrams_total Shared chassis temp datagrams by result.\n"
+            "# TYPE pwm_fan_peer_datagrams_total counter\n"
+            "pwm_fan_peer_datagrams_total{result=\"sent\"} %lu\n"
+            "pwm_fan_peer_datagrams_total{result=\"send_failed\"} %lu\n"
+            "pwm_fan_peer_datagrams_total{result=\"received\"} %lu\n"
+            "pwm_fan_peer_datagrams_total{result=\"rejected\"} %lu\n",
+            atomic_load_explicit( &metrics.peers_fresh,      memory_order_relaxed ),
+            atomic_load_explicit( &metrics.peers_stale,      memory_order_relaxed ),
+            atomic_load_explicit( &metrics.peer_sent,        memory_order_relaxed ),
+            atomic_load_explicit( &metrics.peer_send_failed, memory_order_relaxed ),
+            atomic_load_explicit( &metrics.peer_received,    memory_order_relaxed ),
+            atomic_load_explicit( &metrics.peer_rejected,    memory_order_relaxed ) );
+    }
+
+    if( is_tach_enabled ) {
+
+        len += snprintf( buffer + len, buffer_size - len, "# HELP pwm_fan_rpm Fan RPM averaged over the last tick.\n# TYPE pwm_fan_rpm gauge\n" );
+
+        for( int i = 0; i < fan_count; i++ ) {
+
+            if( ! fans[i].is_tach_enabled ) { continue; }
+
+            len += snprintf( buffer + len, buffer_size - len, "pwm_fan_rpm{fan=\"%i\"} %u\n", i, atomic_load_explicit( &metrics.rpm[i], memory_order_relaxed ) );
+        }
+
+        len += snprintf( buffer + len, buffer_size - len, "# HELP pwm_fan_health Fan health from stall detection (1 for the current state).\n# TYPE pwm_fan_health gauge\n" );
+
+        for( int i = 0; i < fan_count; i++ ) {
+
+            if( ! fans[i].is_tach_enabled ) { continue; }
+
+            unsigned int health = atomic_load_explicit( &metrics.health[i], memory_order_relaxed );
+
+            for( int j = 0; j < FAN_HEALTH_COUNT; j++ ) {
+
+                len += snprintf( buffer + len, buffer_size - len, "pwm_fan_health{fan=\"%i\",state=\"%s\"} %i\n", i, get_fan_health_str( j ), health == ( unsigned int ) j );
+            }
+        }
+    }
+
+    len += snprintf( buffer + len, buffer_size - len, "# HELP pwm_fan_mode Current fan mode (1 for the active mode).\n# TYPE pwm_fan_mode gauge\n" );
+
+    for( int i = 0; i < fan_count; i++ ) {
+
+        unsigned int mode = atomic_load_explicit( &metrics.mode[i], memory_order_relaxed );
+
+        for( int j = 0; j < FAN_MODE_COUNT; j++ ) {
+
+            len += snprintf( buffer + len, buffer_size - len, "pwm_fan_mode{fan=\"%i\",mode=\"%s\"} %i\n", i, get_fan_mode_str( j ), mode == ( unsigned int ) j );
+        }
+    }
+
+    len += snprintf( buffer + len, buffer_size - len, "# HELP pwm_fan_mode_seconds_total Time spent in each fan mode.\n# TYPE pwm_fan_mode_seconds_total counter\n" );
+
+    for( int i = 0; i < fan_count; i++ ) {
+
+        for( int j = 0; j < FAN_MODE_COUNT; j++ ) {
+
+            unsigned long long mode_ms = atomic_load_explicit( &metrics.mode_ms[i][j], memory_order_relaxed );
+
+            len += snprintf( buffer + len, buffer_size - len, "pwm_fan_mode_seconds_total{fan=\"%i\",mode=\"%s\"} %llu.%03llu\n", i, get_fan_mode_str( j ), mode_ms / 1000, mode_ms % 1000 );
+        }
+    }
+
+    len += snprintf( buffer + len, buffer_size - len, "# HELP pwm_fan_pwm_writes_total Duty cycle writes by result.\n# TYPE pwm_fan_pwm_writes_total counter\n" );
+
+    for( int i = 0; i < fan_count; i++ ) {
+
+        len += snprintf( buffer + len, buffer_size - len, "pwm_fan_pwm_writes_total{fan=\"%i\",result=\"written\"} %lu\n", i, atomic_load_explicit( &fans[i].pwm_duty_cycle_writes, memory_order_relaxed ) );
+        len += snprintf( buffer + len, buffer_size - len, "pwm_fan_pwm_writes_total{fan=\"%i\",result=\"skipped\"} %lu\n", i, atomic_load_explicit( &fans[i].pwm_duty_cycle_writes_skipped, memory_order_relaxed ) );
+    }
+
+    len += metrics_format_histogram( buffer + len, buffer_size - len, "pwm_fan_loop_latency_seconds", "Tick deadline to duty cycles written.", &metrics.loop_latency );
+    len += metrics_format_histogram( buffer + len, buffer_size - len, "pwm_fan_wakeup_jitter_seconds", "Tick deadline to the loop waking up.", &metrics.wakeup_jitter );
+    len += metrics_format_histogram( buffer + len, buffer_size - len, "pwm_fan_temp_read_seconds", "CPU temp read and smoothing per tick.", &metrics.stage_read );
+    len += metrics_format_histogram( buffer + len, buffer_size - len, "pwm_fan_decide_seconds", "Fan decisions per tick, excluding PWM writes.", &metrics.stage_decide );
+    len += metrics_format_histogram( buffer + len, buffer_size - len, "pwm_fan_pwm_write_seconds", "PWM duty cycle writes per tick.", &metrics.stage_write );
+
+    return len < ( int ) buffer_size ? len : ( int ) buffer_size - 1;
+}
+
+// Build the response to a scrape's request into `response` and point `out` at it; HTTP GETs
+//    get an HTTP response, anything else (ie: `nc -U`) or no request at all plain text
+int metrics_respond( const char *request, ssize_t request_len, char *response, int response_size, char **out ) {
+
+    bool is_http = request_len >= 4 && strncmp( request, "GET ", 4 ) == 0;
+
+    // Leave room ahead of the body for the HTTP header
+    int body_offset = is_http ? 128 : 0;
+    int body_len    = metrics_format( response + body_offset, response_size - body_offset );
+
+    *out = response + body_offset;
+
+    if( ! is_http ) { return body_len; }
+
+    char header[128];
+    int header_len = snprintf( header, sizeof( header ), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %i\r\n\r\n", body_len );
+
+    *out -= header_len;
+    memcpy( *out, header, header_len );
+
+    return header_len + body_len;
+}
+
+// Serve one scrape on the metrics thread; waits up to METRICS_REQUEST_WAIT_MS for the request
+void metrics_serve( int fd_client ) {
+
+    static char response[ METRICS_RESPONSE_SIZE ];
+    char request[ METRICS_REQUEST_SIZE ];
+    ssize_t request_len = 0;
+    char *out;
+
+    struct pollfd poll_client = { fd_client, POLLIN, 0 };
+
+    if( poll( &poll_client, 1, METRICS_REQUEST_WAIT_MS ) > 0 ) {
+
+        request_len = recv( fd_client, request, sizeof( request ) - 1, 0 );
+    }
+
+    int out_len = metrics_respond( request, request_len, response, sizeof( response ), &out );
+
+    // A stalled client must not wedge the metrics thread for more than METRICS_SEND_TIMEOUT_MS
+    //    in total
+    long long send_deadline_ns = monotonic_ns() + METRICS_SEND_TIMEOUT_MS * 1000000LL;
+
+    while( out_len > 0 ) {
+
+        ssize_t written = send( fd_client, out, out_len, MSG_NOSIGNAL | MSG_DONTWAIT );
+
+        if( written < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) ) {
+
+            long long remaining_ms = ( send_deadline_ns - monotonic_ns() ) / 1000000;
+            struct pollfd poll_send = { fd_client, POLLOUT, 0 };
+
+            if( remaining_ms <= 0 || poll( &poll_send, 1, remaining_ms ) <= 0 ) { break; }
+
+            continue;
+        }
+
+        if( written <= 0 ) { break; }
+
+        out     += written;
+        out_len -= written;
+    }
+}
+
+// Metrics thread; sleeps in poll until a scrape connects so it costs nothing between scrapes
+void* metrics_thread_func( void* arg ) {
+
+    ( void ) arg;
+
+    struct pollfd poll_fds[2] = {
+        { fd_metrics_unix, POLLIN, 0 },
+        { fd_metrics_tcp,  POLLIN, 0 }
+    };
+
+    while( ! halt_received ) {
+
+        if( poll( poll_fds, 2, -1 ) <= 0 ) { continue; }
+
+        for( int i = 0; i < 2; i++ ) {
+
+            if( ! ( poll_fds[i].revents & POLLIN ) ) { continue; }
+
+            int fd_client = accept( poll_fds[i].fd, NULL, NULL );
+
+            if( fd_client < 0 ) { continue; }
+
+            metrics_serve( fd_client );
+            close( fd_client );
+        }
+    }
+
+    pthread_exit( NULL );
+}
+
+// Open the metrics listening sockets and start the serving thread
+void metrics_setup() {
+
+    if( METRICS_SOCKET[0] != '\0' ) {
+
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+        if( strlen( METRICS_SOCKET ) >= sizeof( addr.sun_path ) ) {
+
+            l( ERROR, "PWM_FAN_METRICS_SOCKET path is too long: %s\n", METRICS_SOCKET );
+            clean_up_and_exit( 1 );
+        }
+
+        strcpy( addr.sun_path, METRICS_SOCKET );
+
+        // A stale socket from an unclean exit would fail the bind
+        unlink( METRICS_SOCKET );
+
+        fd_metrics_unix = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+
+        if( fd_metrics_unix < 0 || bind( fd_metrics_unix, ( struct sockaddr* ) &addr, sizeof( addr ) ) != 0 || listen( fd_metrics_unix, 8 ) != 0 ) {
+
+            l( ERROR, "Unable to listen on metrics socket %s: %s\n", METRICS_SOCKET, strerror( errno ) );
+            clean_up_and_exit( 1 );
+        }
+
+        l( INFO, "Serving metrics on unix:%s\n", METRICS_SOCKET );
+    }
+
+    if( METRICS_PORT > 0 ) {
+
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons( METRICS_PORT ), .sin_addr.s_addr = htonl( INADDR_LOOPBACK ) };
+        int reuse_addr = 1;
+
+        fd_metrics_tcp = socket( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+
+        if( fd_metrics_tcp >= 0 ) { setsockopt( fd_metrics_tcp, SOL_SOCKET, SO_REUSEADDR, &reuse_addr, sizeof( reuse_addr ) ); }
+
+        if( fd_metrics_tcp < 0 || bind( fd_metrics_tcp, ( struct sockaddr* ) &addr, sizeof( addr ) ) != 0 || listen( fd_metrics_tcp, 8 ) != 0 ) {
+
+            l( ERROR, "Unable to listen on metrics port 127.0.0.1:%i: %s\n", METRICS_PORT, strerror( errno ) );
+            clean_up_and_exit( 1 );
+        }
+
+        l( INFO, "Serving metrics on http://127.0.0.1:%i/metrics\n", METRICS_PORT );
+    }
+
+    if( fd_metrics_unix < 0 && fd_metrics_tcp < 0 ) { return; }
+
+    // The reactor accepts scrapes on the control thread instead
+    if( REACTOR ) {
+
+        if( ! reactor_add( fd_metrics_unix, EPOLLIN, REACTOR_METRICS_LISTEN, fd_metrics_unix ) ||
+            ! reactor_add( fd_metrics_tcp,  EPOLLIN, REACTOR_METRICS_LISTEN, fd_metrics_tcp ) ) {
+
+            clean_up_and_exit( 1 );
+        }
+
+        return;
+    }
+
+    if( pthread_create( &metrics_thread, NULL, metrics_thread_func, NULL ) != 0 ) {
+
+        l( ERROR, "Failed to create the metrics thread\n" );
+        clean_up_and_exit( 1 );
+    }
+
+    // Blocked in poll/accept without a timeout so it is never joined; exit tears it down
+    pthread_detach( metrics_thread );
+}
+
+// Accept a scrape onto the reactor; it's served once the request is readable, or after
+//    METRICS_REQUEST_WAIT_MS without one like the metrics thread does
+void reactor_metrics_accept( int fd_listen ) {
+
+    int fd_client = accept( fd_listen, NULL, NULL );
+
+    if( fd_client < 0 ) { return; }
+
+    int slot = 0;
+
+    while( slot < METRICS_REACTOR_CLIENTS && metrics_clients[ slot ].is_active ) { slot++; }
+
+    // Left in the backlog it would keep the listening socket readable
+    if( slot == METRICS_REACTOR_CLIENTS ) {
+
+        l( DEBUG, "Too many metrics clients; closing a new one unanswered\n" );
+        close( fd_client );
+        return;
+    }
+
+    fcntl( fd_client, F_SETFL, fcntl( fd_client, F_GETFL ) | O_NONBLOCK );
+
+    if( ! reactor_add( fd_client, EPOLLIN | EPOLLRDHUP, REACTOR_METRICS_CLIENT, slot ) ) {
+
+        close( fd_client );
+        return;
+    }
+
+    MetricsClient *client = &metrics_clients[ slot ];
+
+    client->is_active   = true;
+    client->fd          = fd_client;
+    client->deadline_ns = monotonic_ns() + METRICS_REQUEST_WAIT_MS * 1000000LL;
+    client->out_len     = 0;
+}
+
+// Close a reactor scrape; closing also drops it from the epoll set
+void reactor_metrics_close( MetricsClient *client ) {
+
+    close( client->fd );
+    client->is_active = false;
+}
+
+// Send as much of the response as the socket takes without blocking; true once it's all out
+//    or the client is gone
+bool reactor_metrics_send( MetricsClient *client ) {
+
+    while( client->out_len > 0 ) {
+
+        ssize_t written = send( client->fd, client->out, client->out_len, MSG_NOSIGNAL | MSG_DONTWAIT );
+
+        if( written < 0 && errno == EINTR ) { continue; }
+
+        if( written < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) { return false; }
+
+        if( written <= 0 ) { return true; }
+
+        client->out     += written;
+        client->out_len -= written;
+    }
+
+    return true;
+}
+
+// Answer a reactor scrape; a full socket waits for EPOLLOUT, up to METRICS_SEND_TIMEOUT_MS
+void reactor_metrics_respond( MetricsClient *client, const char *request, ssize_t request_len ) {
+
+    client->out_len = metrics_respond( request, request_len, client->response, sizeof( client->response ), &client->out );
+
+    if( reactor_metrics_send( client ) ) {
+
+        reactor_metrics_close( client );
+        return;
+    }
+
+    struct epoll_event event = { .events = EPOLLOUT, .data.u64 = ( ( unsigned long long ) REACTOR_METRICS_CLIENT << 32 ) | ( unsigned int ) ( client - metrics_clients ) };
+
+    client->deadline_ns = monotonic_ns() + METRICS_SEND_TIMEOUT_MS * 1000000LL;
+
+    if( epoll_ctl( fd_reactor, EPOLL_CTL_MOD, client->fd, &event ) != 0 ) {
+
+        reactor_metrics_close( client );
+    }
+}
+
+// Handle a reactor scrape's event; the request once readable, then the rest of the response
+//    each time the socket has room
+void reactor_metrics_client_event( int slot ) {
+
+    MetricsClient *client = &metrics_clients[ slot ];
+
+    // Expired earlier in the same batch of events
+    if( ! client->is_active ) { return; }
+
+    if( client->out_len > 0 ) {
+
+        if( reactor_metrics_send( client ) ) { reactor_metrics_close( client ); }
+
+        return;
+    }
+
+    char request[ METRICS_REQUEST_SIZE ];
+    ssize_t request_len = recv( client->fd, request, sizeof( request ) - 1, 0 );
+
+    reactor_metrics_respond( client, request, request_len );
+}
+
+// Answer reactor scrapes that never sent a request, and close ones that stopped reading
+void reactor_metrics_expire( long long now_ns ) {
+
+    for( int i = 0; i < METRICS_REACTOR_CLIENTS; i++ ) {
+
+        MetricsClient *client = &metrics_clients[i];
+
+        if( ! client->is_active || now_ns < client->deadline_ns ) { continue; }
+
+        if( client->out_len > 0 ) {
+
+            reactor_metrics_close( client );
+
+        } else {
+
+            reactor_metrics_respond( client, NULL, 0 );
+        }
+    }
+}
+
+// Reactor wait timeout; the power save tick deadline or the soonest scrape deadline
+int reactor_wait_timeout_ms() {
+
+    int timeout_ms = scheduler_wait_timeout_ms();
+    long long now_ns = monotonic_ns();
+
+    for( int i = 0; i < METRICS_REACTOR_CLIENTS; i++ ) {
+
+        if( ! metrics_clients[i].is_active ) { continue; }
+
+        long long remaining_ns = metrics_clients[i].deadline_ns - now_ns;
+        int client_timeout_ms  = remaining_ns > 0 ? ( remaining_ns + 999999 ) / 1000000 : 0;
+
+        if( timeout_ms < 0 || client_timeout_ms < timeout_ms ) { timeout_ms = client_timeout_ms; }
+    }
+
+    return timeout_ms;
+}
+
+// Read pending signals off the signalfd; true when one needs the main loop now
+bool reactor_read_signals() {
+
+    struct signalfd_siginfo signal_info;
+    bool is_tick_due = false;
+
+    while( read( fd_signal, &signal_info, sizeof( signal_info ) ) == sizeof( signal_info ) ) {
+
+        if( signal_info.ssi_signo == SIGUSR1 ) {
+
+            metrics_log_stats();
+
+        } else if( signal_info.ssi_signo == SIGHUP ) {
+
+            // Reload on a tick started now
+            reload_config_received = 1;
+            next_tick_deadline_ns  = monotonic_ns();
+            is_tick_due            = true;
+
+        } else {
+
+            halt_received = 1;
+            is_tick_due   = true;
+        }
+    }
+
+    return is_tick_due;
+}
+
+// Dispatch reactor events for up to `timeout_ms` (-1 to block); true once the next tick is due
+bool reactor_dispatch( int timeout_ms ) {
+
+    struct epoll_event events[ REACTOR_MAX_EVENTS ];
+    bool is_tick_due = false;
+
+    int event_count = epoll_wait( fd_reactor, events, REACTOR_MAX_EVENTS, timeout_ms );
+
+    if( event_count < 0 ) {
+
+        if( errno == EINTR ) { return false; }
+
+        // Fall back to ticking rather than spinning on a broken epoll instance
+        l( ERROR, "Reactor wait failed: %s\n", strerror( errno ) );
+        return true;
+    }
+
+    for( int i = 0; i < event_count; i++ ) {
+
+        int source = events[i].data.u64 >> 32;
+        int idx    = ( int ) ( events[i].data.u64 & 0xffffffff );
+
+        switch( source ) {
+
+            case REACTOR_TICK_TIMER:
+                tick_timer_drain();
+                is_tick_due = true;
+                break;
+
+            case REACTOR_THERMAL_EVENTS:
+                thermal_events_drain();
+                is_tick_due = true;
+                break;
+
+            case REACTOR_PSI_TRIGGER:
+                psi_trigger_drain();
+                is_tick_due = true;
+                break;
+
+            case REACTOR_CONFIG_WATCH:
+                config_watch_drain();
+                if( reload_config_received ) { is_tick_due = true; }
+                break;
+
+            case REACTOR_SIGNAL:
+                if( reactor_read_signals() ) { is_tick_due = true; }
+                break;
+
+            case REACTOR_TACH:
+                tach_read_event( idx );
+                break;
+
+            case REACTOR_METRICS_LISTEN:
+                reactor_metrics_accept( idx );
+                break;
+
+            case REACTOR_METRICS_CLIENT:
+                reactor_metrics_client_event( idx );
+                break;
+        }
+    }
+
+    reactor_metrics_expire( monotonic_ns() );
+
+    // A wait times out at the power save tick deadline, or at a scrape deadline which doesn't
+    //    tick
+    if( event_count == 0 ) { return scheduler_wait_timeout_ms() == 0; }
+
+    return is_tick_due;
+}
+
+// Handle reactor events until the next tick deadline, an early wakeup or a halt
+void reactor_wait_for_next_tick( unsigned int sleep_ms ) {
+
+    // An overrun ticks right away but still services whatever is already pending
+    if( ! scheduler_arm_next_tick( sleep_ms ) ) {
+
+        reactor_dispatch( 0 );
+        return;
+    }
+
+    while( ! reactor_dispatch( reactor_wait_timeout_ms() ) && ! halt_received );
+}
+
+// Sleep until the next tick on the configured event loop
+void wait_for_next_tick( unsigned int sleep_ms ) {
+
+    if( REACTOR ) {
+
+        reactor_wait_for_next_tick( sleep_ms );
+
+    } else {
+
+        poll_wait_for_next_tick( sleep_ms );
+    }
+}
+
+// Per-fan env var; ie: PWM_FAN_1_MAX_DUTY_CYCLE for fan 1
+char* getenv_fan( Fan *fan, const char *name ) {
+
+    char env_name[64];
+    snprintf( env_name, sizeof( env_name ), "PWM_FAN_%i_%s", fan->idx, name );
+
+    return getenv( env_name );
+}
+
+// Get a per-fan temp env var in C as millidegrees; an unparseable value is an invalid config
+void getenv_fan_millidegrees( Fan *fan, const char *name, int *temp_mc ) {
+
+    char env_name[64];
+    snprintf( env_name, sizeof( env_name ), "PWM_FAN_%i_%s", fan->idx, name );
+
+    getenv_millidegrees( env_name, temp_mc );
+}
+
+// Why a calibration can't be used, or NULL when it can
+// - Points must increase in duty cycle for the curve to map them
+const char* calibration_invalid_reason( Calibration *cal ) {
+
+    if( cal->max_duty_cycle == 0 )                          { return "no max_duty_cycle"; }
+    if( cal->start_duty_cycle > cal->max_duty_cycle )       { return "start_duty_cycle above max_duty_cycle"; }
+    if( cal->rpm_point_count < 2 )                          { return "fewer than 2 rpm points"; }
+
+    for( int j = 1; j < cal->rpm_point_count; j++ ) {
+
+        if( cal->rpm_points[j].duty_cycle <= cal->rpm_points[ j - 1 ].duty_cycle ) { return "rpm point duty cycles not strictly increasing"; }
+    }
+
+    return NULL;
+}
+
+// Load CALIBRATION_FILE into a MAX_FANS `calibration_table`; a missing file leaves every fan
+//    uncalibrated
+// - `fan=N` starts each fan's keys; `rpm` is `duty_cycle:rpm,...` by increasing duty cycle
+// - A reload loads into a staged table so a rejected reload keeps the running one
+// - False when a table in the file was rejected; those fans are left uncalibrated
+bool calibration_load( Calibration *calibration_table ) {
+
+    memset( calibration_table, 0, sizeof( Calibration ) * MAX_FANS );
+
+    if( CALIBRATION_FILE[0] == '\0' ) { return true; }
+
+    FILE *fd_calibration = fopen( CALIBRATION_FILE, "r" );
+
+    if( fd_calibration == NULL ) {
+
+        l( DEBUG, "No fan calibration at %s: %s\n", CALIBRATION_FILE, strerror( errno ) );
+        return true;
+    }
+
+    char line[ CALIBRATION_LINE_MAX ];
+    Calibration *cal = NULL;
+    int calibrated_count = 0,
+        rejected_count   = 0;
+
+    while( fgets( line, sizeof( line ), fd_calibration ) != NULL ) {
+
+        line[ strcspn( line, "\n" ) ] = '\0';
+
+        char *value = strchr( line, '=' );
+
+        if( value == NULL ) { continue; }
+
+        *value++ = '\0';
+
+        if( strcmp( line, "fan" ) == 0 ) {
+
+            int idx = atoi( value );
+
+            cal = idx >= 0 && idx < MAX_FANS ? &calibration_table[ idx ] : NULL;
+
+            if( cal != NULL ) { memset( cal, 0, sizeof( *cal ) ); }
+
+            continue;
+        }
+
+        if( cal == NULL ) { continue; }
+
+        if( strcmp( line, "pwm_gpio" ) == 0 )              { cal->bcm_gpio_pin_pwm = atoi( value ); }
+        else if( strcmp( line, "pwm_freq_hz" ) == 0 )      { cal->pwm_freq_hz = atoi( value ); }
+        else if( strcmp( line, "max_duty_cycle" ) == 0 )   { cal->max_duty_cycle = atoi( value ); }
+        else if( strcmp( line, "start_duty_cycle" ) == 0 ) { cal->start_duty_cycle = atoi( value ); }
+        else if( strcmp( line, "stop_duty_cycle" ) == 0 )  { cal->stop_duty_cycle = atoi( value ); }
+        else if( strcmp( line, "rpm" ) == 0 ) {
+
+            int chars_read;
+
+            for( cal->rpm_point_count = 0; cal->rpm_point_count < CALIBRATION_MAX_POINTS && sscanf( value, "%hu:%u%n", &cal->rpm_points[ cal->rpm_point_count ].duty_cycle, &cal->rpm_points[ cal->rpm_point_count ].rpm, &chars_read ) == 2; cal->rpm_point_count++ ) {
+
+                value += chars_read;
+
+                if( *value == ',' ) { value++; }
+            }
+        }
+    }
+
+    fclose( fd_calibration );
+
+    for( int i = 0; i < MAX_FANS; i++ ) {
+
+        cal = &calibration_table[i];
+
+        // Fans without an entry stay uncalibrated quietly
+        if( cal->max_duty_cycle == 0 && cal->rpm_point_count == 0 ) { continue; }
+
+        const char *invalid_str = calibration_invalid_reason( cal );
+
+        cal->valid = invalid_str == NULL;
+
+        if( ! cal->valid ) {
+
+            l( ERROR, "Fan %i calibration in %s rejected: %s\n", i, CALIBRATION_FILE, invalid_str );
+        }
+
+        calibrated_count += cal->valid;
+        rejected_count   += ! cal->valid;
+    }
+
+    l( INFO, "Loaded %i fan calibration(s) from %s\n", calibrated_count, CALIBRATION_FILE );
+
+    return rejected_count == 0;
+}
+
+// Apply the calibration in `calibration_table` matching a fan's PWM pin, frequency and
+//    MAX_DUTY_CYCLE, if any
+// - The minimum duty cycle is raised to the start duty cycle so an on fan is never in its
+//   dead band, the curve is compiled linear in RPM and pid_rpm's max RPM defaults to the
+//   measured one
+void calibration_apply( Fan *fan, Calibration *calibration_table ) {
+
+    fan->ctl.rpm_point_count = 0;
+
+    for( int i = 0; i < MAX_FANS; i++ ) {
+
+        Calibration *cal = &calibration_table[i];
+        unsigned int rpm = 0;
+
+        if( ! cal->valid || cal->bcm_gpio_pin_pwm != fan->bcm_gpio_pin_pwm || cal->pwm_freq_hz != fan->pwm_freq_hz || cal->max_duty_cycle != fan->ctl.max_duty_cycle ) { continue; }
+
+        // Measured RPM can dip between steps; the curve needs it non-decreasing
+        for( int j = 0; j < cal->rpm_point_count; j++ ) {
+
+            if( cal->rpm_points[j].rpm > rpm ) { rpm = cal->rpm_points[j].rpm; }
+
+            fan->ctl.rpm_points[j].duty_cycle = cal->rpm_points[j].duty_cycle;
+            fan->ctl.rpm_points[j].rpm        = rpm;
+        }
+
+        fan->ctl.rpm_point_count = cal->rpm_point_count;
+
+        if( fan->ctl.min_duty_cycle < cal->start_duty_cycle ) { fan->ctl.min_duty_cycle = cal->start_duty_cycle; }
+        if( fan->ctl.pid_max_rpm == 0 )                       { fan->ctl.pid_max_rpm = rpm; }
+
+        l( DEBUG, "Fan %i calibrated: starts at duty cycle %i, stalls below %i, %u RPM at max\n", fan->idx, cal->start_duty_cycle, cal->stop_duty_cycle, rpm );
+        return;
+    }
+}
+
+// Initialize a fan from the global config with nothing open
+void fan_init( Fan *fan, int idx ) {
+
+    memset( fan, 0, sizeof( *fan ) );
+
+    fan->idx                  = idx;
+    fan->bcm_gpio_pin_pwm     = BCM_GPIO_PIN_PWM;
+    fan->pwm_freq_hz          = PWM_FREQ_HZ;
+    fan->ctl.min_duty_cycle   = MIN_DUTY_CYCLE;
+    fan->ctl.max_duty_cycle   = MAX_DUTY_CYCLE;
+    fan->ctl.fan_off_grace_ms = FAN_OFF_GRACE_MS;
+    fan->ctl.min_off_temp_mc  = MIN_OFF_TEMP_MC;
+    fan->ctl.min_on_temp_mc   = MIN_ON_TEMP_MC;
+    fan->ctl.max_temp_mc      = MAX_TEMP_MC;
+    fan->curve                = CURVE;
+    fan->curve_points_str     = CURVE_POINTS;
+    fan->control              = CONTROL;
+    fan->ctl.pid_target_mc    = PID_TARGET_MC;
+    fan->ctl.pid_max_rpm      = PID_MAX_RPM;
+
+    fan->ctl.temp_pid.kp_milli    = PID_KP_MILLI;
+    fan->ctl.temp_pid.ki_milli    = PID_KI_MILLI;
+    fan->ctl.temp_pid.kd_milli    = PID_KD_MILLI;
+    fan->ctl.temp_pid.error_scale = 1000;
+
+    fan->ctl.rpm_pid.kp_milli    = RPM_KP_MILLI;
+    fan->ctl.rpm_pid.ki_milli    = RPM_KI_MILLI;
+    fan->ctl.rpm_pid.error_scale = 1;
+
+    fan->fd_pwm_channel_set_duty_cycle = -1;
+    fan->pwm_last_duty_cycle_ns        = PWM_DUTY_CYCLE_NS_UNKNOWN;
+    fan->fd_gpio_tach_value            = -1;
+    fan->fd_gpio_tach_line             = -1;
+}
+
+// Apply PWM_FAN_<n>_* env overrides and the matching calibration in `calibration_table` to a fan
+void fan_config( Fan *fan, Calibration *calibration_table ) {
+
+    if( getenv_fan( fan, "BCM_GPIO_PIN_PWM" ) ) sscanf( getenv_fan( fan, "BCM_GPIO_PIN_PWM" ), "%hu", &fan->bcm_gpio_pin_pwm );
+    if( getenv_fan( fan, "PWM_FREQ_HZ" ) )      sscanf( getenv_fan( fan, "PWM_FREQ_HZ" ),      "%hu", &fan->pwm_freq_hz );
+    if( getenv_fan( fan, "MIN_DUTY_CYCLE" ) )   sscanf( getenv_fan( fan, "MIN_DUTY_CYCLE" ),   "%hu", &fan->ctl.min_duty_cycle );
+    if( getenv_fan( fan, "MAX_DUTY_CYCLE" ) )   sscanf( getenv_fan( fan, "MAX_DUTY_CYCLE" ),   "%hu", &fan->ctl.max_duty_cycle );
+    if( getenv_fan( fan, "FAN_OFF_GRACE_MS" ) ) sscanf( getenv_fan( fan, "FAN_OFF_GRACE_MS" ), "%hu", &fan->ctl.fan_off_grace_ms );
+    getenv_fan_millidegrees( fan, "MIN_OFF_TEMP_C", &fan->ctl.min_off_temp_mc );
+    getenv_fan_millidegrees( fan, "MIN_ON_TEMP_C",  &fan->ctl.min_on_temp_mc );
+    getenv_fan_millidegrees( fan, "MAX_TEMP_C",     &fan->ctl.max_temp_mc );
+    if( getenv_fan( fan, "CURVE" ) )            fan->curve = getenv_fan( fan, "CURVE" );
+    if( getenv_fan( fan, "CURVE_POINTS" ) )     fan->curve_points_str = getenv_fan( fan, "CURVE_POINTS" );
+
+    if( getenv_fan( fan, "TACH_PIN" ) ) {
+
+        sscanf( getenv_fan( fan, "TACH_PIN" ), "%hu", &fan->bcm_gpio_pin_tach );
+
+        fan->is_tach_enabled    = true;
+        fan->tach_pulse_per_rev = 2;
+    }
+
+    if( getenv_fan( fan, "TACH_PPR" ) )         sscanf( getenv_fan( fan, "TACH_PPR" ),         "%hu", &fan->tach_pulse_per_rev );
+    if( getenv_fan( fan, "CONTROL" ) )          fan->control = getenv_fan( fan, "CONTROL" );
+    getenv_fan_millidegrees( fan, "PID_TARGET_C", &fan->ctl.pid_target_mc );
+    getenv_fan_millidegrees( fan, "PID_KP",       &fan->ctl.temp_pid.kp_milli );
+    getenv_fan_millidegrees( fan, "PID_KI",       &fan->ctl.temp_pid.ki_milli );
+    getenv_fan_millidegrees( fan, "PID_KD",       &fan->ctl.temp_pid.kd_milli );
+    getenv_fan_millidegrees( fan, "RPM_KP",       &fan->ctl.rpm_pid.kp_milli );
+    getenv_fan_millidegrees( fan, "RPM_KI",       &fan->ctl.rpm_pid.ki_milli );
+    if( getenv_fan( fan, "PID_MAX_RPM" ) )      sscanf( getenv_fan( fan, "PID_MAX_RPM" ),      "%u",  &fan->ctl.pid_max_rpm );
+
+    if( fan->pwm_freq_hz == 0 || fan->ctl.max_duty_cycle == 0 || fan->ctl.min_duty_cycle > fan->ctl.max_duty_cycle ) {
+
+        l( ERROR, "Error: Fan %i needs PWM_FREQ_HZ above 0 and MIN_DUTY_CYCLE up to MAX_DUTY_CYCLE!\n", fan->idx );
+        config_invalid();
+        return;
+    }
+
+    calibration_apply( fan, calibration_table );
+
+    if( strcmp( fan->control, "curve" ) == 0 )        { fan->ctl.control_mode = CONTROL_CURVE; }
+    else if( strcmp( fan->control, "pid" ) == 0 )     { fan->ctl.control_mode = CONTROL_PID; }
+    else if( strcmp( fan->control, "pid_rpm" ) == 0 ) { fan->ctl.control_mode = CONTROL_PID_RPM; }
+    else {
+
+        l( ERROR, "Error: Fan %i PWM_FAN_CONTROL must be curve, pid or pid_rpm!\n", fan->idx );
+        config_invalid();
+        return;
+    }
+
+    if( fan->ctl.control_mode == CONTROL_PID_RPM && ( ! fan->is_tach_enabled || fan->ctl.pid_max_rpm == 0 ) ) {
+
+        l( ERROR, "Error: Fan %i pid_rpm control needs a tachometer and PWM_FAN_PID_MAX_RPM above 0!\n", fan->idx );
+        config_invalid();
+        return;
+    }
+
+    if( fan->ctl.temp_pid.kp_milli < 0 || fan->ctl.temp_pid.ki_milli < 0 || fan->ctl.temp_pid.kd_milli < 0 || fan->ctl.rpm_pid.kp_milli < 0 || fan->ctl.rpm_pid.ki_milli < 0 ) {
+
+        l( ERROR, "Error: Fan %i PID gains can't be negative!\n", fan->idx );
+        config_invalid();
+        return;
+    }
+
+    // Both loops clamp to the fan's duty cycle range
+    fan->ctl.temp_pid.out_min_mpct = fan->ctl.min_duty_cycle * 1000LL;
+    fan->ctl.temp_pid.out_max_mpct = fan->ctl.max_duty_cycle * 1000LL;
+    fan->ctl.rpm_pid.out_min_mpct  = fan->ctl.min_duty_cycle * 1000LL;
+    fan->ctl.rpm_pid.out_max_mpct  = fan->ctl.max_duty_cycle * 1000LL;
+
+    l( DEBUG, "\nFan %i config:\n", fan->idx );
+    l( DEBUG, " - bcm_gpio_pin_pwm = %i\n", fan->bcm_gpio_pin_pwm );
+    l( DEBUG, " - pwm_freq_hz      = %i\n", fan->pwm_freq_hz );
+    l( DEBUG, " - min_duty_cycle   = %i\n", fan->ctl.min_duty_cycle );
+    l( DEBUG, " - max_duty_cycle   = %i\n", fan->ctl.max_duty_cycle );
+    l( DEBUG, " - min_off_temp_mc  = %i\n", fan->ctl.min_off_temp_mc );
+    l( DEBUG, " - min_on_temp_mc   = %i\n", fan->ctl.min_on_temp_mc );
+    l( DEBUG, " - max_temp_mc      = %i\n", fan->ctl.max_temp_mc );
+    l( DEBUG, " - fan_off_grace_ms = %i\n", fan->ctl.fan_off_grace_ms );
+    l( DEBUG, " - curve            = %s\n", fan->curve );
+    l( DEBUG, " - curve_points_str = %s\n", fan->curve_points_str );
+    l( DEBUG, " - control          = %s\n", fan->control );
+
+    if( fan->ctl.control_mode != CONTROL_CURVE ) {
+
+        l( DEBUG, " - pid_target_mc    = %i\n", fan->ctl.pid_target_mc );
+        l( DEBUG, " - pid kp/ki/kd     = %i/%i/%i (milli)\n", fan->ctl.temp_pid.kp_milli, fan->ctl.temp_pid.ki_milli, fan->ctl.temp_pid.kd_milli );
+    }
+
+    if( fan->ctl.control_mode == CONTROL_PID_RPM ) {
+
+        l( DEBUG, " - pid_max_rpm      = %u\n", fan->ctl.pid_max_rpm );
+        l( DEBUG, " - rpm kp/ki        = %i/%i (milli)\n", fan->ctl.rpm_pid.kp_milli, fan->ctl.rpm_pid.ki_milli );
+    }
+
+    if( fan->is_tach_enabled ) {
+
+        l( DEBUG, " - tach pin/ppr     = %i/%i\n", fan->bcm_gpio_pin_tach, fan->tach_pulse_per_rev );
+    }
+}
+
+// Decide a fan's duty cycle and mode for the current temp at `now_ns` without touching the
+//    hardware, so replay runs the exact decisions the main loop makes
+unsigned short fan_decide( Fan *fan, int cur_temp_mc, int smooth_temp_mc, long long now_ns ) {
+
+    ControllerSample sample = {
+        .cur_temp_mc    = cur_temp_mc,
+        .smooth_temp_mc = smooth_temp_mc,
+        .tach_rpm       = fan->tach_rpm,
+        .now_ns         = now_ns
+    };
+
+    ControllerDecision decision = controller_step( &fan->ctl, &sample );
+
+    switch( decision.mode ) {
+
+        case FAN_BELOW_MIN:
+            l( DEBUG, CYAN MC_FMT RESET " BELOW_MIN use_min_temp_mc - MIN_DUTY_CYCLE   ", MC_FMT_ARGS( cur_temp_mc ) );
+            break;
+
+        case FAN_BELOW_OFF:
+            l( DEBUG, GREEN MC_FMT RESET " BELOW_OFF use_min_temp_mc - OFF              ", MC_FMT_ARGS( cur_temp_mc ) );
+            break;
+
+        case FAN_ABOVE_MAX:
+            l( DEBUG, RED MC_FMT RESET " ABOVE_MAX MAX_TEMP_MC - MAX_DUTY_CYCLE       ", MC_FMT_ARGS( cur_temp_mc ) );
+            break;
+
+        case FAN_PID:
+            l( DEBUG, YELLOW MC_FMT RESET " PID       target " MC_FMT " - %s", MC_FMT_ARGS( cur_temp_mc ), MC_FMT_ARGS( fan->ctl.pid_target_mc ), fan->control );
+
+            if( fan->ctl.control_mode == CONTROL_PID_RPM ) {
+
+                l( DEBUG, " - RPM target = %u", fan->ctl.pid_rpm_target );
+            }
+
+            break;
+
+        default:
+            l( DEBUG, YELLOW MC_FMT RESET " ABOVE_EAS MAX_TEMP_MC - %s curve", MC_FMT_ARGS( cur_temp_mc ), fan->curve );
+            break;
+    }
+
+    return decision.duty_cycle;
+}
+
+// Judge the RPM measured over the last tick against the duty cycle it ran at (main loop only)
+// - 0 RPM while commanded to spin for STALL_DETECT_MS kick-starts the fan, up to STALL_KICKS
+//   times, and then faults it; a kick runs its full KICK_MS before the RPM is judged again
+// - A calibrated fan only has to spin where its calibration does, and is degraded under
+//   STALL_DEGRADED_PCT of the calibrated RPM; degraded fans still spin so aren't kicked
+void fan_stall_check( Fan *fan, long long now_ns ) {
+
+    if( ! fan->is_tach_enabled || STALL_DETECT_MS == 0 || now_ns < fan->kick_until_ns ) { return; }
+
+    // A faulted fan is held at max
+    unsigned short duty_cycle = fan->health == FAN_HEALTH_FAULT ? fan->ctl.max_duty_cycle : fan->ctl.duty_cycle_set_val;
+    bool is_calibrated        = fan->ctl.rpm_point_count >= 2;
+    unsigned int expected_rpm = is_calibrated ? curve_rpm_at( &fan->ctl, duty_cycle ) : 0;
+    bool is_stalled           = fan->tach_rpm == 0;
+    bool is_degraded          = fan->tach_rpm > 0 && ( unsigned long long ) fan->tach_rpm * 100 < ( unsigned long long ) expected_rpm * STALL_DEGRADED_PCT;
+
+    // Off (or under the calibrated start) says nothing either way; the health and kicks carry
+    //    over to when it should next spin
+    if( duty_cycle == 0 || ( is_calibrated && expected_rpm == 0 ) ) {
+
+        fan->stall_since_ns = 0;
+        return;
+    }
+
+    if( ! is_stalled && ! is_degraded ) {
+
+        if( fan->health != FAN_HEALTH_OK ) {
+
+            l( INFO, "Fan %i recovered at %u RPM\n", fan->idx, fan->tach_rpm );
+        }
+
+        fan->health         = FAN_HEALTH_OK;
+        fan->stall_since_ns = 0;
+        fan->stall_kicks    = 0;
+        return;
+    }
+
+    if( fan->stall_since_ns == 0 ) { fan->stall_since_ns = now_ns; }
+
+    if( now_ns - fan->stall_since_ns < STALL_DETECT_MS * 1000000LL || fan->health == FAN_HEALTH_FAULT ) { return; }
+
+    if( is_degraded ) {
+
+        if( fan->health != FAN_HEALTH_DEGRADED ) {
+
+            l( ERROR, "Fan %i degraded: %u RPM at %u%% duty cycle, calibrated %u RPM\n", fan->idx, fan->tach_rpm, duty_cycle, expected_rpm );
+        }
+
+        fan->health = FAN_HEALTH_DEGRADED;
+        return;
+    }
+
+    if( fan->stall_kicks < STALL_KICKS ) {
+
+        fan->stall_kicks++;
+        fan->health         = FAN_HEALTH_STALLED;
+        fan->kick_until_ns  = now_ns + KICK_MS * 1000000LL;
+        fan->stall_since_ns = 0;
+
+        l( ERROR, "Fan %i stalled: 0 RPM at %u%% duty cycle for %ums, kick-start %u of %u\n", fan->idx, duty_cycle, STALL_DETECT_MS, fan->stall_kicks, STALL_KICKS );
+        return;
+    }
+
+    fan->health = FAN_HEALTH_FAULT;
+
+    l( ERROR, "Fan %i fault: still stalled after %u kick-start(s), holding MAX_DUTY_CYCLE\n", fan->idx, STALL_KICKS );
+
+    if( STALL_EXIT ) {
+
+        fan_fault_exit = true;
+        halt_received  = 1;
+    }
+}
+
+// Longest sleep stall detection allows for a fan, or 0 for no limit; STALL_DETECT_MS while it
+//    should spin and SLEEP_MS while a stall or kick-start is pending, so event mode and power
+//    save can't stretch detection
+unsigned int stall_sleep_ms( Fan *fan, long long now_ns ) {
+
+    if( ! fan->is_tach_enabled || STALL_DETECT_MS == 0 ) { return 0; }
+
+    if( fan->stall_since_ns != 0 || now_ns < fan->kick_until_ns ) { return SLEEP_MS; }
+
+    return fan->ctl.duty_cycle_set_val > 0 || fan->health == FAN_HEALTH_FAULT ? STALL_DETECT_MS : 0;
+}
+
+// Decide and set a fan's duty cycle for the current temp; a kick-start, fault or stale peers
+//    override the decision with max
+void fan_control_tick( Fan *fan, int cur_temp_mc, int smooth_temp_mc ) {
+
+    long long now_ns = monotonic_ns();
+    unsigned short duty_cycle_set_val = fan_decide( fan, cur_temp_mc, smooth_temp_mc, now_ns );
+
+    if( now_ns < fan->kick_until_ns || fan->health == FAN_HEALTH_FAULT || is_peer_stale ) {
+
+        pwm_set_max_duty_cycle( fan );
+        fan->duty_cycle_applied = fan->ctl.max_duty_cycle;
+
+        l( DEBUG, " - DC = " MAGENTA "%i" RESET " (%s)", fan->ctl.max_duty_cycle, now_ns < fan->kick_until_ns ? "kick-start" : fan->health == FAN_HEALTH_FAULT ? "fault" : "peers stale" );
+        return;
+    }
+
+    pwm_set_duty_cycle( fan, duty_cycle_set_val );
+    fan->duty_cycle_applied = duty_cycle_set_val;
+
+    l( DEBUG, " - DC = " MAGENTA "%i" RESET, duty_cycle_set_val );
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+
+// Save or restore the reloadable globals
+void config_globals_save( ConfigGlobals *config ) {
+
+    #define CONFIG_GLOBAL_SAVE( name ) config->name = name;
+    CONFIG_RELOADABLE_GLOBALS( CONFIG_GLOBAL_SAVE )
+    #undef CONFIG_GLOBAL_SAVE
+}
+
+void config_globals_restore( ConfigGlobals *config ) {
+
+    #define CONFIG_GLOBAL_RESTORE( name ) name = config->name;
+    CONFIG_RELOADABLE_GLOBALS( CONFIG_GLOBAL_RESTORE )
+    #undef CONFIG_GLOBAL_RESTORE
+}
+
+// Is a PWM_FAN_* or PWM_FAN_<n>_* key one a reload may change?
+bool config_key_is_reloadable( const char *key ) {
+
+    const char *name = key + strlen( "PWM_FAN_" );
+
+    if( name[0] >= '0' && name[0] <= '9' && name[1] == '_' ) { name += 2; }
+
+    for( int i = 0; CONFIG_RELOADABLE_KEYS[i] != NULL; i++ ) {
+
+        if( strcmp( name, CONFIG_RELOADABLE_KEYS[i] ) == 0 ) { return true; }
+    }
+
+    return false;
+}
+
+// Parse the config file's `PWM_FAN_KEY=value` lines; blank lines and `#` comments are
+//    skipped and a value may be wrapped in quotes (systemd EnvironmentFile compatible)
+// - Returns the # of keys or -1 if the file can't be read
+int config_file_parse( char keys[][ CONFIG_KEY_MAX ], char values[][ CONFIG_LINE_MAX ] ) {
+
+    FILE *fd_config = fopen( CONFIG_FILE, "r" );
+
+    if( fd_config == NULL ) {
+
+        l( ERROR, "Unable to open config file %s: %s\n", CONFIG_FILE, strerror( errno ) );
+        return -1;
+    }
+
+    char line[ CONFIG_LINE_MAX ];
+    int line_num = 0,
+        count    = 0;
+
+    while( fgets( line, sizeof( line ), fd_config ) != NULL ) {
+
+        line_num++;
+
+        char *key = line;
+        while( *key == ' ' || *key == '\t' ) { key++; }
+
+        char *end = key + strlen( key );
+        while( end > key && ( end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t' ) ) { *--end = '\0'; }
+
+        if( *key == '\0' || *key == '#' ) { continue; }
+
+        char *value = strchr( key, '=' );
+
+        if( value == NULL || strncmp( key, "PWM_FAN_", strlen( "PWM_FAN_" ) ) != 0 || strncmp( key, "PWM_FAN_CONFIG_FILE=", strlen( "PWM_FAN_CONFIG_FILE=" ) ) == 0 ) {
+
+            l( ERROR, "Ignoring config file %s line %i; expected PWM_FAN_KEY=value\n", CONFIG_FILE, line_num );
+            continue;
+        }
+
+        // Split and trim around the `=`
+        char *key_end = value;
+        while( key_end > key && ( key_end[-1] == ' ' || key_end[-1] == '\t' ) ) { key_end--; }
+        *key_end = '\0';
+
+        value++;
+        while( *value == ' ' || *value == '\t' ) { value++; }
+
+        end = value + strlen( value );
+
+        if( end - value >= 2 && ( *value == '"' || *value == '\'' ) && end[-1] == *value ) {
+
+            value++;
+            end[-1] = '\0';
+        }
+
+        if( count == CONFIG_FILE_MAX_KEYS || strlen( key ) >= CONFIG_KEY_MAX ) {
+
+            l( ERROR, "Ignoring config file %s line %i; too many or too long keys\n", CONFIG_FILE, line_num );
+            continue;
+        }
+
+        strcpy( keys[ count ], key );
+        strcpy( values[ count ], value );
+        count++;
+    }
+
+    fclose( fd_config );
+
+    return count;
+}
+
+// Set or unset (NULL) an env var, recording the value it replaces in `undo` when given
+void config_env_set( const char *key, const char *value, ConfigFileKey *undo, int *undo_count ) {
+
+    if( undo != NULL ) {
+
+        snprintf( undo[ *undo_count ].key, CONFIG_KEY_MAX, "%s", key );
+        undo[ *undo_count ].env_value = getenv( key ) ? strdup( getenv( key ) ) : NULL;
+        ( *undo_count )++;
+    }
+
+    if( value != NULL ) {
+
+        setenv( key, value, 1 );
+
+    } else {
+
+        unsetenv( key );
+    }
+}
+
+// Put back (or just forget) env changes recorded by config_env_set
+void config_env_undo( ConfigFileKey *undo, int undo_count, bool is_restore ) {
+
+    for( int i = undo_count - 1; i >= 0; i-- ) {
+
+        if( is_restore ) { config_env_set( undo[i].key, undo[i].env_value, NULL, NULL ); }
+
+        free( undo[i].env_value );
+        undo[i].env_value = NULL;
+    }
+}
+
+// Apply the config file over the environment
+// - A key dropped from the file reverts to the env value it replaced; a reload skips keys
+//   that need a restart and records every change in `undo` so it can be rolled back
+bool config_file_apply( bool is_reload, ConfigFileKey *undo, int *undo_count ) {
+
+    static char keys[ CONFIG_FILE_MAX_KEYS ][ CONFIG_KEY_MAX ];
+    static char values[ CONFIG_FILE_MAX_KEYS ][ CONFIG_LINE_MAX ];
+
+    int count = config_file_parse( keys, values );
+
+    if( count < 0 ) { return false; }
+
+    for( int i = 0; i < config_file_key_count; i++ ) {
+
+        ConfigFileKey *file_key = &config_file_keys[i];
+        bool is_in_file = false;
+
+        for( int j = 0; j < count && ! is_in_file; j++ ) { is_in_file = strcmp( keys[j], file_key->key ) == 0; }
+
+        if( is_in_file || ! config_key_is_reloadable( file_key->key ) ) { continue; }
+
+        config_env_set( file_key->key, file_key->env_value, undo, undo_count );
+    }
+
+    for( int i = 0; i < count; i++ ) {
+
+        if( getenv( keys[i] ) != NULL && strcmp( getenv( keys[i] ), values[i] ) == 0 ) { continue; }
+
+        if( is_reload && ! config_key_is_reloadable( keys[i] ) ) {
+
+            l( ERROR, "%s changed in %s but needs a restart to apply; ignoring\n", keys[i], CONFIG_FILE );
+            continue;
+        }
+
+        // Remember the env value the file replaces the first time the file sets a key
+        bool is_known = false;
+
+        for( int j = 0; j < config_file_key_count && ! is_known; j++ ) { is_known = strcmp( config_file_keys[j].key, keys[i] ) == 0; }
+
+        if( ! is_known && config_file_key_count < CONFIG_FILE_MAX_KEYS ) {
+
+            ConfigFileKey *file_key = &config_file_keys[ config_file_key_count++ ];
+
+            strcpy( file_key->key, keys[i] );
+            file_key->env_value = getenv( keys[i] ) ? strdup( getenv( keys[i] ) ) : NULL;
+        }
+
+        config_env_set( keys[i], values[i], undo, undo_count );
+    }
+
+    return true;
+}
+
+// Read the global config from the environment and validate it
+// - Run at startup and again by a reload after the reloadable globals are reset to defaults
+void config_read() {
+
+    if( getenv( "PWM_FAN_FANS" ) )             sscanf( getenv( "PWM_FAN_FANS" ),             "%u",  &FAN_COUNT );
+    if( getenv( "PWM_FAN_BCM_GPIO_PIN_PWM" ) ) sscanf( getenv( "PWM_FAN_BCM_GPIO_PIN_PWM" ), "%hu", &BCM_GPIO_PIN_PWM );;
+    if( getenv( "PWM_FAN_PWM_FREQ_HZ" ) )      sscanf( getenv( "PWM_FAN_PWM_FREQ_HZ" ),      "%hu", &PWM_FREQ_HZ );
+    if( getenv( "PWM_FAN_MIN_DUTY_CYCLE" ) )   sscanf( getenv( "PWM_FAN_MIN_DUTY_CYCLE" ),   "%hu", &MIN_DUTY_CYCLE );
+    if( getenv( "PWM_FAN_MAX_DUTY_CYCLE" ) )   sscanf( getenv( "PWM_FAN_MAX_DUTY_CYCLE" ),   "%hu", &MAX_DUTY_CYCLE );
+    if( getenv( "PWM_FAN_FAN_OFF_GRACE_MS" ) ) sscanf( getenv( "PWM_FAN_FAN_OFF_GRACE_MS" ), "%hu", &FAN_OFF_GRACE_MS );
+    if( getenv( "PWM_FAN_SLEEP_MS" ) )         sscanf( getenv( "PWM_FAN_SLEEP_MS" ),         "%i",  &SLEEP_MS );
+    if( getenv( "PWM_FAN_SLEEP_MIN_MS" ) )     sscanf( getenv( "PWM_FAN_SLEEP_MIN_MS" ),     "%u",  &SLEEP_MIN_MS );
+    if( getenv( "PWM_FAN_SLEEP_MAX_MS" ) )     sscanf( getenv( "PWM_FAN_SLEEP_MAX_MS" ),     "%u",  &SLEEP_MAX_MS );
+    getenv_millidegrees( "PWM_FAN_ADAPT_STEP_C",   &ADAPT_STEP_MC );
+    getenv_millidegrees( "PWM_FAN_MIN_OFF_TEMP_C", &MIN_OFF_TEMP_MC );
+    getenv_millidegrees( "PWM_FAN_MIN_ON_TEMP_C",  &MIN_ON_TEMP_MC );
+    getenv_millidegrees( "PWM_FAN_MAX_TEMP_C",     &MAX_TEMP_MC );
+    if( getenv( "PWM_FAN_SYSFS_ROOT" ) )       SYSFS_ROOT = getenv( "PWM_FAN_SYSFS_ROOT" );
+    if( getenv( "PWM_FAN_TOPOLOGY_CACHE" ) )   TOPOLOGY_CACHE = getenv( "PWM_FAN_TOPOLOGY_CACHE" );
+    if( getenv( "PWM_FAN_CALIBRATION_FILE" ) ) CALIBRATION_FILE = getenv( "PWM_FAN_CALIBRATION_FILE" );
+    if( getenv( "PWM_FAN_CALIBRATE_STEP" ) )   sscanf( getenv( "PWM_FAN_CALIBRATE_STEP" ),   "%hu", &CALIBRATE_STEP );
+    if( getenv( "PWM_FAN_CALIBRATE_SETTLE_MS" ) ) sscanf( getenv( "PWM_FAN_CALIBRATE_SETTLE_MS" ), "%u", &CALIBRATE_SETTLE_MS );
+    if( getenv( "PWM_FAN_STALL_DETECT_MS" ) )  sscanf( getenv( "PWM_FAN_STALL_DETECT_MS" ),  "%u",  &STALL_DETECT_MS );
+    if( getenv( "PWM_FAN_STALL_DEGRADED_PCT" ) ) sscanf( getenv( "PWM_FAN_STALL_DEGRADED_PCT" ), "%hu", &STALL_DEGRADED_PCT );
+    if( getenv( "PWM_FAN_KICK_MS" ) )          sscanf( getenv( "PWM_FAN_KICK_MS" ),          "%u",  &KICK_MS );
+    if( getenv( "PWM_FAN_STALL_KICKS" ) )      sscanf( getenv( "PWM_FAN_STALL_KICKS" ),      "%hu", &STALL_KICKS );
+    if( getenv( "PWM_FAN_STALL_EXIT" ) )       STALL_EXIT = strcmp( getenv( "PWM_FAN_STALL_EXIT" ), "1" ) == 0;
+    if( getenv( "PWM_FAN_PEER_PUBLISH" ) )     PEER_PUBLISH = getenv( "PWM_FAN_PEER_PUBLISH" );
+    if( getenv( "PWM_FAN_PEER_LISTEN" ) )      PEER_LISTEN = getenv( "PWM_FAN_PEER_LISTEN" );
+    if( getenv( "PWM_FAN_PEER_AGGREGATE" ) )   PEER_AGGREGATE = getenv( "PWM_FAN_PEER_AGGREGATE" );
+    if( getenv( "PWM_FAN_PEER_ID" ) )          PEER_ID = getenv( "PWM_FAN_PEER_ID" );
+    if( getenv( "PWM_FAN_PEER_WEIGHT" ) )      sscanf( getenv( "PWM_FAN_PEER_WEIGHT" ),      "%hu", &PEER_WEIGHT );
+    if( getenv( "PWM_FAN_PEER_TIMEOUT_MS" ) )  sscanf( getenv( "PWM_FAN_PEER_TIMEOUT_MS" ),  "%u",  &PEER_TIMEOUT_MS );
+    if( getenv( "PWM_FAN_PEER_EXPECT" ) )      sscanf( getenv( "PWM_FAN_PEER_EXPECT" ),      "%u",  &PEER_EXPECT );
+    if( getenv( "PWM_FAN_CURVE" ) )            CURVE = getenv( "PWM_FAN_CURVE" );
+    if( getenv( "PWM_FAN_TACH_BACKEND" ) )     TACH_BACKEND = getenv( "PWM_FAN_TACH_BACKEND" );
+    if( getenv( "PWM_FAN_TACH_GPIOCHIP" ) )    TACH_GPIOCHIP = getenv( "PWM_FAN_TACH_GPIOCHIP" );
+    if( getenv( "PWM_FAN_TACH_DEBOUNCE_US" ) ) sscanf( getenv( "PWM_FAN_TACH_DEBOUNCE_US" ), "%u",  &TACH_DEBOUNCE_US );
+    if( getenv( "PWM_FAN_SMOOTH_FILTER" ) )    SMOOTH_FILTER = getenv( "PWM_FAN_SMOOTH_FILTER" );
+    if( getenv( "PWM_FAN_SMOOTH_WINDOW" ) )    sscanf( getenv( "PWM_FAN_SMOOTH_WINDOW" ),    "%u",  &SMOOTH_WINDOW );
+    if( getenv( "PWM_FAN_CURVE_POINTS" ) )     CURVE_POINTS = getenv( "PWM_FAN_CURVE_POINTS" );
+    if( getenv( "PWM_FAN_TELEMETRY" ) )        TELEMETRY = getenv( "PWM_FAN_TELEMETRY" );
+    if( getenv( "PWM_FAN_TELEMETRY_FILE" ) )   TELEMETRY_FILE = getenv( "PWM_FAN_TELEMETRY_FILE" );
+    if( getenv( "PWM_FAN_TELEMETRY_EVERY" ) )  sscanf( getenv( "PWM_FAN_TELEMETRY_EVERY" ),  "%u",  &TELEMETRY_EVERY );
+    if( getenv( "PWM_FAN_METRICS_SOCKET" ) )   METRICS_SOCKET = getenv( "PWM_FAN_METRICS_SOCKET" );
+    if( getenv( "PWM_FAN_METRICS_PORT" ) )     sscanf( getenv( "PWM_FAN_METRICS_PORT" ),     "%hu", &METRICS_PORT );
+    if( getenv( "PWM_FAN_CONTROL" ) )          CONTROL = getenv( "PWM_FAN_CONTROL" );
+    getenv_millidegrees( "PWM_FAN_PID_TARGET_C", &PID_TARGET_MC );
+    getenv_millidegrees( "PWM_FAN_PID_KP",       &PID_KP_MILLI );
+    getenv_millidegrees( "PWM_FAN_PID_KI",       &PID_KI_MILLI );
+    getenv_millidegrees( "PWM_FAN_PID_KD",       &PID_KD_MILLI );
+    getenv_millidegrees( "PWM_FAN_RPM_KP",       &RPM_KP_MILLI );
+    getenv_millidegrees( "PWM_FAN_RPM_KI",       &RPM_KI_MILLI );
+    if( getenv( "PWM_FAN_PID_MAX_RPM" ) )      sscanf( getenv( "PWM_FAN_PID_MAX_RPM" ),      "%u",  &PID_MAX_RPM );
+    if( getenv( "PWM_FAN_EVENT_MODE" ) )       EVENT_MODE = strcmp( getenv( "PWM_FAN_EVENT_MODE" ), "1" ) == 0;
+    if( getenv( "PWM_FAN_ADOPT" ) )            ADOPT = strcmp( getenv( "PWM_FAN_ADOPT" ), "1" ) == 0;
+    if( getenv( "PWM_FAN_REACTOR" ) )          REACTOR = strcmp( getenv( "PWM_FAN_REACTOR" ), "1" ) == 0;
+    if( getenv( "PWM_FAN_POWER_SAVE" ) )       POWER_SAVE = strcmp( getenv( "PWM_FAN_POWER_SAVE" ), "1" ) == 0;
+    if( getenv( "PWM_FAN_TIMER_SLACK_US" ) )   sscanf( getenv( "PWM_FAN_TIMER_SLACK_US" ),   "%u",  &TIMER_SLACK_US );
+    if( getenv( "PWM_FAN_IDLE_SLEEP_MS" ) )    sscanf( getenv( "PWM_FAN_IDLE_SLEEP_MS" ),    "%u",  &IDLE_SLEEP_MS );
+    getenv_millidegrees( "PWM_FAN_IDLE_MARGIN_C", &IDLE_MARGIN_MC );
+    if( getenv( "PWM_FAN_FEEDFORWARD" ) )      FEEDFORWARD = strcmp( getenv( "PWM_FAN_FEEDFORWARD" ), "1" ) == 0;
+    getenv_millidegrees( "PWM_FAN_FF_GAIN_C", &FF_GAIN_MC );
+    if( getenv( "PWM_FAN_FF_TAU_MS" ) )        sscanf( getenv( "PWM_FAN_FF_TAU_MS" ),        "%u",  &FF_TAU_MS );
+    if( getenv( "PWM_FAN_FF_PSI_US" ) )        sscanf( getenv( "PWM_FAN_FF_PSI_US" ),        "%u",  &FF_PSI_US );
+    if( getenv( "PWM_FAN_BLIP_MS" ) )          sscanf( getenv( "PWM_FAN_BLIP_MS" ),          "%u",  &BLIP_MS );
+    if( getenv( "PWM_FAN_EVENT_MAX_SLEEP_MS" ) ) sscanf( getenv( "PWM_FAN_EVENT_MAX_SLEEP_MS" ), "%u", &EVENT_MAX_SLEEP_MS );
+    getenv_millidegrees( "PWM_FAN_EVENT_MAX_SLEW_C_S", &EVENT_MAX_SLEW_MC_S );
+
+    if( strcmp( TACH_BACKEND, "sysfs" ) == 0 ) {
+
+        tach_backend = TACH_BACKEND_SYSFS;
+
+    } else if( strcmp( TACH_BACKEND, "cdev" ) == 0 ) {
+
+        tach_backend = TACH_BACKEND_CDEV;
+
+    } else {
+
+        l( ERROR, "Error: PWM_FAN_TACH_BACKEND must be sysfs or cdev!\n" );
+        config_invalid();
+    }
+
+    if( strcmp( TELEMETRY, "off" ) == 0 )         { telemetry_format = TELEMETRY_OFF; }
+    else if( strcmp( TELEMETRY, "csv" ) == 0 )    { telemetry_format = TELEMETRY_CSV; }
+    else if( strcmp( TELEMETRY, "jsonl" ) == 0 )  { telemetry_format = TELEMETRY_JSONL; }
+    else if( strcmp( TELEMETRY, "binary" ) == 0 ) { telemetry_format = TELEMETRY_BINARY; }
+    else {
+
+        l( ERROR, "Error: PWM_FAN_TELEMETRY must be off, csv, jsonl or binary!\n" );
+        config_invalid();
+    }
+
+    if( TELEMETRY_EVERY < 1 ) {
+
+        l( ERROR, "Error: PWM_FAN_TELEMETRY_EVERY must be at least 1!\n" );
+        config_invalid();
+    }
+
+    // A publish-only peer has no fans of its own
+    if( ( FAN_COUNT < 1 && PEER_PUBLISH[0] == '\0' ) || FAN_COUNT > MAX_FANS ) {
+
+        l( ERROR, "Error: PWM_FAN_FANS must be between 1 and %i (0 with PWM_FAN_PEER_PUBLISH)!\n", MAX_FANS );
+        config_invalid();
+    }
+
+    if( strcmp( PEER_AGGREGATE, "max" ) == 0 ) {
+
+        peer_aggregate = PEER_AGGREGATE_MAX;
+
+    } else if( strcmp( PEER_AGGREGATE, "mean" ) == 0 ) {
+
+        peer_aggregate = PEER_AGGREGATE_MEAN;
+
+    } else {
+
+        l( ERROR, "Error: PWM_FAN_PEER_AGGREGATE must be max or mean!\n" );
+        config_invalid();
+    }
+
+    if( PEER_WEIGHT < 1 || PEER_TIMEOUT_MS < 2 || strlen( PEER_ID ) > PEER_ID_MAX ) {
+
+        l( ERROR, "Error: PWM_FAN_PEER_WEIGHT must be at least 1, PWM_FAN_PEER_TIMEOUT_MS at least 2 and PWM_FAN_PEER_ID at most %i characters!\n", PEER_ID_MAX );
+        config_invalid();
+    }
+
+    if( SLEEP_MIN_MS == 0 ) { SLEEP_MIN_MS = SLEEP_MS; }
+    if( SLEEP_MAX_MS == 0 ) { SLEEP_MAX_MS = SLEEP_MS; }
+
+    if( SLEEP_MIN_MS > SLEEP_MAX_MS || SLEEP_MIN_MS == 0 || ADAPT_STEP_MC <= 0 ) {
+
+        l( ERROR, "Error: PWM_FAN_SLEEP_MIN_MS must be between 1 and PWM_FAN_SLEEP_MAX_MS and PWM_FAN_ADAPT_STEP_C greater than 0!\n" );
+        config_invalid();
+    }
+
+    if( CALIBRATE_STEP < 1 || CALIBRATE_STEP > 100 ) {
+
+        l( ERROR, "Error: PWM_FAN_CALIBRATE_STEP must be between 1 and 100!\n" );
+        config_invalid();
+    }
+
+    if( STALL_DEGRADED_PCT > 100 || ( STALL_DETECT_MS > 0 && KICK_MS == 0 ) ) {
+
+        l( ERROR, "Error: PWM_FAN_STALL_DEGRADED_PCT must be between 0 and 100 and PWM_FAN_KICK_MS at least 1!\n" );
+        config_invalid();
+    }
+
+    if( EVENT_MAX_SLEW_MC_S <= 0 ) {
+
+        l( ERROR, "Error: PWM_FAN_EVENT_MAX_SLEW_C_S must be greater than 0!\n" );
+        config_invalid();
+    }
+
+    if( FF_GAIN_MC < 0 || FF_TAU_MS == 0 || FF_PSI_US == 0 || FF_PSI_US > FF_PSI_WINDOW_US ) {
+
+        l( ERROR, "Error: PWM_FAN_FF_GAIN_C must be 0 or greater, PWM_FAN_FF_TAU_MS at least 1 and PWM_FAN_FF_PSI_US between 1 and %i!\n", FF_PSI_WINDOW_US );
+        config_invalid();
+    }
+
+    if( IDLE_MARGIN_MC < 0 ) {
+
+        l( ERROR, "Error: PWM_FAN_IDLE_MARGIN_C must be 0 or greater!\n" );
+        config_invalid();
+    }
+
+    l( DEBUG, "\nConfig:\n" );
+    l( DEBUG, " - CONFIG_FILE      = %s\n", CONFIG_FILE ? CONFIG_FILE : "(none)" );
+    l( DEBUG, " - FAN_COUNT        = %u\n", FAN_COUNT );
+    l( DEBUG, " - BCM_GPIO_PIN_PWM = %i\n", BCM_GPIO_PIN_PWM );
+    l( DEBUG, " - PWM_FREQ_HZ      = %i\n", PWM_FREQ_HZ );
+    l( DEBUG, " - MIN_DUTY_CYCLE   = %i\n", MIN_DUTY_CYCLE );
+    l( DEBUG, " - MAX_DUTY_CYCLE   = %i\n", MAX_DUTY_CYCLE );
+    l( DEBUG, " - MIN_OFF_TEMP_MC  = %i\n", MIN_OFF_TEMP_MC );
+    l( DEBUG, " - MIN_ON_TEMP_MC   = %i\n", MIN_ON_TEMP_MC );
+    l( DEBUG, " - MAX_TEMP_MC      = %i\n", MAX_TEMP_MC );
+    l( DEBUG, " - FAN_OFF_GRACE_MS = %i\n", FAN_OFF_GRACE_MS );
+    l( DEBUG, " - SLEEP_MS         = %i\n", SLEEP_MS );
+    l( DEBUG, " - SLEEP_MIN_MS     = %u\n", SLEEP_MIN_MS );
+    l( DEBUG, " - SLEEP_MAX_MS     = %u\n", SLEEP_MAX_MS );
+    l( DEBUG, " - ADAPT_STEP_MC    = %i\n", ADAPT_STEP_MC );
+    l( DEBUG, " - SYSFS_ROOT       = %s\n", SYSFS_ROOT );
+    l( DEBUG, " - TOPOLOGY_CACHE   = %s\n", TOPOLOGY_CACHE );
+    l( DEBUG, " - CALIBRATION_FILE = %s\n", CALIBRATION_FILE );
+    l( DEBUG, " - CALIBRATE_STEP   = %u\n", CALIBRATE_STEP );
+    l( DEBUG, " - CALIBRATE_SETTLE_MS = %u\n", CALIBRATE_SETTLE_MS );
+    l( DEBUG, " - STALL_DETECT_MS  = %u\n", STALL_DETECT_MS );
+    l( DEBUG, " - STALL_DEGRADED_PCT = %u\n", STALL_DEGRADED_PCT );
+    l( DEBUG, " - KICK_MS          = %u\n", KICK_MS );
+    l( DEBUG, " - STALL_KICKS      = %u\n", STALL_KICKS );
+    l( DEBUG, " - STALL_EXIT       = %i\n", STALL_EXIT );
+    l( DEBUG, " - PEER_PUBLISH     = %s\n", PEER_PUBLISH );
+    l( DEBUG, " - PEER_LISTEN      = %s\n", PEER_LISTEN );
+    l( DEBUG, " - PEER_AGGREGATE   = %s\n", PEER_AGGREGATE );
+    l( DEBUG, " - PEER_ID          = %s\n", PEER_ID );
+    l( DEBUG, " - PEER_WEIGHT      = %u\n", PEER_WEIGHT );
+    l( DEBUG, " - PEER_TIMEOUT_MS  = %u\n", PEER_TIMEOUT_MS );
+    l( DEBUG, " - PEER_EXPECT      = %u\n", PEER_EXPECT );
+    l( DEBUG, " - CURVE            = %s\n", CURVE );
+    l( DEBUG, " - CURVE_POINTS     = %s\n", CURVE_POINTS );
+    l( DEBUG, " - CONTROL          = %s\n", CONTROL );
+    l( DEBUG, " - TELEMETRY        = %s\n", TELEMETRY );
+    l( DEBUG, " - TELEMETRY_FILE   = %s\n", TELEMETRY_FILE );
+    l( DEBUG, " - TELEMETRY_EVERY  = %u\n", TELEMETRY_EVERY );
+    l( DEBUG, " - METRICS_SOCKET   = %s\n", METRICS_SOCKET );
+    l( DEBUG, " - METRICS_PORT     = %i\n", METRICS_PORT );
+    l( DEBUG, " - TACH_BACKEND     = %s\n", TACH_BACKEND );
+    l( DEBUG, " - TACH_GPIOCHIP    = %s\n", TACH_GPIOCHIP ? TACH_GPIOCHIP : "(auto)" );
+    l( DEBUG, " - TACH_DEBOUNCE_US = %u\n", TACH_DEBOUNCE_US );
+    l( DEBUG, " - SMOOTH_FILTER    = %s\n", SMOOTH_FILTER );
+    l( DEBUG, " - SMOOTH_WINDOW    = %u\n", SMOOTH_WINDOW );
+    l( DEBUG, " - EVENT_MODE       = %i\n", EVENT_MODE );
+    l( DEBUG, " - ADOPT            = %i\n", ADOPT );
+    l( DEBUG, " - REACTOR          = %i\n", REACTOR );
+    l( DEBUG, " - POWER_SAVE       = %i\n", POWER_SAVE );
+    l( DEBUG, " - TIMER_SLACK_US   = %u\n", TIMER_SLACK_US );
+    l( DEBUG, " - IDLE_SLEEP_MS    = %u\n", IDLE_SLEEP_MS );
+    l( DEBUG, " - IDLE_MARGIN_MC   = %i\n", IDLE_MARGIN_MC );
+    l( DEBUG, " - FEEDFORWARD      = %i\n", FEEDFORWARD );
+    l( DEBUG, " - FF_GAIN_MC       = %i\n", FF_GAIN_MC );
+    l( DEBUG, " - FF_TAU_MS        = %u\n", FF_TAU_MS );
+    l( DEBUG, " - FF_PSI_US        = %u\n", FF_PSI_US );
+    l( DEBUG, " - BLIP_MS          = %u\n", BLIP_MS );
+    l( DEBUG, " - EVENT_MAX_SLEEP_MS = %u\n", EVENT_MAX_SLEEP_MS );
+    l( DEBUG, " - EVENT_MAX_SLEW_MC_S = %i\n", EVENT_MAX_SLEW_MC_S );
+    l( DEBUG, "\n" );
+}
+
+// Watch the config file's directory so a changed file reloads without a SIGHUP
+void config_watch_setup() {
+
+    char dir[ CONFIG_LINE_MAX ];
+    char *slash = strrchr( CONFIG_FILE, '/' );
+
+    if( slash == NULL ) {
+
+        strcpy( dir, "." );
+        config_file_name = CONFIG_FILE;
+
+    } else {
+
+        snprintf( dir, sizeof( dir ), "%.*s", slash == CONFIG_FILE ? 1 : ( int ) ( slash - CONFIG_FILE ), CONFIG_FILE );
+        config_file_name = slash + 1;
+    }
+
+    fd_config_watch = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+
+    if( fd_config_watch < 0 || inotify_add_watch( fd_config_watch, dir, IN_CLOSE_WRITE | IN_MOVED_TO ) < 0 ) {
+
+        l( ERROR, "Unable to watch config file %s (%s); reload with SIGHUP instead\n", CONFIG_FILE, strerror( errno ) );
+        close_raw_fd( &fd_config_watch, "fd_config_watch" );
+        return;
+    }
+
+    if( REACTOR && ! reactor_add( fd_config_watch, EPOLLIN, REACTOR_CONFIG_WATCH, 0 ) ) {
+
+        close_raw_fd( &fd_config_watch, "fd_config_watch" );
+        return;
+    }
+
+    l( INFO, "Watching config file %s for changes\n", CONFIG_FILE );
+}
+
+// Swap a staged fan's config into a running fan; fds, tachometer and control state stay
+// - The PID integrators carry over so a gain change doesn't jump the duty cycle
+void fan_apply_config( Fan *fan, Fan *staged ) {
+
+    curve_free( &fan->ctl );
+
+    fan->ctl.min_duty_cycle     = staged->ctl.min_duty_cycle;
+    fan->ctl.max_duty_cycle     = staged->ctl.max_duty_cycle;
+    fan->ctl.fan_off_grace_ms   = staged->ctl.fan_off_grace_ms;
+    fan->ctl.min_off_temp_mc    = staged->ctl.min_off_temp_mc;
+    fan->ctl.min_on_temp_mc     = staged->ctl.min_on_temp_mc;
+    fan->ctl.max_temp_mc        = staged->ctl.max_temp_mc;
+    fan->curve                  = staged->curve;
+    fan->curve_points_str       = staged->curve_points_str;
+    fan->ctl.curve_table        = staged->ctl.curve_table;
+    fan->ctl.curve_table_size   = staged->ctl.curve_table_size;
+    fan->ctl.curve_table_min_mc = staged->ctl.curve_table_min_mc;
+    fan->ctl.curve_point_count  = staged->ctl.curve_point_count;
+    fan->control                = staged->control;
+    fan->ctl.control_mode       = staged->ctl.control_mode;
+    fan->ctl.pid_target_mc      = staged->ctl.pid_target_mc;
+    fan->ctl.pid_max_rpm        = staged->ctl.pid_max_rpm;
+
+    memcpy( fan->ctl.curve_points, staged->ctl.curve_points, sizeof( fan->ctl.curve_points ) );
+    memcpy( fan->ctl.rpm_points, staged->ctl.rpm_points, sizeof( fan->ctl.rpm_points ) );
+
+    fan->ctl.rpm_point_count = staged->ctl.rpm_point_count;
+
+    fan->ctl.temp_pid.kp_milli     = staged->ctl.temp_pid.kp_milli;
+    fan->ctl.temp_pid.ki_milli     = staged->ctl.temp_pid.ki_milli;
+    fan->ctl.temp_pid.kd_milli     = staged->ctl.temp_pid.kd_milli;
+    fan->ctl.temp_pid.out_min_mpct = staged->ctl.temp_pid.out_min_mpct;
+    fan->ctl.temp_pid.out_max_mpct = staged->ctl.temp_pid.out_max_mpct;
+    fan->ctl.rpm_pid.kp_milli      = staged->ctl.rpm_pid.kp_milli;
+    fan->ctl.rpm_pid.ki_milli      = staged->ctl.rpm_pid.ki_milli;
+    fan->ctl.rpm_pid.out_min_mpct  = staged->ctl.rpm_pid.out_min_mpct;
+    fan->ctl.rpm_pid.out_max_mpct  = staged->ctl.rpm_pid.out_max_mpct;
+
+    staged->ctl.curve_table = NULL;
+}
+
+// Reload the config file and environment between ticks; nothing is re-exported and the fans
+//    are not blipped
+// - Everything is staged and validated first so a bad config changes nothing
+void config_reload() {
+
+    static Fan staged_fans[ MAX_FANS ];
+    static Calibration staged_calibrations[ MAX_FANS ];
+    static ConfigFileKey undo[ CONFIG_FILE_MAX_KEYS * 2 ];
+    int undo_count = 0;
+    ConfigGlobals running;
+    SmoothFilter staged_smooth = { 0 };
+
+    reload_config_received = 0;
+
+    l( INFO, "Reloading config...\n" );
+
+    if( CONFIG_FILE != NULL && ! config_file_apply( true, undo, &undo_count ) ) {
+
+        l( ERROR, "Config reload failed; keeping the running config\n" );
+        config_env_undo( undo, undo_count, true );
+        return;
+    }
+
+    config_globals_save( &running );
+    config_globals_restore( &config_defaults );
+    config_reload_rejected = false;
+
+    config_read();
+
+    // A bad calibration only leaves the fan uncalibrated at startup, but a reload keeps the
+    //    running calibrations rather than drop one
+    if( ! calibration_load( staged_calibrations ) ) { config_invalid(); }
+
+    for( int i = 0; i < fan_count && ! config_reload_rejected; i++ ) {
+
+        // Tachometers are fixed at startup (and fan 0's may come from the CLI)
+        fan_init( &staged_fans[i], i );
+        staged_fans[i].is_tach_enabled    = fans[i].is_tach_enabled;
+        staged_fans[i].bcm_gpio_pin_tach  = fans[i].bcm_gpio_pin_tach;
+        staged_fans[i].tach_pulse_per_rev = fans[i].tach_pulse_per_rev;
+
+        fan_config( &staged_fans[i], staged_calibrations );
+
+        if( ! config_reload_rejected ) { curve_setup( &staged_fans[i] ); }
+    }
+
+    // A new filter starts empty, so only replace it when it changed
+    bool is_smooth_changed = strcmp( SMOOTH_FILTER, running.SMOOTH_FILTER ) != 0 || SMOOTH_WINDOW != running.SMOOTH_WINDOW;
+
+    if( ! config_reload_rejected && is_smooth_changed && ! smooth_setup( &staged_smooth, SMOOTH_FILTER, SMOOTH_WINDOW ) ) {
+
+        l( ERROR, "Error: PWM_FAN_SMOOTH_FILTER must be sma, ema or median with PWM_FAN_SMOOTH_WINDOW 1-%i!\n", SMOOTH_WINDOW_MAX );
+        config_invalid();
+    }
+
+    if( config_reload_rejected ) {
+
+        for( int i = 0; i < fan_count; i++ ) {
+
+            curve_free( &staged_fans[i].ctl );
+        }
+
+        smooth_free( &staged_smooth );
+        config_env_undo( undo, undo_count, true );
+        config_globals_restore( &running );
+
+        l( ERROR, "Config reload rejected; keeping the running config\n" );
+        return;
+    }
+
+    config_env_undo( undo, undo_count, false );
+
+    for( int i = 0; i < fan_count; i++ ) {
+
+        fan_apply_config( &fans[i], &staged_fans[i] );
+    }
+
+    // The staged fans were configured from the staged calibrations
+    memcpy( calibrations, staged_calibrations, sizeof( calibrations ) );
+
+    if( is_smooth_changed ) {
+
+        smooth_free( &cpu_temp_smooth );
+        cpu_temp_smooth = staged_smooth;
+    }
+
+    // Restart the adaptive interval from the new SLEEP_MS
+    adaptive_interval_ms = 0;
+
+    peers_forget_stale( monotonic_ns() );
+
+    l( INFO, "Config reloaded\n" );
+}
+
+// Save calibrations to CALIBRATION_FILE; written to a temp file and renamed so a crash never
+//    leaves a partial file
+bool calibration_save() {
+
+    char tmp_path_str[ CALIBRATION_LINE_MAX ];
+    snprintf( tmp_path_str, sizeof( tmp_path_str ), "%s.tmp", CALIBRATION_FILE );
+
+    FILE *fd_calibration = fopen( tmp_path_str, "w" );
+
+    if( fd_calibration == NULL ) {
+
+        l( ERROR, "Unable to write fan calibration %s: %s\n", tmp_path_str, strerror( errno ) );
+        return false;
+    }
+
+    for( int i = 0; i < MAX_FANS; i++ ) {
+
+        Calibration *cal = &calibrations[i];
+
+        if( ! cal->valid ) { continue; }
+
+        fprintf( fd_calibration, "fan=%i\npwm_gpio=%i\npwm_freq_hz=%i\nmax_duty_cycle=%i\nstart_duty_cycle=%i\nstop_duty_cycle=%i\nrpm=", i, cal->bcm_gpio_pin_pwm, cal->pwm_freq_hz, cal->max_duty_cycle, cal->start_duty_cycle, cal->stop_duty_cycle );
+
+        for( int j = 0; j < cal->rpm_point_count; j++ ) {
+
+            fprintf( fd_calibration, "%s%i:%u", j > 0 ? "," : "", cal->rpm_points[j].duty_cycle, cal->rpm_points[j].rpm );
+        }
+
+        fprintf( fd_calibration, "\n" );
+    }
+
+    if( fclose( fd_calibration ) != 0 || rename( tmp_path_str, CALIBRATION_FILE ) != 0 ) {
+
+        l( ERROR, "Unable to write fan calibration %s: %s\n", CALIBRATION_FILE, strerror( errno ) );
+        unlink( tmp_path_str );
+        return false;
+    }
+
+    l( INFO, "Saved fan calibration to %s\n", CALIBRATION_FILE );
+
+    return true;
+}
+
+// Sleep during calibration; false once halted (the signal cuts the sleep short)
+bool calibrate_sleep_ms( unsigned int sleep_ms ) {
+
+    struct timespec sleep_ts = { sleep_ms / 1000, ( sleep_ms % 1000 ) * 1000000L };
+
+    nanosleep( &sleep_ts, NULL );
+
+    return ! halt_received;
+}
+
+// Set every tachometer fan to `duty_pct` of its MAX_DUTY_CYCLE, let it settle and measure its
+//    steady RPM into `rpm`; false once halted
+// - Steady is two windows in a row within CALIBRATE_STEADY_PCT, or the last of
+//   CALIBRATE_MAX_WINDOWS windows
+bool calibrate_measure( int duty_pct, unsigned int *rpm ) {
+
+    for( int i = 0; i < fan_count; i++ ) {
+
+        if( fans[i].is_tach_enabled ) { pwm_set_duty_cycle( &fans[i], fans[i].ctl.max_duty_cycle * duty_pct / 100 ); }
+    }
+
+    if( ! calibrate_sleep_ms( CALIBRATE_SETTLE_MS ) ) { return false; }
+
+    // Windows start after the settle
+    for( int i = 0; i < fan_count; i++ ) {
+
+        if( fans[i].is_tach_enabled ) { tach_window_rpm( &fans[i] ); }
+    }
+
+    for( int window = 0; window < CALIBRATE_MAX_WINDOWS; window++ ) {
+
+        bool is_steady = true;
+
+        if( ! calibrate_sleep_ms( CALIBRATE_WINDOW_MS ) ) { return false; }
+
+        for( int i = 0; i < fan_count; i++ ) {
+
+            if( ! fans[i].is_tach_enabled ) { continue; }
+
+            unsigned int window_rpm = tach_window_rpm( &fans[i] );
+            unsigned int delta_rpm  = window_rpm > rpm[i] ? window_rpm - rpm[i] : rpm[i] - window_rpm;
+
+            if( window == 0 || delta_rpm * 100 > rpm[i] * CALIBRATE_STEADY_PCT ) { is_steady = false; }
+
+            rpm[i] = window_rpm;
+        }
+
+        if( is_steady ) { break; }
+    }
+
+    return true;
+}
+
+// Whether a sweep step gives any fan a duty cycle its last recorded point doesn't have
+bool calibrate_is_new_step( int duty_pct ) {
+
+    for( int i = 0; i < fan_count; i++ ) {
+
+        Calibration *cal = &calibrations[i];
+
+        if( ! fans[i].is_tach_enabled ) { continue; }
+
+        if( cal->rpm_point_count == 0 || cal->rpm_points[ cal->rpm_point_count - 1 ].duty_cycle != fans[i].ctl.max_duty_cycle * duty_pct / 100 ) { return true; }
     }
 
-    return sum / CPU_TEMP_SMOOTH_ARR_SIZE;
+    return false;
 }
 
-// Quartic bezier easing function
-// - https://easings.net/#easeInOutQuart
-unsigned short quartic_bezier_easing(
-    float cur_val,
-    unsigned short range_1_low,
-    unsigned short range_1_high,
-    unsigned short range_2_low,
-    unsigned short range_2_high ) {
+// Calibrate every fan with a tachometer and save the results to CALIBRATION_FILE
+// - Sweeps down from MAX_DUTY_CYCLE to 0 measuring steady RPM per step; the lowest step still
+//   spinning is the stop duty cycle. Then sweeps up from a standstill; the first step that
+//   spins the fan is the start duty cycle. Fans without a tachometer keep their calibration
+// - Returns false if halted or a fan never started
+bool calibrate_run() {
 
-    // Just in case we're OOB for the passed value
-    // - This can happen using CPU temp smoothing because the averages may fall out of the
-    //   singular instantaneous check in the main loop
-    if( cur_val < range_1_low )  { return MIN_DUTY_CYCLE; }
-    if( cur_val > range_1_high ) { return MAX_DUTY_CYCLE; }
+    unsigned int rpm[ MAX_FANS ] = { 0 };
+    bool is_started[ MAX_FANS ] = { false };
+    int tach_fan_count = 0, started_count = 0;
 
-    unsigned short range_1_delta = range_1_high - range_1_low,
-                   range_2_delta = range_2_high - range_2_low;
+    for( int i = 0; i < fan_count; i++ ) {
 
-    float pct_range_1_delta = 1 - ( ( range_1_high - cur_val ) / range_1_delta );
-    float pct_quartic_bezier_range_2_delta;
+        if( ! fans[i].is_tach_enabled ) { continue; }
 
-    if( pct_range_1_delta < 0.5 ) {
+        Calibration *cal = &calibrations[i];
 
-        pct_quartic_bezier_range_2_delta = 8 * pow( pct_range_1_delta, 4 );
+        memset( cal, 0, sizeof( *cal ) );
 
-    } else {
+        cal->bcm_gpio_pin_pwm = fans[i].bcm_gpio_pin_pwm;
+        cal->pwm_freq_hz      = fans[i].pwm_freq_hz;
+        cal->max_duty_cycle   = fans[i].ctl.max_duty_cycle;
 
-        pct_quartic_bezier_range_2_delta = 1 - ( pow( -2 * pct_range_1_delta + 2, 4 ) ) / 2;
+        tach_fan_count++;
     }
 
-    unsigned short quartic_bezier_val = round( pct_quartic_bezier_range_2_delta * range_2_delta + range_2_low );
+    if( tach_fan_count == 0 ) {
+
+        l( ERROR, "Error: calibrate needs a tachometer; pass {tach_pin} {tach_pulse_per_rotation} or set PWM_FAN_<n>_TACH_PIN!\n" );
+        return false;
+    }
 
-    // Ensure we don't pass invalid duty cycle
-    // - Should not happen due to above temp range check
-    if( quartic_bezier_val < MIN_DUTY_CYCLE )  { return MIN_DUTY_CYCLE; }
-    if( quartic_bezier_val > MAX_DUTY_CYCLE ) { return MAX_DUTY_CYCLE; }
+    l( INFO, "Calibrating %i fan(s) in steps of %u%% duty cycle, %ums to settle per step...\n", tach_fan_count, CALIBRATE_STEP, CALIBRATE_SETTLE_MS );
 
-    return quartic_bezier_val;
-}
+    // Down from full speed; points are collected in reverse and flipped once done
+    for( int duty_pct = 100; duty_pct >= 0; duty_pct = duty_pct > 0 && duty_pct < CALIBRATE_STEP ? 0 : duty_pct - CALIBRATE_STEP ) {
+
+        // A small MAX_DUTY_CYCLE maps several steps to one duty cycle; each is measured once
+        if( ! calibrate_is_new_step( duty_pct ) ) { continue; }
+
+        if( ! calibrate_measure( duty_pct, rpm ) ) { return false; }
+
+        for( int i = 0; i < fan_count; i++ ) {
+
+            if( ! fans[i].is_tach_enabled ) { continue; }
+
+            Calibration *cal = &calibrations[i];
+            unsigned short duty_cycle = fans[i].ctl.max_duty_cycle * duty_pct / 100;
+
+            // Another fan's duty cycle changed at this step but not this one's
+            if( cal->rpm_point_count > 0 && cal->rpm_points[ cal->rpm_point_count - 1 ].duty_cycle == duty_cycle ) { continue; }
+
+            cal->rpm_points[ cal->rpm_point_count ].duty_cycle = duty_cycle;
+            cal->rpm_points[ cal->rpm_point_count ].rpm        = rpm[i];
+            cal->rpm_point_count++;
+
+            if( rpm[i] > 0 ) { cal->stop_duty_cycle = duty_cycle; }
+
+            l( INFO, "Fan %i duty cycle %3i (down): %u RPM\n", i, duty_cycle, rpm[i] );
+        }
+    }
+
+    // Up from a standstill until every fan started
+    for( int duty_pct = 0; duty_pct <= 100 && started_count < tach_fan_count; duty_pct = duty_pct < 100 && duty_pct + CALIBRATE_STEP > 100 ? 100 : duty_pct + CALIBRATE_STEP ) {
+
+        if( ! calibrate_measure( duty_pct, rpm ) ) { return false; }
+
+        for( int i = 0; i < fan_count; i++ ) {
+
+            if( ! fans[i].is_tach_enabled || is_started[i] || rpm[i] == 0 ) { continue; }
+
+            calibrations[i].start_duty_cycle = fans[i].ctl.max_duty_cycle * duty_pct / 100;
+            is_started[i] = true;
+            started_count++;
+
+            l( INFO, "Fan %i duty cycle %3i (up): started at %u RPM\n", i, calibrations[i].start_duty_cycle, rpm[i] );
+        }
+    }
+
+    for( int i = 0; i < fan_count; i++ ) {
+
+        if( ! fans[i].is_tach_enabled ) { continue; }
+
+        Calibration *cal = &calibrations[i];
+
+        for( int j = 0; j < cal->rpm_point_count / 2; j++ ) {
+
+            RpmPoint swap = cal->rpm_points[j];
 
-// Handler for tachometer pull-down (ie: rotation pulse)
-void on_tach_pull_down() {
+            cal->rpm_points[j] = cal->rpm_points[ cal->rpm_point_count - 1 - j ];
+            cal->rpm_points[ cal->rpm_point_count - 1 - j ] = swap;
+        }
+
+        if( ! is_started[i] ) {
 
-    struct timeval cur_epoch;
-    gettimeofday( &cur_epoch, NULL );
+            l( ERROR, "Error: Fan %i never started; check its tachometer pin and wiring!\n", i );
+            return false;
+        }
 
-    float delta_time_ms = ( cur_epoch.tv_sec - tach_last_fall_epoch.tv_sec ) * 1000.0f + ( cur_epoch.tv_usec - tach_last_fall_epoch. tv_usec) / 1000.0f;
+        const char *invalid_str = calibration_invalid_reason( cal );
 
-    gettimeofday( &tach_last_fall_epoch, NULL );
+        if( invalid_str != NULL ) {
 
-    // Reject spuriously short pulses
-    if( delta_time_ms < TACH_MIN_TIME_DELTA_MS ) return;
+            l( ERROR, "Error: Fan %i calibration is unusable (%s); try a smaller PWM_FAN_CALIBRATE_STEP or larger PWM_FAN_MAX_DUTY_CYCLE!\n", i, invalid_str );
+            return false;
+        }
 
-    pthread_mutex_lock( &mutex_tach_rpm );
+        cal->valid = true;
 
-    tach_rpm = round( ( 1000.0 / delta_time_ms ) / tach_pulse_per_rev * 60 );
+        l( INFO, "Fan %i: starts at duty cycle %i, stalls below %i, %u RPM at max\n", i, cal->start_duty_cycle, cal->stop_duty_cycle, cal->rpm_points[ cal->rpm_point_count - 1 ].rpm );
+    }
 
-    pthread_mutex_unlock( &mutex_tach_rpm );
+    return calibration_save();
 }
 
-// Setup the GPIO polling interrupt for the tachomter using the true GPIO number
-void setup_tach_gpio_interrupt( unsigned short true_gpio_num ) {
+// Column of a replay trace header, or -1
+int replay_find_column( char columns[][ CONFIG_KEY_MAX ], int column_count, const char *name ) {
 
-    l( INFO, "Setting up GPIO polling interrupt on true GPIO #%i...\n", true_gpio_num );
+    for( int i = 0; i < column_count; i++ ) {
+
+        if( strcmp( columns[i], name ) == 0 ) { return i; }
+    }
 
-    char gpio_value_path[32];
-    snprintf( gpio_value_path, sizeof( gpio_value_path ), "/sys/class/gpio/gpio%i/value", true_gpio_num );
+    return -1;
+}
 
-    fd_gpio_tach_value = open( gpio_value_path, O_RDONLY | O_NONBLOCK );
+// Split a trace line on commas/whitespace in place; returns the # of fields
+int replay_split( char *line, char *fields[] ) {
 
-    if( fd_gpio_tach_value < 0 ) {
+    int field_count = 0;
 
-        l( ERROR, "Failed to open GPIO value file %s, error: %s\n", gpio_value_path, strerror( errno ) );
+    for( char *field = strtok( line, ", \t\r\n" ); field != NULL && field_count < REPLAY_MAX_COLUMNS; field = strtok( NULL, ", \t\r\n" ) ) {
+
+        fields[ field_count++ ] = field;
+    }
+
+    return field_count;
+}
+
+// Replay a temp trace through the main loop's smoothing and decision code as fast as it
+//    parses; the decided series is written as telemetry to `out_path` (optional) and summary
+//    stats are logged
+// - Traces are telemetry/csvdebug CSV (`cur_temp_c` plus optional `t_ms` and tach RPM
+//   columns) or headerless `<temp_c>` or `<t_ms> <temp_c>` lines, ie: a fake backend temp
+//   script; without times, samples are PWM_FAN_SLEEP_MS apart
+void replay_run( const char *trace_path, const char *out_path ) {
+
+    FILE *fd_trace = strcmp( trace_path, "-" ) == 0 ? stdin : fopen( trace_path, "r" );
+
+    if( fd_trace == NULL ) {
+
+        l( ERROR, "Unable to open replay trace %s: %s\n", trace_path, strerror( errno ) );
         clean_up_and_exit( 1 );
     }
 
-    // Dummy read to clear any initial value
-    char dumb_buffer[2];
-    read( fd_gpio_tach_value, dumb_buffer, sizeof( dumb_buffer ) );
+    // The series is telemetry; csv unless PWM_FAN_TELEMETRY picked another format
+    if( out_path != NULL ) {
 
-    // Setup polling file descriptor
-    poll_tach_gpio.fd = fd_gpio_tach_value;
+        TELEMETRY_FILE = ( char* ) out_path;
 
-    // Priority data (rising or rising edge)
-    poll_tach_gpio.events = POLLPRI;
+        if( telemetry_format == TELEMETRY_OFF ) { telemetry_format = TELEMETRY_CSV; }
 
-    l( INFO, "GPIO polling interrupt setup on true GPIO #%i!\n", true_gpio_num );
-}
+    } else {
 
-// Setup the tachometer for measuring fan RPM
-void tach_gpio_setup() {
+        telemetry_format = TELEMETRY_OFF;
+    }
 
-    l( INFO, "Tachometer support enabled on GPIO #%i! Setting up pull-down event handler...\n", bcm_gpio_pin_tach );
+    // Summary goes to stderr when the series has stdout
+    FILE *fd_summary = out_path != NULL && strcmp( out_path, "-" ) == 0 ? stderr : stdout;
 
-    gpio_true_tach_num = get_gpio_sysfs_num( LOOKUP_GPIO, bcm_gpio_pin_tach );
-    l( INFO, "Tachometer true GPIO found: %i\n", gpio_true_tach_num );
+    static char out_buffer[ TELEMETRY_BUFFER_SIZE ];
+    size_t out_len = 0;
 
-    char gpio_path_str[17] = "/sys/class/gpio/";
+    char line[ REPLAY_LINE_MAX ];
+    char *fields[ REPLAY_MAX_COLUMNS ];
+    char columns[ REPLAY_MAX_COLUMNS ][ CONFIG_KEY_MAX ];
+    int column_count = 0;
+    int temp_column = 0, time_column = -1, rpm_columns[ MAX_FANS ];
 
-    // Ensure unloaded before we start
-    open_fd( "/sys/class/gpio/unexport", &fd_gpio_tach_unexport, "w" );
-    gpio_set_export( false );
+    ReplayStats stats[ MAX_FANS ];
+    memset( stats, 0, sizeof( stats ) );
 
-    // Setup file descriptors/handles for /sys/class control points
-    open_fd( "/sys/class/gpio/export", &fd_gpio_tach_export, "w" );
-    gpio_set_export( true );
+    unsigned long sample_count = 0, skipped_count = 0, line_num = 0;
+    long long first_ns = 0, prev_ns = 0;
+    int prev_temp_mc = 0, peak_temp_mc = 0;
 
-    char gpio_pin_path_str[32];
-    snprintf( gpio_pin_path_str, sizeof( gpio_pin_path_str ), "%sgpio%i/", gpio_path_str, gpio_true_tach_num );
+    for( int i = 0; i < MAX_FANS; i++ ) { rpm_columns[i] = -1; }
 
-    char gpio_active_low_path_str[48];
-    snprintf( gpio_active_low_path_str, sizeof( gpio_active_low_path_str ), "%sactive_low", gpio_pin_path_str );
+    while( fgets( line, sizeof( line ), fd_trace ) != NULL ) {
 
-    // Wait for GPIO settings interface before continuing
-    wait_for_file_with_timeout( gpio_active_low_path_str, 5 );
+        line_num++;
 
-    open_fd( gpio_active_low_path_str, &fd_gpio_tach_active_low, "w" );
+        if( line[0] == '#' ) { continue; }
 
-    char gpio_direction_path_str[48];
-    snprintf( gpio_direction_path_str, sizeof( gpio_direction_path_str ), "%sdirection", gpio_pin_path_str );
-    open_fd( gpio_direction_path_str, &fd_gpio_tach_direction, "w" );
+        int field_count = replay_split( line, fields );
+        int temp_mc;
 
-    char gpio_edge_path_str[64];
-    snprintf( gpio_edge_path_str, sizeof( gpio_edge_path_str ), "%sedge", gpio_pin_path_str );
-    open_fd( gpio_edge_path_str, &fd_gpio_tach_edge, "w" );
+        if( field_count == 0 ) { continue; }
 
-    l( INFO, "Setting active low to 0...\n" );
+        // A header names the columns; csvdebug output has log lines around it
+        if( sample_count == 0 && column_count == 0 && ! parse_millidegrees( fields[0], &temp_mc ) ) {
 
-    fprintf( fd_gpio_tach_active_low, "0" );
-    fflush( fd_gpio_tach_active_low );
+            char header_columns[ REPLAY_MAX_COLUMNS ][ CONFIG_KEY_MAX ];
 
-    l( INFO, "Active low set to 0! Setting direction to \"in\"...\n" );
+            for( int i = 0; i < field_count; i++ ) {
+
+                snprintf( header_columns[i], CONFIG_KEY_MAX, "%s", fields[i] );
+            }
 
-    fprintf( fd_gpio_tach_direction, "in" );
-    fflush( fd_gpio_tach_direction );
+            if( replay_find_column( header_columns, field_count, "cur_temp_c" ) < 0 ) {
 
-    l( INFO, "Direction set to \"in\"! Setting edge to \"falling\"...\n" );
+                skipped_count++;
+                continue;
+            }
 
-    fprintf( fd_gpio_tach_edge, "falling" );
-    fflush( fd_gpio_tach_edge );
+            memcpy( columns, header_columns, sizeof( columns ) );
+            column_count = field_count;
 
-    l( INFO, "Edge set to \"falling\"!\n" );
+            temp_column = replay_find_column( columns, column_count, "cur_temp_c" );
+            time_column = replay_find_column( columns, column_count, "t_ms" );
 
-    setup_tach_gpio_interrupt( gpio_true_tach_num );
+            for( int i = 0; i < fan_count; i++ ) {
 
-    l( INFO, "Tachometer support setup!\n" );
-}
+                char rpm_column[ CONFIG_KEY_MAX ];
+                snprintf( rpm_column, sizeof( rpm_column ), "fan%i_tach_rpm", i );
 
-// Polling thread function for the tachometer
-// - Uses own thread for independent polling loop to monitor for GPIO events
-void* polling_thread_tach_func(void* arg) {
+                rpm_columns[i] = replay_find_column( columns, column_count, fan_count == 1 ? "tach_rpm" : rpm_column );
 
-    char dumb_buffer[64];
-    int poll_return;
+                // The series keeps a traced fan's RPM, ie: to compare a pid_rpm replay with the
+                //    original
+                if( rpm_columns[i] >= 0 ) { fans[i].is_tach_enabled = true; }
+            }
+
+            continue;
+        }
 
-    // Track time since last pulse so we can detect 0 RPM
-    struct timeval last_pulse_time, current_time;
-    float time_since_last_pulse_ms;
+        // Headerless two column lines are `<t_ms> <temp_c>`
+        if( column_count == 0 && field_count >= 2 ) {
 
-    // Get the current time as the initial last pulse time
-    gettimeofday( &last_pulse_time, NULL );
+            temp_column = 1;
+            time_column = 0;
+        }
 
-    while( ! halt_received ) {
+        if( temp_column >= field_count || ! parse_millidegrees( fields[ temp_column ], &temp_mc ) ) {
 
-        // Wait for an event on the GPIO pin
-        poll_return = poll( &poll_tach_gpio, 1, RPM_TIMEOUT_MS );
+            l( DEBUG, "Replay trace %s line %lu: no temp, skipped\n", trace_path, line_num );
+            skipped_count++;
+            continue;
+        }
 
-        if( poll_return > 0 && poll_tach_gpio.revents & POLLPRI ) {
+        long long t_ns = time_column >= 0 && time_column < field_count ? ( long long ) ( strtod( fields[ time_column ], NULL ) * 1000000 ) : ( long long ) sample_count * SLEEP_MS * 1000000;
 
-            // Reset the file pointer to read from the start
-            lseek( poll_tach_gpio.fd, 0, SEEK_SET );
+        if( sample_count == 0 ) {
 
-            // Read to clear the event
-            read( poll_tach_gpio.fd, dumb_buffer, sizeof( dumb_buffer ) );
+            // As at startup, the grace period runs from the first sample
+            first_ns = t_ns;
 
-            // Calculate the RPM
-            on_tach_pull_down();
+            for( int i = 0; i < fan_count; i++ ) { controller_start( &fans[i].ctl, t_ns ); }
 
-            // Update the last pulse time
-            gettimeofday( &last_pulse_time, NULL );
+            // Each replay is a complete series, so a reused output file starts over; opened once
+            //    the trace's header has picked the RPM columns the series' header lists
+            if( telemetry_format != TELEMETRY_OFF ) { telemetry_open( true ); }
 
         } else {
 
-            // Either timeout or error, check the time since the last pulse
-            gettimeofday(&current_time, NULL);
-            time_since_last_pulse_ms = ( current_time.tv_sec - last_pulse_time.tv_sec ) * 1000.0f + ( current_time.tv_usec - last_pulse_time.tv_usec ) / 1000.0f;
+            // The previous decisions held until now
+            long long held_ms = t_ns > prev_ns ? ( t_ns - prev_ns ) / 1000000 : 0;
 
-            // If the time since the last pulse exceeds our threshold, set RPM to 0
-            if( time_since_last_pulse_ms >= RPM_TIMEOUT_MS ) {
+            for( int i = 0; i < fan_count; i++ ) {
 
-                pthread_mutex_lock( &mutex_tach_rpm );
-                tach_rpm = 0;
-                pthread_mutex_unlock( &mutex_tach_rpm );
+                stats[i].mode_ms[ fans[i].ctl.decided_mode_int ] += held_ms;
+                stats[i].duty_ms += held_ms * fans[i].ctl.duty_cycle_set_val;
+
+                if( fans[i].ctl.duty_cycle_set_val > 0 )       { stats[i].on_ms += held_ms; }
+                if( prev_temp_mc > fans[i].ctl.max_temp_mc )   { stats[i].over_max_ms += held_ms; }
             }
         }
-    }
 
-    pthread_exit( NULL );
-}
+        smooth_push( &cpu_temp_smooth, temp_mc );
 
-// Setup the tachometer polling thread
-void tach_polling_setup() {
+        int smooth_temp_mc = smooth_value( &cpu_temp_smooth );
 
-    int thread_create_status;
+        for( int i = 0; i < fan_count; i++ ) {
 
-    // Creating the polling thread
-    thread_create_status = pthread_create( &polling_thread_tach, NULL, polling_thread_tach_func, NULL );
+            Fan *fan = &fans[i];
+            unsigned short prev_mode_int   = fan->ctl.decided_mode_int;
+            unsigned short prev_duty_cycle = fan->ctl.duty_cycle_set_val;
 
-    if( thread_create_status != 0 ) {
+            if( rpm_columns[i] >= 0 && rpm_columns[i] < field_count ) { fan->tach_rpm = strtoul( fields[ rpm_columns[i] ], NULL, 10 ); }
 
-        l( ERROR, "Failed to create the polling thread\n" );
+            fan_decide( fan, temp_mc, smooth_temp_mc, t_ns );
+
+            if( sample_count > 0 && fan->ctl.decided_mode_int != prev_mode_int )       { stats[i].transitions++; }
+            if( fan->ctl.duty_cycle_set_val > 0 && ( sample_count == 0 || prev_duty_cycle == 0 ) ) { stats[i].starts++; }
+        }
+
+        if( telemetry_format != TELEMETRY_OFF ) {
+
+            TelemetrySample sample;
+            memset( &sample, 0, sizeof( sample ) );
+
+            sample.t_ns           = t_ns;
+            sample.temp_mc        = temp_mc;
+            sample.smooth_temp_mc = smooth_temp_mc;
+
+            for( int i = 0; i < fan_count; i++ ) {
+
+                sample.mode[i]       = fans[i].ctl.decided_mode_int;
+                sample.duty_cycle[i] = fans[i].ctl.duty_cycle_set_val;
+                sample.rpm[i]        = fans[i].tach_rpm;
+            }
+
+            if( out_len + TELEMETRY_LINE_MAX > sizeof( out_buffer ) ) {
+
+                telemetry_write( out_buffer, out_len );
+                out_len = 0;
+            }
+
+            out_len += telemetry_format_sample( out_buffer + out_len, &sample );
+        }
+
+        if( temp_mc > peak_temp_mc || sample_count == 0 ) { peak_temp_mc = temp_mc; }
+
+        prev_ns      = t_ns;
+        prev_temp_mc = temp_mc;
+        sample_count++;
+    }
+
+    if( out_len > 0 ) { telemetry_write( out_buffer, out_len ); }
+
+    if( fd_trace != stdin ) { fclose( fd_trace ); }
+
+    if( sample_count == 0 ) {
+
+        l( ERROR, "Replay trace %s has no temp samples!\n", trace_path );
         clean_up_and_exit( 1 );
     }
-}
 
-////////////////////////////////////////////////////////////////////////////////////
+    long long duration_ms = ( prev_ns - first_ns ) / 1000000;
+
+    fprintf( fd_summary, "Replayed %lu samples (%lu lines skipped) over %llims of trace, peak temp " MC_FMT "C\n", sample_count, skipped_count, duration_ms, MC_FMT_ARGS( peak_temp_mc ) );
+
+    for( int i = 0; i < fan_count; i++ ) {
+
+        fprintf( fd_summary, "Fan %i: on %lli.%01llis (%lli%%), %lu starts, %lu mode transitions, over MAX_TEMP_C %lli.%01llis, mean duty cycle %lli%%\n", i,
+            stats[i].on_ms / 1000, stats[i].on_ms % 1000 / 100, duration_ms > 0 ? stats[i].on_ms * 100 / duration_ms : 0,
+            stats[i].starts, stats[i].transitions,
+            stats[i].over_max_ms / 1000, stats[i].over_max_ms % 1000 / 100,
+            duration_ms > 0 ? stats[i].duty_ms / duration_ms : 0 );
+
+        for( int j = 0; j < FAN_MODE_COUNT; j++ ) {
+
+            if( stats[i].mode_ms[j] == 0 ) { continue; }
+
+            fprintf( fd_summary, " - %-9s %lli.%01llis\n", get_fan_mode_str( j ), stats[i].mode_ms[j] / 1000, stats[i].mode_ms[j] % 1000 / 100 );
+        }
+    }
+}
 
 int main( int argc, char* argv[] ) {
 
@@ -958,6 +5855,10 @@ int main( int argc, char* argv[] ) {
     signal( SIGINT, handle_halt );
     signal( SIGTERM, handle_halt );
 
+    // Register SIGUSR1 stats dump and SIGHUP config reload handlers
+    signal( SIGUSR1, handle_dump_stats );
+    signal( SIGHUP, handle_reload );
+
     // Disable stdout buffering so logs show up in journal
     setbuf( stdout, NULL );
 
@@ -972,6 +5873,8 @@ int main( int argc, char* argv[] ) {
         l( INFO, "\nRaspberry Pi CPU PWM Fan Controller v2 \n"
                  "\n"
                  "Usage: ./pwm_fan_control2 {tach_pin optional} {tach_pulse_per_rotation optional}\n"
+                 "       ./pwm_fan_control2 replay {trace_file} {telemetry_out optional}\n"
+                 "       ./pwm_fan_control2 calibrate {tach_pin optional} {tach_pulse_per_rotation optional}\n"
                  "\n"
                  " - Watches CPU temp and sets PWM fan speed accordingly.\n"
                  " - Configured through environment variables.\n"
@@ -994,9 +5897,20 @@ int main( int argc, char* argv[] ) {
                  "  Run w/debug logging + tachometer on GPIO pin #24 with 2 pulses per revolution:\n"
                  "    ./pwm_fan_tach2 debug 24 2\n"
                  "\n"
+                 "  Calibrate the fan on a tachometer on GPIO pin #24 with 2 pulses per revolution:\n"
+                 "    ./pwm_fan_tach2 calibrate 24 2\n"
+                 "\n"
+                 "  Replay a recorded temp trace offline and write the decided series as CSV:\n"
+                 "    ./pwm_fan_tach2 replay trace.csv replayed.csv\n"
+                 "\n"
+                 "  Share one fan between hosts; publish from a fanless peer, listen on the fan owner:\n"
+                 "    PWM_FAN_FANS=0 PWM_FAN_PEER_PUBLISH=udp:fan-owner:9720 ./pwm_fan_tach2\n"
+                 "    PWM_FAN_PEER_LISTEN=udp:9720 ./pwm_fan_tach2\n"
+                 "\n"
                  "Exit status:\n"
                  "  0 if OK\n"
                  "  1 if error\n"
+                 "  3 if a fan faulted with PWM_FAN_STALL_EXIT=1 (stalled through every kick-start)\n"
                  "\n"
                  "Online help, docs & bug reports: <https://github.com/folkhack/raspberry-pi-pwm-fan-2> \n"
         );
@@ -1014,10 +5928,25 @@ int main( int argc, char* argv[] ) {
     if( argc > 1 && strcmp( argv[1], "csvdebug" ) == 0 ) {
 
         csv_debug_logging_enabled = true;
+        TELEMETRY = "csv";
+    }
+
+    // Replay a trace offline instead of driving hardware
+    bool is_replay = argc > 1 && strcmp( argv[1], "replay" ) == 0;
+
+    // Calibrate the fans instead of controlling them
+    bool is_calibrate = argc > 1 && strcmp( argv[1], "calibrate" ) == 0;
+
+    if( is_replay && ( argc < 3 || argc > 4 ) ) {
+
+        l( ERROR, "Error: replay needs a trace file and optionally a telemetry output file.\n" );
+        l( ERROR, "Use --help for usage information.\n" );
+
+        clean_up_and_exit( 1 );
     }
 
     // Check if the required number of arguments is provided if using tachometer
-    if( argc > 2 && argc != 4 ) {
+    if( ! is_replay && argc > 2 && argc != 4 ) {
 
         l( ERROR, "Error: Incorrect number of arguments.\n" );
         l( ERROR, "Use --help for usage information.\n" );
@@ -1025,7 +5954,7 @@ int main( int argc, char* argv[] ) {
         clean_up_and_exit( 1 );
     }
 
-    is_tach_enabled = argc == 4;
+    bool is_tach_arg = ! is_replay && argc == 4;
 
     ////////////////////////////////////////////////////////////////////////////////
     //
@@ -1033,29 +5962,59 @@ int main( int argc, char* argv[] ) {
     //  - See readme.md for documentation
     //
 
-    if( getenv( "PWM_FAN_BCM_GPIO_PIN_PWM" ) ) sscanf( getenv( "PWM_FAN_BCM_GPIO_PIN_PWM" ), "%hu", &BCM_GPIO_PIN_PWM );;
-    if( getenv( "PWM_FAN_PWM_FREQ_HZ" ) )      sscanf( getenv( "PWM_FAN_PWM_FREQ_HZ" ),      "%hu", &PWM_FREQ_HZ );
-    if( getenv( "PWM_FAN_MIN_DUTY_CYCLE" ) )   sscanf( getenv( "PWM_FAN_MIN_DUTY_CYCLE" ),   "%hu", &MIN_DUTY_CYCLE );
-    if( getenv( "PWM_FAN_MAX_DUTY_CYCLE" ) )   sscanf( getenv( "PWM_FAN_MAX_DUTY_CYCLE" ),   "%hu", &MAX_DUTY_CYCLE );
-    if( getenv( "PWM_FAN_FAN_OFF_GRACE_MS" ) ) sscanf( getenv( "PWM_FAN_FAN_OFF_GRACE_MS" ), "%hu", &FAN_OFF_GRACE_MS );
-    if( getenv( "PWM_FAN_SLEEP_MS" ) )         sscanf( getenv( "PWM_FAN_SLEEP_MS" ),         "%i",  &SLEEP_MS );
-    if( getenv( "PWM_FAN_MIN_OFF_TEMP_C" ) )   sscanf( getenv( "PWM_FAN_MIN_OFF_TEMP_C" ),   "%f",  &MIN_OFF_TEMP_C );
-    if( getenv( "PWM_FAN_MIN_ON_TEMP_C" ) )    sscanf( getenv( "PWM_FAN_MIN_ON_TEMP_C" ),    "%f",  &MIN_ON_TEMP_C );
-    if( getenv( "PWM_FAN_MAX_TEMP_C" ) )       sscanf( getenv( "PWM_FAN_MAX_TEMP_C" ),       "%f",  &MAX_TEMP_C );
+    if( getenv( "PWM_FAN_CONFIG_FILE" ) )      CONFIG_FILE = getenv( "PWM_FAN_CONFIG_FILE" );
 
-    l( DEBUG, "\nConfig:\n" );
-    l( DEBUG, " - BCM_GPIO_PIN_PWM = %i\n", BCM_GPIO_PIN_PWM );
-    l( DEBUG, " - PWM_FREQ_HZ      = %i\n", PWM_FREQ_HZ );
-    l( DEBUG, " - MIN_DUTY_CYCLE   = %i\n", MIN_DUTY_CYCLE );
-    l( DEBUG, " - MAX_DUTY_CYCLE   = %i\n", MAX_DUTY_CYCLE );
-    l( DEBUG, " - MIN_OFF_TEMP_C   = %f\n", MIN_OFF_TEMP_C );
-    l( DEBUG, " - MIN_ON_TEMP_C    = %f\n", MIN_ON_TEMP_C );
-    l( DEBUG, " - MAX_TEMP_C       = %f\n", MAX_TEMP_C );
-    l( DEBUG, " - FAN_OFF_GRACE_MS = %i\n", FAN_OFF_GRACE_MS );
-    l( DEBUG, " - SLEEP_MS         = %i\n", SLEEP_MS );
-    l( DEBUG, "\n" );
+    if( CONFIG_FILE != NULL && ! config_file_apply( false, NULL, NULL ) ) {
+
+        clean_up_and_exit( 1 );
+    }
+
+    // Defaults a reload starts from
+    config_globals_save( &config_defaults );
+
+    config_read();
+
+    if( ! smooth_setup( &cpu_temp_smooth, SMOOTH_FILTER, SMOOTH_WINDOW ) ) {
+
+        l( ERROR, "Error: PWM_FAN_SMOOTH_FILTER must be sma, ema or median with PWM_FAN_SMOOTH_WINDOW 1-%i!\n", SMOOTH_WINDOW_MAX );
+        clean_up_and_exit( 1 );
+    }
+
+    // Calibrate measures the fans against their configured limits through the tachometer
+    //    thread, so no calibration is applied and the reactor is off
+    if( is_calibrate ) {
 
-    for( int i = 0; i < CPU_TEMP_SMOOTH_ARR_SIZE; i++ ) { cpu_temp_smooth_arr[i] = MAX_TEMP_C; }
+        REACTOR = false;
+
+    } else {
+
+        calibration_load( calibrations );
+    }
+
+    // Fans start from the global config; fan 0's tachometer can also come from the CLI
+    for( unsigned int i = 0; i < FAN_COUNT; i++ ) {
+
+        fan_init( &fans[i], i );
+        fan_count++;
+
+        if( i == 0 && is_tach_arg ) {
+
+            fans[i].is_tach_enabled    = true;
+            fans[i].bcm_gpio_pin_tach  = ( unsigned short ) strtoul( argv[2], NULL, 10 );
+            fans[i].tach_pulse_per_rev = ( unsigned short ) strtoul( argv[3], NULL, 10 );
+        }
+
+        fan_config( &fans[i], calibrations );
+        curve_setup( &fans[i] );
+
+        if( fans[i].is_tach_enabled ) { is_tach_enabled = true; }
+    }
+
+    if( is_replay ) {
+
+        replay_run( argv[2], argc == 4 ? argv[3] : NULL );
+        clean_up_and_exit( 0 );
+    }
 
     ////////////////////////////////////////////////////////////////////////////////
     //
@@ -1064,162 +6023,317 @@ int main( int argc, char* argv[] ) {
 
     l( INFO, "Starting PWM fan controller...\n" );
 
-    // Setup CSV headers if needed
-    if( csv_debug_logging_enabled ) {
-
-        printf( "cur_temp_c,decided_mode,duty_cycle_set_val" );
+    // Before any thread starts so they all inherit the timer slack
+    if( POWER_SAVE ) { power_save_setup(); }
 
-        if( is_tach_enabled ) {
+    // Resolve the PWM chip and GPIO base for both PWM and tachometer setup; a publish-only
+    //    peer has neither
+    if( fan_count > 0 ) { topology_setup(); }
 
-            printf( ",tach_rpm" );
-        }
+    // Setup the PWM interface for controlling the fan speeds
+    for( int i = 0; i < fan_count; i++ ) {
 
-        printf( "\n" );
+        pwm_setup( &fans[i] );
     }
 
-    // Get the Raspberry Pi model for both PWM and tachometer setup
-    get_raspberry_pi_model();
+    cpu_temp_setup();
+
+    is_setup = true;
 
-    // Setup the PWM interface for controlling the fan speed
-    pwm_setup();
+    if( EVENT_MODE ) { thermal_events_setup(); }
+
+    if( FEEDFORWARD ) { feedforward_setup(); }
+
+    if( PEER_PUBLISH[0] != '\0' || PEER_LISTEN[0] != '\0' ) { peers_setup(); }
 
     if( is_tach_enabled ) {
 
         l( INFO, "Starting tachometer...\n" );
 
-        bcm_gpio_pin_tach  = ( unsigned short ) strtoul( argv[2], NULL, 10 );
-        tach_pulse_per_rev = ( unsigned short ) strtoul( argv[3], NULL, 10 );
+        for( int i = 0; i < fan_count; i++ ) {
+
+            if( ! fans[i].is_tach_enabled ) { continue; }
+
+            l( INFO, "Monitoring fan %i GPIO pin: %d, Pulses per revolution: %d\n", i, fans[i].bcm_gpio_pin_tach, fans[i].tach_pulse_per_rev );
+
+            if( tach_backend == TACH_BACKEND_CDEV ) {
+
+                tach_cdev_setup( &fans[i] );
+
+            } else {
+
+                tach_gpio_setup( &fans[i] );
+            }
+        }
+
+        // One thread polls every fan's tachometer unless the reactor handles their edges
+        if( ! REACTOR ) { tach_polling_setup(); }
+    }
+
+    // Other fans' calibrations are kept when the new ones are saved
+    if( is_calibrate ) {
+
+        calibration_load( calibrations );
+
+        bool is_calibrated = calibrate_run();
+
+        halt_received = 1;
+
+        l( INFO, "Setting fans to MAX_DUTY_CYCLE before exit...\n" );
+        pwm_set_max_duty_cycle_all();
+
+        if( is_tach_enabled ) { tach_polling_stop(); }
+
+        clean_up_and_exit( is_calibrated ? 0 : 1 );
+    }
+
+    // Blip fans to full duty cycle together; the main loop starts right away and holds them
+    //    there until the blip ends, filling the temp filter in the meantime
+    long long blip_end_ns = monotonic_ns() + BLIP_MS * 1000000LL;
+    bool is_blipping = BLIP_MS > 0 && fan_count > 0;
 
-        l( INFO, "Monitoring GPIO pin: %d, Pulses per revolution: %d\n", bcm_gpio_pin_tach, tach_pulse_per_rev );
+    if( is_blipping ) {
 
-        tach_gpio_setup();
-        tach_polling_setup();
+        l( INFO, "Blipping %i fan(s) to full duty cycle for %ums...\n", fan_count, BLIP_MS );
+        pwm_set_max_duty_cycle_all();
     }
 
-    l( INFO, "Blipping to full duty cycle %i for 2s...\n", MAX_DUTY_CYCLE );
+    l( INFO, "Starting main loop CPU temp polling/PWM set at %ims sleep interval...\n", SLEEP_MS );
+
+    scheduler_setup();
 
-    // Blip fan to full duty cycle before start
-    pwm_set_max_duty_cycle();
-    sleep( 2 );
+    // Ahead of telemetry so its thread inherits the blocked signal mask
+    if( REACTOR ) { reactor_setup(); }
 
-    l( INFO, "2s fan blip finished! Starting main loop CPU temp polling/PWM set at %ins sleep interval...\n", SLEEP_MS );
+    // Telemetry and metrics start with the loop so the blip isn't logged
+    telemetry_setup();
+    metrics_setup();
+
+    if( CONFIG_FILE != NULL ) { config_watch_setup(); }
 
     ////////////////////////////////////////////////////////////////////////////////
     //
     //  Main loop
     //
-    struct timeval cur_epoch;
-    unsigned short duty_cycle_set_val;
-    float cur_temp_c;
-    float use_min_temp_c;
-    float grace_check_ms;
-    unsigned short decided_mode_int;
+    int cur_temp_mc;
+    int smooth_temp_mc;
+    unsigned int next_sleep_ms;
+    unsigned int band_sleep_ms;
+    unsigned int idle_sleep_ms;
+    unsigned int max_sleep_ms;
+    int ff_offset_mc;
+    int control_temp_mc;
+    int control_smooth_mc;
 
     while( ! halt_received ) {
 
-        cur_temp_c = get_cpu_temp_c();
+        // Config changes apply between ticks
+        if( reload_config_received ) {
+
+            config_reload();
+        }
+
+        // Deadline this tick woke for; jitter and latency are measured from here
+        tick_timing.deadline_ns = next_tick_deadline_ns;
+        tick_timing.start_ns    = monotonic_ns();
+        tick_timing.write_ns    = 0;
 
-        // Set fan to full if error reading CPU
-        if( cur_temp_c <= 0 ) {
+        // One sensor read per tick drives every fan
+        cur_temp_mc = get_cpu_temp_mc();
 
-            l( ERROR, "ERROR: Invalid CPU temp! Setting fan to full for safety and continuing...\n" );
-            pwm_set_max_duty_cycle();
+        // Set fans to full if error reading CPU
+        if( cur_temp_mc <= 0 ) {
+
+            l( ERROR, "ERROR: Invalid CPU temp! Setting fans to full for safety and continuing...\n" );
+            pwm_set_max_duty_cycle_all();
 
             // Sleep and continue
-            usleep( SLEEP_MS );
+            wait_for_next_tick( SLEEP_MS );
             continue;
         }
 
-        // Push temp to
+        // Warm-up only while blipping; the temp filter fills but the fans stay at full
+        if( is_blipping ) {
+
+            long long blip_remaining_ms = ( blip_end_ns - tick_timing.start_ns + 999999 ) / 1000000;
+
+            if( blip_remaining_ms > 0 ) {
+
+                wait_for_next_tick( blip_remaining_ms < SLEEP_MS ? blip_remaining_ms : SLEEP_MS );
+                continue;
+            }
+
+            is_blipping = false;
+            l( INFO, "Fan blip finished!\n" );
+        }
+
+        smooth_temp_mc = smooth_value( &cpu_temp_smooth );
+        band_sleep_ms  = EVENT_MAX_SLEEP_MS;
+
+        // Feed-forward leads both the band and curve inputs by the load step; telemetry and
+        //    metrics keep the sensor temps
+        ff_offset_mc      = FEEDFORWARD ? feedforward_offset_mc() : 0;
+        control_temp_mc   = cur_temp_mc + ff_offset_mc;
+        control_smooth_mc = smooth_temp_mc + ff_offset_mc;
+        idle_sleep_ms  = IDLE_SLEEP_MS;
+        max_sleep_ms   = 0;
+
+        // Peers get this host's own control temps and the fans every host's
+        if( fd_peer_publish >= 0 ) { peer_publish( control_temp_mc, control_smooth_mc ); }
 
-        duty_cycle_set_val = 0;
-        use_min_temp_c     = MIN_ON_TEMP_C;
+        if( fd_peer_listen >= 0 ) {
 
-        // If we're above min off temp then set last_above_min_epoch
-        if( cur_temp_c > use_min_temp_c ) {
+            long long now_ns = monotonic_ns();
 
-            gettimeofday( &last_above_min_epoch, NULL );
+            peers_drain( now_ns );
+            peers_aggregate( &control_temp_mc, &control_smooth_mc, now_ns );
         }
 
-        gettimeofday( &cur_epoch, NULL );
+        // Peers are only heard from every tick, and must hear from this host, well within
+        //    PEER_TIMEOUT_MS
+        if( fd_peer_publish >= 0 || fd_peer_listen >= 0 ) { max_sleep_ms = PEER_TIMEOUT_MS / 2; }
 
-        grace_check_ms = ( cur_epoch.tv_sec - last_above_min_epoch.tv_sec ) * 1000.0f + ( cur_epoch.tv_usec - last_above_min_epoch.tv_usec ) / 1000.0f;
+        tick_timing.read_ns = monotonic_ns();
 
-        // If we're below min temp and within fan off grace period set to min duty cycle
-        if( cur_temp_c <= use_min_temp_c && grace_check_ms < FAN_OFF_GRACE_MS ) {
+        for( int i = 0; i < fan_count; i++ ) {
 
-            duty_cycle_set_val = MIN_DUTY_CYCLE;
-            decided_mode_int   = FAN_BELOW_MIN;
+            Fan *fan = &fans[i];
 
-            l( DEBUG, CYAN "%.2f" RESET " BELOW_MIN use_min_temp_c - MIN_DUTY_CYCLE   ", cur_temp_c );
+            if( fan_count > 1 ) {
 
-        } else if( cur_temp_c <= use_min_temp_c ) {
+                l( DEBUG, "fan %i: ", i );
+            }
+
+            // RPM over the last tick; read first so the RPM loop can use it
+            if( fan->is_tach_enabled ) {
 
-            duty_cycle_set_val = 0;
-            decided_mode_int   = FAN_BELOW_OFF;
+                // Without the tach thread's timeout the stop check happens here, only when needed
+                if( REACTOR ) { tach_check_stopped( fan ); }
 
-            l( DEBUG, GREEN "%.2f" RESET " BELOW_OFF use_min_temp_c - OFF              ", cur_temp_c );
+                fan->tach_rpm = tach_window_rpm( fan );
 
-        } else if( cur_temp_c >= MAX_TEMP_C ) {
+                fan_stall_check( fan, monotonic_ns() );
+            }
 
-            duty_cycle_set_val = MAX_DUTY_CYCLE;
-            decided_mode_int   = FAN_ABOVE_MAX;
+            fan_control_tick( fan, control_temp_mc, control_smooth_mc );
 
-            l( DEBUG, RED "%.2f" RESET " ABOVE_MAX MAX_TEMP_C - MAX_DUTY_CYCLE       ", cur_temp_c );
+            // Output tachometer if needed
+            if( fan->is_tach_enabled ) {
 
-        } else {
+                l( DEBUG, " - RPM = " CYAN "%u" RESET, fan->tach_rpm );
+            }
 
-            duty_cycle_set_val = quartic_bezier_easing( get_cpu_temp_avg_c(), MIN_OFF_TEMP_C, MAX_TEMP_C, MIN_DUTY_CYCLE, MAX_DUTY_CYCLE );
-            decided_mode_int   = FAN_ABOVE_EAS;
+            // Event mode may only sleep as long as the soonest band edge of any fan
+            if( EVENT_MODE ) {
 
-            l( DEBUG, YELLOW "%.2f" RESET " ABOVE_EAS MAX_TEMP_C - quartic_bezier_easing", cur_temp_c );
-        }
+                unsigned int fan_band_sleep_ms = event_band_sleep_ms( fan, control_temp_mc );
+
+                if( fan_band_sleep_ms < band_sleep_ms ) { band_sleep_ms = fan_band_sleep_ms; }
+            }
 
-        pwm_set_duty_cycle( duty_cycle_set_val );
-        l( DEBUG, " - DC = " MAGENTA "%i" RESET, duty_cycle_set_val );
+            // Power save may only idle while every fan is idle
+            if( POWER_SAVE ) {
 
-        // Handle CSV logging
-        if( csv_debug_logging_enabled ) {
+                unsigned int fan_idle_sleep_ms = power_save_idle_sleep_ms( fan, control_temp_mc );
 
-            printf( "%.2f,%s,%i", cur_temp_c, get_fan_mode_str( decided_mode_int ), duty_cycle_set_val );
+                if( fan_idle_sleep_ms < idle_sleep_ms ) { idle_sleep_ms = fan_idle_sleep_ms; }
+            }
+
+            unsigned int fan_stall_sleep_ms = stall_sleep_ms( fan, monotonic_ns() );
 
-            if( is_tach_enabled ) {
+            if( fan_stall_sleep_ms > 0 && ( max_sleep_ms == 0 || fan_stall_sleep_ms < max_sleep_ms ) ) { max_sleep_ms = fan_stall_sleep_ms; }
 
-                printf( ",%u", tach_rpm );
+            if( i < fan_count - 1 ) {
+
+                l( DEBUG, "\n" );
             }
+        }
+
+        tick_timing.done_ns = monotonic_ns();
+
+        // Queue telemetry for the writer thread
+        telemetry_push( cur_temp_mc, smooth_temp_mc, &tick_timing );
+
+        next_sleep_ms = scheduler_adaptive_interval_ms( cur_temp_mc );
+
+        // Event mode may sleep longer while the temp is far from a band edge
+        if( EVENT_MODE && band_sleep_ms > next_sleep_ms ) {
+
+            next_sleep_ms = band_sleep_ms;
+        }
+
+        // Power save backs off to IDLE_SLEEP_MS in deep idle, which also bounds the reaction time
+        if( POWER_SAVE && idle_sleep_ms > next_sleep_ms ) {
+
+            next_sleep_ms = idle_sleep_ms;
+        }
+
+        // Stall detection bounds any longer sleep either allowed
+        if( max_sleep_ms > 0 && next_sleep_ms > max_sleep_ms ) {
+
+            next_sleep_ms = max_sleep_ms;
+        }
 
-            printf( "\n" );
+        // Publish for the metrics thread and SIGUSR1
+        metrics_record_tick( cur_temp_mc, smooth_temp_mc, &tick_timing, next_sleep_ms );
+
+        if( dump_stats_received ) {
+
+            metrics_log_stats();
+        }
+
+        if( FEEDFORWARD ) {
+
+            l( DEBUG, " - FF = %c" MC_FMT, ff_offset_mc < 0 ? '-' : '+', MC_FMT_ARGS( abs( ff_offset_mc ) ) );
+        }
+
+        if( fd_peer_listen >= 0 ) {
+
+            l( DEBUG, " - peers = %u fresh%s", atomic_load_explicit( &metrics.peers_fresh, memory_order_relaxed ), is_peer_stale ? ", " RED "stale" RESET : "" );
         }
 
-        // Output tachometer if needed
-        if( is_tach_enabled ) {
+        if( next_sleep_ms != SLEEP_MS ) {
 
-            l( DEBUG, " - RPM = " CYAN "%i" RESET, tach_rpm );
-            tach_rpm = 0;
+            l( DEBUG, " - sleep = %ums", next_sleep_ms );
         }
 
         l( DEBUG, "\n" );
 
-        usleep( SLEEP_MS * 1000 );
+        // A fan fault with STALL_EXIT exits right away
+        if( halt_received ) { break; }
+
+        wait_for_next_tick( next_sleep_ms );
     }
 
     l( INFO, "Halt recieved!\n" );
 
     if( is_setup ) {
 
-        l( INFO, "Setting to MAX_DUTY_CYCLE %i before exit...\n", MAX_DUTY_CYCLE );
-        pwm_set_max_duty_cycle();
+        l( INFO, "Setting fans to MAX_DUTY_CYCLE before exit...\n" );
+        pwm_set_max_duty_cycle_all();
     }
 
-    if( is_tach_enabled ) {
+    for( int i = 0; i < fan_count; i++ ) {
+
+        l( INFO, "Fan %i PWM duty cycle writes: %lu written, %lu skipped as unchanged\n", i, atomic_load( &fans[i].pwm_duty_cycle_writes ), atomic_load( &fans[i].pwm_duty_cycle_writes_skipped ) );
+    }
 
-        l( INFO, "Waiting for tachometer polling thread to finish...\n" );
+    metrics_log_stats();
+
+    if( telemetry_format != TELEMETRY_OFF ) {
+
+        // Unpark the writer for its last drain
+        eventfd_write( fd_telemetry_wake, 1 );
+        pthread_join( telemetry_thread, NULL );
+
+        l( INFO, "Telemetry samples dropped on a full ring: %lu\n", telemetry_dropped );
+    }
 
-        pthread_join( polling_thread_tach, NULL );
+    if( is_tach_enabled && ! REACTOR ) {
 
-        l( INFO, "Tachometer polling thread to finished!\n" );
+        tach_polling_stop();
     }
 
-    clean_up_and_exit( 0 );
+    clean_up_and_exit( fan_fault_exit ? EXIT_FAN_FAULT : 0 );
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,303 @@
+#!/bin/bash
+
+# Regression tests for pwm_fan_control2 against the fake sysfs backend; runs off-Pi as any user
+# - Needs `make compile fake` first (`make test` does both) and localhost TCP/UDP ports 9791-9799
+# - Usage: ./test.sh [TEST...] where TEST is reload, metrics, reactor_metrics, stall_exit,
+#   replay or peers (default: all)
+
+cd "$( dirname "$0" )" || exit 1
+
+CONTROL=./pwm_fan_control2
+FAKE=./pwm_fan_fake_sysfs
+WORK_DIR=$( mktemp -d /tmp/pwm_fan_test.XXXXXX )
+
+PASS_COUNT=0
+FAIL_COUNT=0
+FAKE_PIDS=()
+CONTROL_PID=
+CONTROL_STATUS=
+
+# Runs only see the settings each test sets, and never touch the host's cache or calibration
+for var in $( compgen -e | grep '^PWM_FAN_' ); do unset "$var"; done
+
+export PWM_FAN_TOPOLOGY_CACHE=
+export PWM_FAN_CALIBRATION_FILE=
+export PWM_FAN_BLIP_MS=0
+
+clean_up() {
+
+    [ -n "$CONTROL_PID" ] && kill -INT "$CONTROL_PID" 2>/dev/null
+    [ ${#FAKE_PIDS[@]} -gt 0 ] && kill "${FAKE_PIDS[@]}" 2>/dev/null
+    wait 2>/dev/null
+
+    rm -rf "$WORK_DIR"
+}
+
+trap clean_up EXIT
+
+pass() {
+
+    echo "PASS: $1"
+    PASS_COUNT=$(( PASS_COUNT + 1 ))
+}
+
+# Failures show the end of the log that explains them
+fail() {
+
+    echo "FAIL: $1"
+    FAIL_COUNT=$(( FAIL_COUNT + 1 ))
+
+    if [ -n "$2" ] && [ -f "$2" ]; then
+
+        tail -n 15 "$2" | sed 's/^/    /'
+    fi
+}
+
+# Start a fake tree at WORK_DIR/NAME and wait for it to be populated
+fake_start() {
+
+    local root="$WORK_DIR/$1"
+    shift
+
+    $FAKE --root "$root" "$@" > "$root.fake.log" 2>&1 &
+    FAKE_PIDS+=( $! )
+
+    for i in $( seq 50 ); do
+
+        [ -f "$root/class/thermal/thermal_zone0/temp" ] && return 0
+        sleep 0.1
+    done
+
+    echo "Fake tree $root never came up"
+    return 1
+}
+
+# Stop every fake tree
+fake_stop() {
+
+    kill "${FAKE_PIDS[@]}" 2>/dev/null
+    wait "${FAKE_PIDS[@]}" 2>/dev/null
+    FAKE_PIDS=()
+}
+
+# Start a command on the fake tree at WORK_DIR/NAME with its output in WORK_DIR/NAME.log,
+#    ie: `control_start reload PWM_FAN_SLEEP_MS=250 $CONTROL debug 24 2`
+control_start() {
+
+    local name="$1"
+    shift
+
+    env PWM_FAN_SYSFS_ROOT="$WORK_DIR/$name" "$@" > "$WORK_DIR/$name.log" 2>&1 &
+    CONTROL_PID=$!
+}
+
+# Halt the controller and keep its exit status in CONTROL_STATUS
+control_stop() {
+
+    kill -INT "$CONTROL_PID" 2>/dev/null
+    wait "$CONTROL_PID"
+    CONTROL_STATUS=$?
+    CONTROL_PID=
+}
+
+# Wait up to SECONDS for PATTERN to show up COUNT times (default 1) in WORK_DIR/NAME.log
+wait_for_log() {
+
+    local log="$WORK_DIR/$1.log" pattern="$2" seconds="$3" count="${4:-1}"
+
+    for i in $( seq $(( seconds * 10 )) ); do
+
+        [ "$( grep -a -c -- "$pattern" "$log" 2>/dev/null )" -ge "$count" ] && return 0
+        sleep 0.1
+    done
+
+    return 1
+}
+
+# Scrape metrics from a localhost port over HTTP, or as bare text when `plain` is given; a
+#    plain client sends nothing and relies on the server answering anyway
+scrape() {
+
+    timeout 3 bash -c '
+        exec 3<>/dev/tcp/127.0.0.1/'"$1"' || exit 1
+        [ "'"$2"'" != plain ] && printf "GET /metrics HTTP/1.0\r\n\r\n" >&3
+        cat <&3' 2>/dev/null
+}
+
+# Hot reload from a config file save and SIGHUP; an invalid config is rejected and the
+#    running one kept
+test_reload() {
+
+    local cfg="$WORK_DIR/reload.cfg"
+
+    echo "PWM_FAN_SLEEP_MS=250" > "$cfg"
+
+    fake_start reload --temp 41 --tach 24 || return
+    control_start reload PWM_FAN_CONFIG_FILE="$cfg" $CONTROL debug 24 2
+
+    wait_for_log reload "DC =" 5 || { fail "reload: controller ticking" "$WORK_DIR/reload.log"; control_stop; fake_stop; return; }
+
+    # Save a new file in place, like an editor would
+    echo "PWM_FAN_MAX_TEMP_C=45" > "$cfg.new" && mv "$cfg.new" "$cfg"
+
+    if wait_for_log reload "Config reloaded" 5; then pass "reload: file save applied"; else fail "reload: file save applied" "$WORK_DIR/reload.log"; fi
+
+    echo "PWM_FAN_MIN_DUTY_CYCLE=200" > "$cfg.new" && mv "$cfg.new" "$cfg"
+
+    if wait_for_log reload "Config reload rejected" 5; then pass "reload: invalid config rejected"; else fail "reload: invalid config rejected" "$WORK_DIR/reload.log"; fi
+
+    echo "PWM_FAN_MAX_TEMP_C=44" > "$cfg"
+    kill -HUP "$CONTROL_PID"
+
+    if wait_for_log reload "Config reloaded" 5 2; then pass "reload: SIGHUP applied"; else fail "reload: SIGHUP applied" "$WORK_DIR/reload.log"; fi
+
+    control_stop
+    fake_stop
+
+    if [ "$CONTROL_STATUS" = 0 ]; then pass "reload: clean exit"; else fail "reload: clean exit (status $CONTROL_STATUS)" "$WORK_DIR/reload.log"; fi
+}
+
+# Metrics over HTTP and from a client that never sends a request, in thread or reactor mode
+check_metrics() {
+
+    local name="$1" port="$2" reactor="$3"
+
+    fake_start "$name" --temp 41 --tach 24 || return
+    control_start "$name" PWM_FAN_METRICS_PORT="$port" PWM_FAN_REACTOR="$reactor" $CONTROL debug 24 2
+
+    # A few ticks in, so the tachometer has a reading
+    wait_for_log "$name" "DC =" 5 4
+
+    local http plain
+    http=$( scrape "$port" )
+    plain=$( scrape "$port" plain )
+
+    if echo "$http" | grep -q "^HTTP/1.0 200 OK" && echo "$http" | grep -q '^pwm_fan_ticks_total [1-9]' && echo "$http" | grep -q '^pwm_fan_rpm{fan="0"} [1-9]'; then
+
+        pass "$name: HTTP scrape"
+
+    else
+
+        fail "$name: HTTP scrape" "$WORK_DIR/$name.log"
+    fi
+
+    if echo "$plain" | grep -q '^pwm_fan_duty_cycle_percent{fan="0"} [0-9]' && ! echo "$plain" | grep -q "^HTTP"; then
+
+        pass "$name: scrape without a request"
+
+    else
+
+        fail "$name: scrape without a request" "$WORK_DIR/$name.log"
+    fi
+
+    control_stop
+    fake_stop
+}
+
+test_metrics()         { check_metrics metrics 9791 0; }
+test_reactor_metrics() { check_metrics reactor_metrics 9792 1; }
+
+# A fan that seizes and stays seized through its kick-starts exits with status 3
+test_stall_exit() {
+
+    fake_start stall_exit --temp 50 --tach 24 --seize 300 || return
+    control_start stall_exit PWM_FAN_STALL_DETECT_MS=500 PWM_FAN_KICK_MS=300 PWM_FAN_STALL_KICKS=1 PWM_FAN_STALL_EXIT=1 $CONTROL debug 24 2
+
+    for i in $( seq 100 ); do
+
+        kill -0 "$CONTROL_PID" 2>/dev/null || break
+        sleep 0.1
+    done
+
+    control_stop
+    fake_stop
+
+    if [ "$CONTROL_STATUS" = 3 ]; then pass "stall_exit: exit status 3"; else fail "stall_exit: exit status 3 (got $CONTROL_STATUS)" "$WORK_DIR/stall_exit.log"; fi
+}
+
+# A recorded run replays to the same modes, duty cycles and RPM
+test_replay() {
+
+    local trace="$WORK_DIR/replay_trace.csv" out="$WORK_DIR/replay_out.csv"
+
+    printf '0 38\n1000 38\n2500 47\n3500 43\n' > "$WORK_DIR/replay_temps.txt"
+
+    fake_start replay --temp-script "$WORK_DIR/replay_temps.txt" --tach 24 || return
+    control_start replay PWM_FAN_SLEEP_MS=100 PWM_FAN_SLEEP_MIN_MS=100 PWM_FAN_SLEEP_MAX_MS=100 PWM_FAN_TELEMETRY=csv PWM_FAN_TELEMETRY_FILE="$trace" $CONTROL debug 24 2
+
+    sleep 4
+    control_stop
+    fake_stop
+
+    PWM_FAN_SLEEP_MS=100 PWM_FAN_SLEEP_MIN_MS=100 PWM_FAN_SLEEP_MAX_MS=100 $CONTROL replay "$trace" "$out" > "$WORK_DIR/replay_run.log" 2>&1
+
+    local samples
+    samples=$( tail -n +2 "$trace" | wc -l )
+
+    if [ "$samples" -gt 10 ] && diff <( cut -d, -f1-4 "$trace" ) <( cut -d, -f1-4 "$out" ) > "$WORK_DIR/replay.diff"; then
+
+        pass "replay: $samples samples round-trip"
+
+    else
+
+        fail "replay: round-trip ($samples samples)" "$WORK_DIR/replay.diff"
+    fi
+}
+
+# A publisher's hotter temp drives the owner's fan over loopback; losing it holds the fan at max
+test_peers() {
+
+    fake_start peers_owner --temp 38 --tach 24 || return
+    fake_start peers_pub --temp 50 || return
+
+    control_start peers_owner PWM_FAN_PEER_LISTEN=udp:127.0.0.1:9797 PWM_FAN_PEER_EXPECT=1 PWM_FAN_PEER_TIMEOUT_MS=1000 PWM_FAN_METRICS_PORT=9798 $CONTROL debug 24 2
+    local owner_pid=$CONTROL_PID
+
+    control_start peers_pub PWM_FAN_FANS=0 PWM_FAN_PEER_PUBLISH=udp:127.0.0.1:9797 PWM_FAN_PEER_ID=pub PWM_FAN_PEER_TIMEOUT_MS=1000 $CONTROL
+    local pub_pid=$CONTROL_PID
+
+    if wait_for_log peers_owner 'Peer "pub" joined' 5 && wait_for_log peers_owner "ABOVE_MAX" 5; then
+
+        pass "peers: publisher's temp drives the owner"
+
+    else
+
+        fail "peers: publisher's temp drives the owner" "$WORK_DIR/peers_owner.log"
+    fi
+
+    if scrape 9798 | grep -q '^pwm_fan_peers{state="fresh"} 1'; then pass "peers: fresh peer metric"; else fail "peers: fresh peer metric" "$WORK_DIR/peers_owner.log"; fi
+
+    CONTROL_PID=$pub_pid
+    control_stop
+
+    if wait_for_log peers_owner "Peers stale" 5; then pass "peers: lost publisher holds the fan"; else fail "peers: lost publisher holds the fan" "$WORK_DIR/peers_owner.log"; fi
+
+    CONTROL_PID=$owner_pid
+    control_stop
+    fake_stop
+}
+
+if [ ! -x "$CONTROL" ] || [ ! -x "$FAKE" ]; then
+
+    echo "Build the controller and the fake backend first: make compile fake"
+    exit 1
+fi
+
+TESTS=( "$@" )
+[ ${#TESTS[@]} -eq 0 ] && TESTS=( reload metrics reactor_metrics stall_exit replay peers )
+
+for test_name in "${TESTS[@]}"; do
+
+    if ! declare -F "test_$test_name" > /dev/null; then
+
+        fail "$test_name: no such test"
+        continue
+    fi
+
+    echo "Running $test_name..."
+    "test_$test_name"
+done
+
+echo "$PASS_COUNT passed, $FAIL_COUNT failed"
+
+[ "$FAIL_COUNT" -eq 0 ]